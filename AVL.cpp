@@ -0,0 +1,944 @@
+/**
+ * @file AVL.cpp
+ * @brief This file contains the AVL tree class definition
+ *        (included from AVL.h since the class is a template)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+template <typename T>
+void AVL<T>::add(const T& value) {
+    // trace the path down to the empty spot
+    PathStack pathNodes;
+    typename BST<T>::BinTree* link = &this->getRoot();
+    while (*link) {
+        typename BST<T>::BinTree node = *link;
+        if (!(value < node->data) && !(node->data < value))
+            throw BSTException(BSTException::E_DUPLICATE, "add: Value is already in the tree.");
+        pathNodes.push(link);
+        link = value < node->data ? &node->left : &node->right;
+    }
+
+    // the new node goes in before anything on the path changes, in case it throws
+    *link = makeLeaf(value);
+
+    // every node on the path has one more node under it
+    for (unsigned i = 0; i < pathNodes.size; ++i)
+        ++(*pathNodes.links[i])->count;
+    balance(pathNodes, link, true);
+}
+
+template <typename T>
+void AVL<T>::remove(const T& value) {
+    // trace the path down to the value
+    PathStack pathNodes;
+    typename BST<T>::BinTree* link = &this->getRoot();
+    while (*link && ((value < (*link)->data) || ((*link)->data < value))) {
+        pathNodes.push(link);
+        link = value < (*link)->data ? &(*link)->left : &(*link)->right;
+    }
+    if (!*link)
+        throw BSTException(BSTException::E_NOT_FOUND, "remove: Value is not in the tree.");
+
+    // a node with two children takes its predecessor's value, and the predecessor goes instead
+    typename BST<T>::BinTree node = *link;
+    if (node->left && node->right) {
+        pathNodes.push(link);
+        link = &node->left;
+        while ((*link)->right) {
+            pathNodes.push(link);
+            link = &(*link)->right;
+        }
+        node->data = (*link)->data;
+    }
+
+    // the node has one child at most, which takes its place
+    typename BST<T>::BinTree removed = *link;
+    *link = removed->left ? removed->left : removed->right;
+    removed->~BinTreeNode();
+    this->getAllocator()->free(removed);
+
+    // every node on the path has one node less under it
+    for (unsigned i = 0; i < pathNodes.size; ++i)
+        --(*pathNodes.links[i])->count;
+    balance(pathNodes, link, false);
+}
+
+template <typename T>
+std::stringstream AVL<T>::printInorder() const {
+    std::stringstream ss;
+    printInorder_(this->root(), ss);
+    return ss;
+}
+
+template <typename T>
+template <bool Reverse>
+void AVL<T>::basic_iterator<Reverse>::step(bool right) {
+    if (!size_) {
+        descend(root_, !right);
+        return;
+    }
+    const typename BST<T>::BinTreeNode* node = path_[size_ - 1];
+    const typename BST<T>::BinTreeNode* child = right ? node->right : node->left;
+    if (child) {
+        descend(child, !right);
+        return;
+    }
+
+    // climb while the path comes up from that side (those values are all done)
+    do {
+        child = path_[--size_];
+    } while (size_ && (right ? path_[size_ - 1]->right : path_[size_ - 1]->left) == child);
+}
+
+template <typename T>
+typename AVL<T>::const_iterator AVL<T>::begin() const {
+    const_iterator it(this->root());
+    it.descend(this->root(), false);
+    return it;
+}
+
+template <typename T>
+typename AVL<T>::const_reverse_iterator AVL<T>::rbegin() const {
+    const_reverse_iterator it(this->root());
+    it.descend(this->root(), true);
+    return it;
+}
+
+template <typename T>
+typename AVL<T>::const_iterator AVL<T>::lower_bound(const T& value) const {
+    return bound(value, true);
+}
+
+template <typename T>
+typename AVL<T>::const_iterator AVL<T>::upper_bound(const T& value) const {
+    return bound(value, false);
+}
+
+template <typename T>
+typename AVL<T>::const_iterator AVL<T>::bound(const T& value, bool orEqual) const {
+    const_iterator it(this->root());
+    unsigned found = 0; // path size up to the last node where the walk went left (0 if none)
+    for (typename BST<T>::BinTree tree = this->root(); tree;) {
+        it.path_[it.size_++] = tree;
+        if (orEqual ? !(tree->data < value) : value < tree->data) {
+            found = it.size_;
+            tree = tree->left;
+        } else {
+            tree = tree->right;
+        }
+    }
+    it.size_ = found;
+    return it;
+}
+
+template <typename T>
+unsigned AVL<T>::countBelow(const T& value, bool orEqual) const {
+    // every time the walk goes right, the left subtree and the node are counted
+    unsigned below = 0;
+    typename BST<T>::BinTree tree = this->root();
+    while (tree) {
+        const unsigned leftCount = tree->left ? tree->left->count : 0;
+        if (value < tree->data) {
+            tree = tree->left;
+        } else if (orEqual || tree->data < value) {
+            below += leftCount + 1;
+            tree = tree->right;
+        } else {
+            return below + leftCount;
+        }
+    }
+    return below;
+}
+
+template <typename T>
+template <typename InputIt>
+void AVL<T>::buildFromSorted(InputIt first, InputIt last) {
+    // batches are cut to what is left when that is known, so that the allocator is not asked for more nodes
+    size_t remaining = std::numeric_limits<size_t>::max();
+    if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                  typename std::iterator_traits<InputIt>::iterator_category>::value)
+        remaining = static_cast<size_t>(std::distance(first, last));
+
+    // construct the values in order in nodes taken a batch at a time, chaining them through their right pointers
+    SimpleAllocator* allocator = this->getAllocator();
+    typename BST<T>::BinTree head = nullptr;
+    typename BST<T>::BinTree tail = nullptr;
+    unsigned count = 0;
+    void* batch[CLEAR_BATCH_SIZE];
+    unsigned batchSize = 0;
+    unsigned batchUsed = 0;
+    try {
+        for (; first != last; ++first) {
+            if (tail && !(tail->data < *first))
+                throw BSTException(BSTException::E_DUPLICATE, "buildFromSorted: Values are not strictly increasing.");
+            if (batchUsed == batchSize) {
+                batchSize = static_cast<unsigned>(std::min<size_t>(CLEAR_BATCH_SIZE, remaining - count));
+                batchUsed = 0;
+                try {
+                    allocator->allocateBatch(batch, batchSize);
+                } catch (const SimpleAllocatorException& e) {
+                    batchSize = 0;
+                    throw BSTException(BSTException::E_NO_MEMORY, e.what());
+                }
+            }
+            typename BST<T>::BinTree node = new (batch[batchUsed]) typename BST<T>::BinTreeNode(*first);
+            ++batchUsed;
+            (tail ? tail->right : head) = node;
+            tail = node;
+            ++count;
+        }
+    } catch (...) {
+        // the old tree is untouched, only the new nodes (and the rest of the batch) go back
+        while (head) {
+            typename BST<T>::BinTree next = head->right;
+            head->~BinTreeNode();
+            allocator->free(head);
+            head = next;
+        }
+        allocator->freeBatch(batch + batchUsed, batchSize - batchUsed);
+        throw;
+    }
+    allocator->freeBatch(batch + batchUsed, batchSize - batchUsed);
+
+    // only now does the old tree go
+    int height;
+    typename BST<T>::BinTree root = linkSorted(head, count, height);
+    clear();
+    this->getRoot() = root;
+    height_ = height;
+}
+
+template <typename T>
+template <typename InputIt>
+void AVL<T>::assign(InputIt first, InputIt last) {
+    std::vector<T> values(first, last);
+    sortUnique(values);
+    buildFromSorted(values.begin(), values.end());
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::linkSorted(typename BST<T>::BinTree& list, unsigned size, int& height) {
+    if (!size) {
+        height = -1;
+        return nullptr;
+    }
+
+    // the left half, then the middle node, then the right half, all in list order
+    int leftHeight, rightHeight;
+    const unsigned leftSize = size / 2;
+    typename BST<T>::BinTree left = linkSorted(list, leftSize, leftHeight);
+    typename BST<T>::BinTree tree = list;
+    list = list->right;
+    tree->left = left;
+    tree->right = linkSorted(list, size - leftSize - 1, rightHeight);
+
+    tree->count = size;
+    tree->balanceFactor = rightHeight - leftHeight;
+    height = 1 + std::max(leftHeight, rightHeight);
+    return tree;
+}
+
+template <typename T>
+void AVL<T>::sortUnique(std::vector<T>& values) {
+    const unsigned threads = std::min(std::thread::hardware_concurrency(), 16u);
+    if (values.size() < PARALLEL_SORT_MIN_SIZE || threads < 2) {
+        std::sort(values.begin(), values.end());
+    } else {
+        // slice i is [slice(i), slice(i + 1))
+        auto slice = [&values, threads](unsigned i) {
+            return values.begin() + values.size() * std::min(i, threads) / threads;
+        };
+
+        // run the tasks of a round on their own threads (the first one on this thread)
+        std::vector<std::thread> workers;
+        auto runRound = [&workers](unsigned tasks, auto task) {
+            try {
+                for (unsigned i = 1; i < tasks; ++i)
+                    workers.emplace_back(task, i);
+            } catch (...) {
+                for (std::thread& worker : workers)
+                    worker.join();
+                throw;
+            }
+            task(0);
+            for (std::thread& worker : workers)
+                worker.join();
+            workers.clear();
+        };
+
+        // sort every slice, then merge neighbouring runs, doubling their width every round
+        runRound(threads, [&slice](unsigned i) { std::sort(slice(i), slice(i + 1)); });
+        for (unsigned width = 1; width < threads; width *= 2) {
+            runRound((threads + 2 * width - 1) / (2 * width), [&slice, width](unsigned i) {
+                const unsigned run = 2 * width * i;
+                std::inplace_merge(slice(run), slice(run + width), slice(run + 2 * width));
+            });
+        }
+    }
+
+    auto equal = [](const T& lhs, const T& rhs) { return !(lhs < rhs) && !(rhs < lhs); };
+    values.erase(std::unique(values.begin(), values.end(), equal), values.end());
+}
+
+template <typename T>
+const T& AVL<T>::select(unsigned k) const {
+    if (k >= size())
+        throw BSTException(BSTException::E_NOT_FOUND, "select: Position is not less than the size of the tree.");
+
+    // skip whole left subtrees (and their parents) until the k-th value is the node itself
+    typename BST<T>::BinTree tree = this->root();
+    for (;;) {
+        const unsigned leftCount = tree->left ? tree->left->count : 0;
+        if (k < leftCount) {
+            tree = tree->left;
+        } else if (k == leftCount) {
+            return tree->data;
+        } else {
+            k -= leftCount + 1;
+            tree = tree->right;
+        }
+    }
+}
+
+template <typename T>
+unsigned AVL<T>::rank(const T& value) const {
+    return countBelow(value, false);
+}
+
+template <typename T>
+const T& AVL<T>::percentile(double percent) const {
+    const unsigned count = size();
+    if (!count)
+        throw BSTException(BSTException::E_NOT_FOUND, "percentile: Tree is empty.");
+    if (!(percent >= 0 && percent <= 100))
+        throw BSTException(BSTException::E_NOT_FOUND, "percentile: Percentile is not between 0 and 100.");
+
+    // nearest rank: the ceil(percent * count / 100)-th value, counting from 1
+    // - multiplying first keeps the product exact for a whole percent, so the division
+    //   cannot round a whole rank up past itself (7 / 100 * 100 would give 8)
+    const double rank = std::ceil(percent * count / 100);
+    return select(rank < 1 ? 0 : static_cast<unsigned>(rank) - 1);
+}
+
+template <typename T>
+const T& AVL<T>::median() const {
+    if (!size())
+        throw BSTException(BSTException::E_NOT_FOUND, "median: Tree is empty.");
+    return select((size() - 1) / 2);
+}
+
+template <typename T>
+bool AVL<T>::split(const T& value, AVL& greater) {
+    // the copies for another allocator are taken before anything changes
+    SimpleAllocator* allocator = this->getAllocator();
+    SimpleAllocator* otherAllocator = greater.getAllocator();
+    SetOperation op;
+    if (otherAllocator != allocator) {
+        const unsigned smaller = rank(value);
+        const bool found = smaller < size() && !(value < select(smaller));
+        reserveSlots(op, otherAllocator, size() - smaller - found);
+    }
+    greater.clear();
+
+    typename BST<T>::BinTree left, right;
+    int leftHeight, rightHeight;
+    typename BST<T>::BinTree found = split(this->getRoot(), height_, value, left, leftHeight, right, rightHeight);
+    this->getRoot() = left;
+    height_ = leftHeight;
+    if (otherAllocator != allocator) {
+        typename BST<T>::BinTree copy = copyOf(op, right);
+        releaseNodes(right);
+        right = copy;
+    }
+    greater.getRoot() = right;
+    greater.height_ = rightHeight;
+    releaseNodes(found);
+    return found != nullptr;
+}
+
+template <typename T>
+void AVL<T>::join(const T& value, AVL& greater) {
+    const bool hasGreater = &greater != this && !greater.empty();
+    if ((!this->empty() && !(select(size() - 1) < value)) || (hasGreater && !(value < greater.select(0))))
+        throw BSTException(BSTException::E_DUPLICATE, "join: Values are not in increasing order.");
+
+    // the new nodes are taken before anything changes
+    SimpleAllocator* allocator = this->getAllocator();
+    SetOperation op;
+    const bool copies = hasGreater && greater.getAllocator() != allocator;
+    if (copies)
+        reserveSlots(op, allocator, greater.size());
+    typename BST<T>::BinTree middle;
+    try {
+        middle = makeLeaf(value);
+    } catch (...) {
+        releaseSlots(op, allocator);
+        throw;
+    }
+
+    typename BST<T>::BinTree right = nullptr;
+    int rightHeight = -1;
+    if (hasGreater) {
+        right = copies ? copyOf(op, greater.root()) : greater.root();
+        rightHeight = greater.height_;
+        if (copies)
+            greater.clear();
+        greater.getRoot() = nullptr;
+        greater.height_ = -1;
+    }
+    this->getRoot() = join(this->getRoot(), height_, middle, right, rightHeight, height_);
+}
+
+template <typename T>
+void AVL<T>::unionWith(const AVL& other) {
+    if (&other == this)
+        return;
+
+    // a node for every value of the other tree, in case they are all new
+    SimpleAllocator* allocator = this->getAllocator();
+    SetOperation op;
+    op.idleThreads = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    reserveSlots(op, allocator, other.size());
+    this->getRoot() = unionOf(op, this->getRoot(), height_, other.root(), other.height_, height_);
+    releaseSlots(op, allocator);
+}
+
+template <typename T>
+void AVL<T>::intersectWith(const AVL& other) {
+    if (&other == this)
+        return;
+
+    SetOperation op;
+    op.idleThreads = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    NodeList released;
+    this->getRoot() = intersectionOf(op, this->getRoot(), height_, other.root(), other.height_, released, height_);
+    releaseNodes(released.head);
+}
+
+template <typename T>
+void AVL<T>::difference(const AVL& other) {
+    if (&other == this) {
+        clear();
+        return;
+    }
+
+    SetOperation op;
+    op.idleThreads = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    NodeList released;
+    this->getRoot() = differenceOf(op, this->getRoot(), height_, other.root(), other.height_, released, height_);
+    releaseNodes(released.head);
+}
+
+template <typename T>
+unsigned AVL<T>::findMany(const T* values, size_t count, bool* results) const {
+    // the group: the node each lookup is at and the value it is for
+    const typename BST<T>::BinTreeNode* nodes[FIND_GROUP_SIZE];
+    size_t lookups[FIND_GROUP_SIZE];
+    const typename BST<T>::BinTreeNode* root = this->root();
+    prefetch(root);
+    size_t next = 0;
+    unsigned active = 0;
+    for (; active < FIND_GROUP_SIZE && next < count; ++active, ++next) {
+        nodes[active] = root;
+        lookups[active] = next;
+    }
+
+    // one step of every lookup per round, so each has a round to wait for its prefetch
+    unsigned found = 0;
+    while (active) {
+        for (unsigned i = 0; i < active;) {
+            const typename BST<T>::BinTreeNode* node = nodes[i];
+            const T& value = values[lookups[i]];
+            if (node && ((value < node->data) | (node->data < value))) {
+                // - both children are loaded so that picking one is a conditional move, not a branch
+                const typename BST<T>::BinTreeNode* left = node->left;
+                const typename BST<T>::BinTreeNode* right = node->right;
+                node = value < node->data ? left : right;
+                prefetch(node);
+                nodes[i] = node;
+                ++i;
+                continue;
+            }
+
+            // - the lookup is over: the next value takes its place, or the last lookup does
+            results[lookups[i]] = node != nullptr;
+            found += node != nullptr;
+            if (next < count) {
+                nodes[i] = root;
+                lookups[i] = next++;
+                ++i;
+            } else {
+                --active;
+                nodes[i] = nodes[active];
+                lookups[i] = lookups[active];
+            }
+        }
+    }
+    return found;
+}
+
+template <typename T>
+unsigned AVL<T>::countInRange(const T& lo, const T& hi) const {
+    if (hi < lo)
+        return 0;
+    return countBelow(hi, true) - countBelow(lo, false);
+}
+
+template <typename T>
+template <typename Visitor>
+bool AVL<T>::forEachInRange(const T& lo, const T& hi, Visitor visitor) const {
+    for (const_iterator it = lower_bound(lo), last = end(); it != last && !(hi < *it); ++it) {
+        if constexpr (std::is_void<decltype(visitor(*it))>::value) {
+            visitor(*it);
+        } else if (!visitor(*it)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+void AVL<T>::printInorder_(const typename BST<T>::BinTree& tree, std::stringstream& ss) const {
+    if (!tree)
+        return;
+    printInorder_(tree->left, ss);
+    ss << tree->data << " ";
+    printInorder_(tree->right, ss);
+}
+
+template <typename T>
+void AVL<T>::balance(PathStack& pathNodes, typename BST<T>::BinTree* link, bool grew) {
+    while (pathNodes.size) {
+        typename BST<T>::BinTree* parentLink = pathNodes.links[--pathNodes.size];
+        typename BST<T>::BinTree parent = *parentLink;
+
+        // the side of link got a level taller (add) or lower (remove)
+        parent->balanceFactor += (link == &parent->left) == grew ? -1 : 1;
+
+        if (grew) {
+            // the parent absorbed it: its height is unchanged
+            if (parent->balanceFactor == 0)
+                return;
+
+            // the rotation brings the subtree back to its height before the add
+            if (parent->balanceFactor < -1 || parent->balanceFactor > 1) {
+                balance(*parentLink);
+                return;
+            }
+        } else {
+            // the other side is now the taller one: the parent's height is unchanged
+            if (parent->balanceFactor == -1 || parent->balanceFactor == 1)
+                return;
+
+            // the rotation only keeps the subtree as high if the taller child was balanced
+            if (parent->balanceFactor < -1 || parent->balanceFactor > 1) {
+                typename BST<T>::BinTree taller = parent->balanceFactor > 0 ? parent->right : parent->left;
+                const bool keepsHeight = taller->balanceFactor == 0;
+                balance(*parentLink);
+                if (keepsHeight)
+                    return;
+            }
+        }
+        link = parentLink;
+    }
+
+    // the walk got past the root, so the whole tree changed height
+    height_ += grew ? 1 : -1;
+}
+
+template <typename T>
+void AVL<T>::balance(typename BST<T>::BinTree& tree) {
+    if (tree->balanceFactor < -1) {
+        // LR if the left child leans right, LL otherwise
+        if (tree->left->balanceFactor > 0)
+            rotateLeftRight(tree);
+        else
+            rotateRight(tree);
+    } else if (tree->balanceFactor > 1) {
+        // RL if the right child leans left, RR otherwise
+        if (tree->right->balanceFactor < 0)
+            rotateRightLeft(tree);
+        else
+            rotateLeft(tree);
+    }
+}
+
+template <typename T>
+void AVL<T>::rotateLeft(typename BST<T>::BinTree& tree) {
+    rotateLeftWithStatsUpdate(tree);
+}
+
+template <typename T>
+void AVL<T>::rotateRight(typename BST<T>::BinTree& tree) {
+    rotateRightWithStatsUpdate(tree);
+}
+
+template <typename T>
+void AVL<T>::rotateLeftRight(typename BST<T>::BinTree& tree) {
+    rotateLeft(tree->left);
+    rotateRight(tree);
+}
+
+template <typename T>
+void AVL<T>::rotateRightLeft(typename BST<T>::BinTree& tree) {
+    rotateRight(tree->right);
+    rotateLeft(tree);
+}
+
+template <typename T>
+void AVL<T>::rotateLeftWithStatsUpdate(typename BST<T>::BinTree& tree) {
+    typename BST<T>::BinTree top = tree->right;
+    tree->right = top->left;
+    top->left = tree;
+
+    // the new top has all the nodes the old one had, the old one loses the new top's right subtree
+    top->count = tree->count;
+    tree->count = 1 + (tree->left ? tree->left->count : 0) + (tree->right ? tree->right->count : 0);
+
+    // - the old top loses the taller of the new top's subtrees from its right side
+    // - the new top gains the old top (one level above its new right subtree) on its left side
+    tree->balanceFactor -= 1 + std::max(top->balanceFactor, 0);
+    top->balanceFactor -= 1 - std::min(tree->balanceFactor, 0);
+    tree = top;
+}
+
+template <typename T>
+void AVL<T>::rotateRightWithStatsUpdate(typename BST<T>::BinTree& tree) {
+    typename BST<T>::BinTree top = tree->left;
+    tree->left = top->right;
+    top->right = tree;
+
+    top->count = tree->count;
+    tree->count = 1 + (tree->left ? tree->left->count : 0) + (tree->right ? tree->right->count : 0);
+
+    // mirror image of rotateLeftWithStatsUpdate
+    tree->balanceFactor += 1 - std::min(top->balanceFactor, 0);
+    top->balanceFactor += 1 + std::max(tree->balanceFactor, 0);
+    tree = top;
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::makeLeaf(const T& value) {
+    SimpleAllocator* allocator = this->getAllocator();
+    void* memory;
+    try {
+        memory = allocator->allocate();
+    } catch (const SimpleAllocatorException& e) {
+        throw BSTException(BSTException::E_NO_MEMORY, e.what());
+    }
+    try {
+        return new (memory) typename BST<T>::BinTreeNode(value);
+    } catch (...) {
+        allocator->free(memory);
+        throw;
+    }
+}
+
+template <typename T>
+void AVL<T>::releaseNodes(typename BST<T>::BinTree tree) {
+    SimpleAllocator* allocator = this->getAllocator();
+    const bool isArena = allocator->isArena();
+    if (isArena && std::is_trivially_destructible<T>::value)
+        return;
+    void* batch[CLEAR_BATCH_SIZE];
+    unsigned count = 0;
+    typename BST<T>::BinTree node = tree;
+    while (node) {
+        if (node->left) {
+            // rotate the left child up so that the node on top loses its left subtree
+            typename BST<T>::BinTree left = node->left;
+            node->left = left->right;
+            left->right = node;
+            node = left;
+        } else {
+            // no left subtree left, so this node goes and its right subtree takes its place
+            typename BST<T>::BinTree right = node->right;
+            node->~BinTreeNode();
+            if (!isArena) {
+                batch[count++] = node;
+                if (count == CLEAR_BATCH_SIZE) {
+                    allocator->freeBatch(batch, count);
+                    count = 0;
+                }
+            }
+            node = right;
+        }
+    }
+    allocator->freeBatch(batch, count);
+}
+
+template <typename T>
+void AVL<T>::reserveSlots(SetOperation& op, SimpleAllocator* allocator, size_t count) {
+    op.slots.resize(count);
+    try {
+        allocator->allocateBatch(op.slots.data(), count);
+    } catch (const SimpleAllocatorException& e) {
+        op.slots.clear();
+        throw BSTException(BSTException::E_NO_MEMORY, e.what());
+    }
+}
+
+template <typename T>
+void AVL<T>::releaseSlots(SetOperation& op, SimpleAllocator* allocator) {
+    const size_t used = op.usedSlots;
+    allocator->freeBatch(op.slots.data() + used, op.slots.size() - used);
+    op.slots.clear();
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::join(typename BST<T>::BinTree left, int leftHeight, typename BST<T>::BinTree middle,
+                                      typename BST<T>::BinTree right, int rightHeight, int& height) {
+    if (leftHeight > rightHeight + 1) {
+        // hang the right tree (with the middle node) down the right side of the left one
+        const int outerHeight = childHeight(left, leftHeight, false);
+        int innerHeight;
+        left->right = join(left->right, childHeight(left, leftHeight, true), middle, right, rightHeight, innerHeight);
+        left->count += 1 + nodeCount(right);
+        left->balanceFactor = innerHeight - outerHeight;
+        if (left->balanceFactor <= 1) {
+            height = 1 + std::max(outerHeight, innerHeight);
+            return left;
+        }
+
+        // - the inner side is 2 levels taller: the rotation leaves the tree as high as the
+        //   inner side, one more if the inner side was balanced
+        const bool wasBalanced = left->right->balanceFactor == 0;
+        balance(left);
+        height = innerHeight + wasBalanced;
+        return left;
+    }
+
+    if (rightHeight > leftHeight + 1) {
+        // mirror image: hang the left tree down the left side of the right one
+        const int outerHeight = childHeight(right, rightHeight, true);
+        int innerHeight;
+        right->left = join(left, leftHeight, middle, right->left, childHeight(right, rightHeight, false), innerHeight);
+        right->count += 1 + nodeCount(left);
+        right->balanceFactor = outerHeight - innerHeight;
+        if (right->balanceFactor >= -1) {
+            height = 1 + std::max(outerHeight, innerHeight);
+            return right;
+        }
+        const bool wasBalanced = right->left->balanceFactor == 0;
+        balance(right);
+        height = innerHeight + wasBalanced;
+        return right;
+    }
+
+    // the heights are at most a level apart, so the middle node can take both
+    middle->left = left;
+    middle->right = right;
+    middle->count = 1 + nodeCount(left) + nodeCount(right);
+    middle->balanceFactor = rightHeight - leftHeight;
+    height = 1 + std::max(leftHeight, rightHeight);
+    return middle;
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::join2(typename BST<T>::BinTree left, int leftHeight, typename BST<T>::BinTree right,
+                                       int rightHeight, int& height) {
+    if (!left || !right) {
+        height = left ? leftHeight : rightHeight;
+        return left ? left : right;
+    }
+    typename BST<T>::BinTree rest;
+    int restHeight;
+    typename BST<T>::BinTree last = splitLast(left, leftHeight, rest, restHeight);
+    return join(rest, restHeight, last, right, rightHeight, height);
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::splitLast(typename BST<T>::BinTree tree, int height, typename BST<T>::BinTree& rest,
+                                           int& restHeight) {
+    if (!tree->right) {
+        rest = tree->left;
+        restHeight = height - 1;
+        tree->left = nullptr;
+        tree->count = 1;
+        tree->balanceFactor = 0;
+        return tree;
+    }
+    typename BST<T>::BinTree right;
+    int rightHeight;
+    typename BST<T>::BinTree last = splitLast(tree->right, childHeight(tree, height, true), right, rightHeight);
+    rest = join(tree->left, childHeight(tree, height, false), tree, right, rightHeight, restHeight);
+    return last;
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::split(typename BST<T>::BinTree tree, int height, const T& value,
+                                       typename BST<T>::BinTree& left, int& leftHeight,
+                                       typename BST<T>::BinTree& right, int& rightHeight) {
+    if (!tree) {
+        left = right = nullptr;
+        leftHeight = rightHeight = -1;
+        return nullptr;
+    }
+    typename BST<T>::BinTree treeLeft = tree->left;
+    typename BST<T>::BinTree treeRight = tree->right;
+    const int treeLeftHeight = childHeight(tree, height, false);
+    const int treeRightHeight = childHeight(tree, height, true);
+
+    // the node and the subtree on the other side of the path go with the near half
+    typename BST<T>::BinTree found;
+    if (value < tree->data) {
+        typename BST<T>::BinTree inner;
+        int innerHeight;
+        found = split(treeLeft, treeLeftHeight, value, left, leftHeight, inner, innerHeight);
+        right = join(inner, innerHeight, tree, treeRight, treeRightHeight, rightHeight);
+    } else if (tree->data < value) {
+        typename BST<T>::BinTree inner;
+        int innerHeight;
+        found = split(treeRight, treeRightHeight, value, inner, innerHeight, right, rightHeight);
+        left = join(treeLeft, treeLeftHeight, tree, inner, innerHeight, leftHeight);
+    } else {
+        left = treeLeft;
+        leftHeight = treeLeftHeight;
+        right = treeRight;
+        rightHeight = treeRightHeight;
+        tree->left = tree->right = nullptr;
+        tree->count = 1;
+        tree->balanceFactor = 0;
+        found = tree;
+    }
+    return found;
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::copyOf(SetOperation& op, const typename BST<T>::BinTreeNode* tree) {
+    if (!tree)
+        return nullptr;
+    typename BST<T>::BinTree copy = new (op.slots[op.usedSlots++]) typename BST<T>::BinTreeNode(tree->data);
+    forkJoin(op, tree->count,
+             [&]() { copy->left = copyOf(op, tree->left); },
+             [&]() { copy->right = copyOf(op, tree->right); });
+    copy->count = tree->count;
+    copy->balanceFactor = tree->balanceFactor;
+    return copy;
+}
+
+template <typename T>
+template <typename First, typename Second>
+void AVL<T>::forkJoin(SetOperation& op, unsigned size, First first, Second second) {
+    // claim one of the idle threads, if there is any left
+    bool forked = false;
+    std::thread worker;
+    if (size >= PARALLEL_SET_MIN_SIZE) {
+        unsigned idle = op.idleThreads;
+        while (idle && !op.idleThreads.compare_exchange_weak(idle, idle - 1))
+            ;
+        if (idle) {
+            try {
+                worker = std::thread(first);
+                forked = true;
+            } catch (const std::system_error&) {
+                ++op.idleThreads;
+            }
+        }
+    }
+
+    if (!forked)
+        first();
+    second();
+    if (forked) {
+        worker.join();
+        ++op.idleThreads;
+    }
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::unionOf(SetOperation& op, typename BST<T>::BinTree ours, int oursHeight,
+                                         const typename BST<T>::BinTreeNode* theirs, int theirsHeight, int& height) {
+    if (!theirs) {
+        height = oursHeight;
+        return ours;
+    }
+    if (!ours) {
+        height = theirsHeight;
+        return copyOf(op, theirs);
+    }
+
+    // split around their root, merge the halves with their subtrees and join them back around it
+    const unsigned size = ours->count + theirs->count;
+    typename BST<T>::BinTree left, right;
+    int leftHeight, rightHeight;
+    typename BST<T>::BinTree middle = split(ours, oursHeight, theirs->data, left, leftHeight, right, rightHeight);
+    if (!middle)
+        middle = new (op.slots[op.usedSlots++]) typename BST<T>::BinTreeNode(theirs->data);
+    forkJoin(op, size,
+             [&]() {
+                 left = unionOf(op, left, leftHeight, theirs->left, childHeight(theirs, theirsHeight, false),
+                                leftHeight);
+             },
+             [&]() {
+                 right = unionOf(op, right, rightHeight, theirs->right, childHeight(theirs, theirsHeight, true),
+                                 rightHeight);
+             });
+    return join(left, leftHeight, middle, right, rightHeight, height);
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::intersectionOf(SetOperation& op, typename BST<T>::BinTree ours, int oursHeight,
+                                                const typename BST<T>::BinTreeNode* theirs, int theirsHeight,
+                                                NodeList& released, int& height) {
+    if (!ours || !theirs) {
+        released.push(ours);
+        height = -1;
+        return nullptr;
+    }
+
+    // only the node of their root's value (if any) stays between the halves
+    const unsigned size = ours->count + theirs->count;
+    typename BST<T>::BinTree left, right;
+    int leftHeight, rightHeight;
+    typename BST<T>::BinTree middle = split(ours, oursHeight, theirs->data, left, leftHeight, right, rightHeight);
+    NodeList releasedRight;
+    forkJoin(op, size,
+             [&]() {
+                 left = intersectionOf(op, left, leftHeight, theirs->left, childHeight(theirs, theirsHeight, false),
+                                       released, leftHeight);
+             },
+             [&]() {
+                 right = intersectionOf(op, right, rightHeight, theirs->right,
+                                        childHeight(theirs, theirsHeight, true), releasedRight, rightHeight);
+             });
+    released.append(releasedRight);
+    return middle ? join(left, leftHeight, middle, right, rightHeight, height)
+                  : join2(left, leftHeight, right, rightHeight, height);
+}
+
+template <typename T>
+typename BST<T>::BinTree AVL<T>::differenceOf(SetOperation& op, typename BST<T>::BinTree ours, int oursHeight,
+                                              const typename BST<T>::BinTreeNode* theirs, int theirsHeight,
+                                              NodeList& released, int& height) {
+    if (!ours || !theirs) {
+        height = oursHeight;
+        return ours;
+    }
+
+    // the node of their root's value (if any) goes, the halves are joined without it
+    const unsigned size = ours->count + theirs->count;
+    typename BST<T>::BinTree left, right;
+    int leftHeight, rightHeight;
+    released.push(split(ours, oursHeight, theirs->data, left, leftHeight, right, rightHeight));
+    NodeList releasedRight;
+    forkJoin(op, size,
+             [&]() {
+                 left = differenceOf(op, left, leftHeight, theirs->left, childHeight(theirs, theirsHeight, false),
+                                     released, leftHeight);
+             },
+             [&]() {
+                 right = differenceOf(op, right, rightHeight, theirs->right, childHeight(theirs, theirsHeight, true),
+                                      releasedRight, rightHeight);
+             });
+    released.append(releasedRight);
+    return join2(left, leftHeight, right, rightHeight, height);
+}
@@ -7,9 +7,16 @@
 
 #ifndef AVL_H
 #define AVL_H
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <iostream>
+#include <iterator>
 #include <sstream>
-#include <stack>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "FrozenAVL.h"
 #include "SimpleAllocator.h"
 
 
@@ -30,10 +37,168 @@ class AVL : public BST<T> {
 
 public:
 
-    // This is a convenience type definition for the stack of path nodes.
-    // It is used to trace back to the unbalanced node(s) after adding/removing, 
-    // as shown in class. Feel free to ignore this and use other techniques if you wish.
-    using PathStack = std::stack<typename BST<T>::BinTree>;
+    // deepest path add/remove may have to trace
+    // - an AVL tree of n nodes is at most about 1.44 * log2(n) levels high,
+    //   so this covers any tree whose size fits in an unsigned
+    static const unsigned MAX_PATH_SIZE = 64;
+
+    /**
+     * @brief Fixed-capacity stack of the path nodes.
+     *        It is used to trace back to the unbalanced node(s) after adding/removing,
+     *        as shown in class. It lives in the caller's stack frame, so tracing
+     *        the path never allocates.
+     *        Every entry is the link (the root or a child pointer of the parent) that
+     *        points at a node on the path, so that a rotation can rewire it in place.
+     */
+    struct PathStack {
+        typename BST<T>::BinTree* links[MAX_PATH_SIZE]; // links from the root down
+        unsigned size = 0; // number of links on the stack
+
+        /**
+         * @brief Push the link of the next node on the path.
+         * @param link link pointing at the node
+         */
+        void push(typename BST<T>::BinTree* link) {
+            links[size++] = link;
+        }
+    };
+
+    /**
+     * @brief Bidirectional iterator over the values in sorted order (or reverse order).
+     *        The path from the root to the current node is kept in a fixed-size array
+     *        inside the iterator, so iterating never allocates and a step is O(1)
+     *        amortized (O(log n) at worst). The position past the last value is the
+     *        empty path, which steps back to the last value.
+     *        The reverse iterator is the same walk with the directions swapped, rather
+     *        than a std::reverse_iterator, which would copy the path and step back on
+     *        every dereference.
+     *        The values are read-only like std::set's, and any add/remove/clear (or
+     *        other change of the tree) invalidates every iterator.
+     * @tparam Reverse true to go from the largest value to the smallest
+     */
+    template <bool Reverse>
+    class basic_iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        /**
+         * @brief Constructor of a singular iterator (only to be assigned to).
+         */
+        basic_iterator() : root_(nullptr), size_(0) {}
+
+        /**
+         * @brief Copy constructor, which only copies the used part of the path.
+         * @param rhs iterator to copy
+         */
+        basic_iterator(const basic_iterator& rhs) : root_(rhs.root_), size_(rhs.size_) {
+            std::copy(rhs.path_, rhs.path_ + size_, path_);
+        }
+
+        /**
+         * @brief Assignment operator, which only copies the used part of the path.
+         * @param rhs iterator to copy
+         * @return this iterator
+         */
+        basic_iterator& operator=(const basic_iterator& rhs) {
+            root_ = rhs.root_;
+            size_ = rhs.size_;
+            std::copy(rhs.path_, rhs.path_ + size_, path_);
+            return *this;
+        }
+
+        reference operator*() const {
+            return path_[size_ - 1]->data;
+        }
+
+        pointer operator->() const {
+            return &path_[size_ - 1]->data;
+        }
+
+        basic_iterator& operator++() {
+            step(!Reverse);
+            return *this;
+        }
+
+        basic_iterator& operator--() {
+            step(Reverse);
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            basic_iterator old(*this);
+            step(!Reverse);
+            return old;
+        }
+
+        basic_iterator operator--(int) {
+            basic_iterator old(*this);
+            step(Reverse);
+            return old;
+        }
+
+        bool operator==(const basic_iterator& rhs) const {
+            return (size_ ? path_[size_ - 1] : nullptr) == (rhs.size_ ? rhs.path_[rhs.size_ - 1] : nullptr);
+        }
+
+        bool operator!=(const basic_iterator& rhs) const {
+            return !(*this == rhs);
+        }
+
+        /**
+         * @brief Get the iterator of the other direction that is one step before this one,
+         *        like std::reverse_iterator::base() (rend().base() is begin()).
+         * @return the iterator
+         */
+        basic_iterator<!Reverse> base() const {
+            basic_iterator<!Reverse> it(root_);
+            it.size_ = size_;
+            std::copy(path_, path_ + size_, it.path_);
+            return ++it;
+        }
+
+    private:
+        friend class AVL;
+        friend class basic_iterator<!Reverse>;
+
+        /**
+         * @brief Constructor of the position past the last value of a tree.
+         * @param root root of the tree
+         */
+        explicit basic_iterator(const typename BST<T>::BinTreeNode* root) : root_(root), size_(0) {}
+
+        /**
+         * @brief Push a node and the nodes down one side of it on the path.
+         * @param node first node to push (may be null)
+         * @param right false for the left side (down to the smallest value), true for the right one
+         */
+        void descend(const typename BST<T>::BinTreeNode* node, bool right) {
+            for (; node; node = right ? node->right : node->left)
+                path_[size_++] = node;
+        }
+
+        /**
+         * @brief Move to the next value in sorted order (right) or the previous one (left).
+         *        That is the nearest one in the child subtree on that side if there is one,
+         *        else the first ancestor the path comes up to from the other side.
+         *        From the empty path, it is the value at the far end.
+         * @param right true for the next value, false for the previous one
+         */
+        void step(bool right);
+
+        const typename BST<T>::BinTreeNode* root_; // root of the tree, to step back from the empty path
+        const typename BST<T>::BinTreeNode* path_[MAX_PATH_SIZE]; // nodes from the root down to the current one
+        unsigned size_; // number of nodes on the path (0 past the last value)
+    };
+
+    // the values cannot be changed in place, so the iterators are all const, like in std::set
+    using const_iterator = basic_iterator<false>;
+    using iterator = const_iterator;
+    using const_reverse_iterator = basic_iterator<true>;
+    using reverse_iterator = const_reverse_iterator;
 
     /**
      * @brief Constructor.
@@ -41,23 +206,22 @@ public:
      *        However, you can implement this from scratch if you wish.
      * @param allocator Pointer to the allocator to use for the tree.
      */
-    AVL(SimpleAllocator* allocator = nullptr) : BST<T>(allocator) {}
+    AVL(SimpleAllocator* allocator = nullptr) : BST<T>(allocator), height_(-1) {}
 
     /**
      * @brief Destructor
-     *        The inline implementation here calls the BST destructor. 
-     *        However, you can implement this from scratch if you wish.
+     *        The inline implementation here releases the nodes in batches (see clear)
+     *        before the BST destructor runs.
      */
-    virtual ~AVL() override {}
+    virtual ~AVL() override {
+        clear();
+    }
 
     /**
      * @brief Add a new value to the tree and balance the tree.
-     *        Use the techniques discussed in class to trace back to the
-     *        first unbalanced node and perform the appropriate rotations.
-     *        Feel free to use other techniques if you wish but make sure your 
-     *        outputs match the expected ones.
-     *        (The declaration assumes you will override the remove method from BST. 
-     *        However, you can remove the inheritance association if you wish.)
+     *        The path down is traced in a PathStack, then walked back up with the
+     *        cached balance factors until a subtree's height is unchanged (or a
+     *        rotation restores it), so the only allocation is the new node.
      * @param value to be added to the tree
      * @throw BSTException if the value already exists in the tree
      */
@@ -65,12 +229,9 @@ public:
 
     /**
      * @brief Remove a value from the tree and balance the tree.
-     *        Use the techniques discussed in class to trace back to ALL
-     *        unbalanced nodes and perform the appropriate rotations.
-     *        Feel free to use other techniques if you wish but make sure your 
-     *        outputs match the expected ones.
-     *        (The declaration assumes you will override the remove method from BST. 
-     *        However, you can remove the inheritance association if you wish.)
+     *        A node with two children takes the value of its predecessor, which is
+     *        removed instead. The path is traced and walked back up like in add,
+     *        rotating every unbalanced node until a subtree's height is unchanged.
      * @param value to be removed from the tree
      * @throw BSTException if the value does not exist in the tree
      */
@@ -83,90 +244,649 @@ public:
     std::stringstream printInorder() const;
 
     /**
-     * @brief Get the height of the tree.
-     *        This is mainly used to update the cached balance factors in the nodes.
+     * @brief Get an iterator to the smallest value in O(log n).
+     * @return iterator to the smallest value (end() if the tree is empty)
+     */
+    const_iterator begin() const;
+
+    /**
+     * @brief Get the iterator past the largest value in O(1).
+     * @return end iterator
+     */
+    const_iterator end() const {
+        return const_iterator(this->root());
+    }
+
+    /**
+     * @brief Get a reverse iterator to the largest value in O(log n).
+     * @return reverse iterator to the largest value (rend() if the tree is empty)
+     */
+    const_reverse_iterator rbegin() const;
+
+    /**
+     * @brief Get the reverse iterator past the smallest value in O(1).
+     * @return reverse end iterator
+     */
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(this->root());
+    }
+
+    /**
+     * @brief Get an iterator to the first value not less than a value in O(log n).
+     * @param value to look for (it need not be in the tree)
+     * @return iterator to the value (end() if all the values are less)
+     */
+    const_iterator lower_bound(const T& value) const;
+
+    /**
+     * @brief Get an iterator to the first value greater than a value in O(log n).
+     * @param value to look for (it need not be in the tree)
+     * @return iterator to the value (end() if no value is greater)
+     */
+    const_iterator upper_bound(const T& value) const;
+
+    /**
+     * @brief Replace the contents of the tree with sorted values in O(N).
+     *        The nodes come from the allocator CLEAR_BATCH_SIZE at a time through
+     *        SimpleAllocator::allocateBatch, in sorted order, and are then linked
+     *        into a perfectly balanced tree (the middle value at the root) with
+     *        their counts and balance factors set, without a single rotation.
+     *        If anything throws, the tree keeps its old contents.
+     * @tparam InputIt input iterator over values of type T
+     * @param first first value
+     * @param last one past the last value
+     * @throw BSTException E_DUPLICATE if the values are not strictly increasing,
+     *        E_NO_MEMORY if the allocator runs out of nodes
+     */
+    template <typename InputIt>
+    void buildFromSorted(InputIt first, InputIt last);
+
+    /**
+     * @brief Replace the contents of the tree with values in any order.
+     *        The values are copied, sorted (on several threads above
+     *        PARALLEL_SORT_MIN_SIZE values), deduplicated and handed to buildFromSorted,
+     *        so this is O(N log N) instead of N adds and their rotations.
+     *        T's operator< must not throw, since it runs on the sorting threads.
+     * @tparam InputIt input iterator over values of type T
+     * @param first first value
+     * @param last one past the last value
+     * @throw BSTException E_NO_MEMORY if the allocator runs out of nodes
+     */
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last);
+
+    /**
+     * @brief Split the tree around a value in O(log n).
+     *        The tree keeps the values less than the value and another tree receives
+     *        the ones greater than it (its old contents are cleared). The nodes just
+     *        change hands if both trees share the allocator, otherwise the greater
+     *        values are copied into the other tree's allocator first (O(m)).
+     * @param value to split around (it need not be in the tree)
+     * @param greater another tree, receives the values greater than value
+     * @return true if the value was in the tree (it is then in neither)
+     * @throw BSTException E_NO_MEMORY if the copies do not fit in the other tree's allocator
+     *        (both trees are left unchanged)
+     */
+    bool split(const T& value, AVL& greater);
+
+    /**
+     * @brief Join the tree, a value and a tree of greater values in O(log n).
+     *        The taller tree is walked down along its inner side to a subtree as high
+     *        as the other tree, which is hung there under the value's node, and the
+     *        walk back up rotates at most once per level. The nodes of the other tree
+     *        just change hands if both trees share the allocator, otherwise they are
+     *        copied first (O(m)). The other tree ends up empty.
+     * @param value to join the trees with
+     * @param greater another tree, whose values all go into this one
+     * @throw BSTException E_DUPLICATE unless every value of the tree is less than value,
+     *        and value is less than every value of greater; E_NO_MEMORY if the allocator
+     *        runs out of nodes (both trees are left unchanged either way)
+     */
+    void join(const T& value, AVL& greater);
+
+    /**
+     * @brief Add every value of another tree that is not in this one yet.
+     *        The other tree is walked down from its root: this tree is split around
+     *        the other root's value, both halves are merged with the other root's
+     *        subtrees (on a thread of their own above PARALLEL_SET_MIN_SIZE values),
+     *        then joined back around the value. That is O(m log(n / m + 1)) for m <= n,
+     *        instead of the O(m log n) of m adds, and it spreads over the cores.
+     *        The nodes the new values may need (the other tree's size) are taken from
+     *        the allocator up front, and the unused ones handed back at the end.
+     *        T's operator< and copy constructor must not throw, since they run on
+     *        the worker threads.
+     * @param other tree to add the values of (unchanged)
+     * @throw BSTException E_NO_MEMORY if the allocator runs out of nodes
+     *        (the tree is left unchanged)
+     */
+    void unionWith(const AVL& other);
+
+    /**
+     * @brief Keep only the values that are also in another tree.
+     *        Same recursion as unionWith, the values missing from the other tree are
+     *        handed back to the allocator at the end. Nothing is allocated.
+     * @param other tree to intersect with (unchanged)
+     */
+    void intersectWith(const AVL& other);
+
+    /**
+     * @brief Remove the values that are also in another tree.
+     *        Same recursion as unionWith, the values found in the other tree are
+     *        handed back to the allocator at the end. Nothing is allocated.
+     * @param other tree of the values to remove (unchanged)
+     */
+    void difference(const AVL& other);
+
+    /**
+     * @brief Get the k-th smallest value in O(log n).
+     *        The cached counts tell how many values every left subtree holds,
+     *        so this walks a single path down.
+     * @param k position of the value in sorted order (0 for the smallest)
+     * @return the value
+     * @throw BSTException E_NOT_FOUND if k is not less than the size
+     */
+    const T& select(unsigned k) const;
+
+    /**
+     * @brief Count the values smaller than a value in O(log n).
+     *        The value itself need not be in the tree.
+     * @param value to rank
+     * @return number of values smaller than it (its position if it is in the tree)
+     */
+    unsigned rank(const T& value) const;
+
+    /**
+     * @brief Get a percentile of the values in O(log n) (nearest-rank method).
+     *        It is the smallest value with at least percent % of the values
+     *        at or below it, so 0 gives the smallest and 100 the largest.
+     * @param percent percentile to get, from 0 to 100
+     * @return the value
+     * @throw BSTException E_NOT_FOUND if the tree is empty or percent is out of range
+     */
+    const T& percentile(double percent) const;
+
+    /**
+     * @brief Get the median of the values in O(log n).
+     *        For an even size it is the lower of the two middle values.
+     * @return the value
+     * @throw BSTException E_NOT_FOUND if the tree is empty
+     */
+    const T& median() const;
+
+    /**
+     * @brief Make a read-only snapshot of the tree in O(N).
+     *        The snapshot keeps the values in one array in Eytzinger order (see FrozenAVL),
+     *        so its lookups go without pointers or branches on the compares. It does not
+     *        change with the tree.
+     * @return the snapshot
+     */
+    FrozenAVL<T> freeze() const {
+        const std::vector<T> values(begin(), end());
+        return FrozenAVL<T>(values.begin(), values.end());
+    }
+
+    /**
+     * @brief Save a snapshot of the tree to a file in O(N) (T must be trivially copyable).
+     *        The file is the array of freeze() behind a versioned and checksummed header
+     *        (see FrozenAVL::save), so that it can be mapped back in and read in place.
+     * @param path file to write
+     * @throw SnapshotException E_IO if the file cannot be written
+     */
+    void save(const std::string& path) const {
+        freeze().save(path);
+    }
+
+    /**
+     * @brief Map a snapshot saved by save() and read it in place, without building a tree.
+     *        This is O(1) apart from the checksum (see FrozenAVL::loadMapped).
+     * @param path file to read
+     * @param verify whether to check the checksum
+     * @return the snapshot, answering the lookups from the mapped file
+     * @throw SnapshotException E_IO, E_BAD_FORMAT or E_BAD_CHECKSUM
+     */
+    static FrozenAVL<T> loadMapped(const std::string& path, bool verify = true) {
+        return FrozenAVL<T>::loadMapped(path, verify);
+    }
+
+    /**
+     * @brief Replace the contents of the tree with a snapshot saved by save() in O(N).
+     *        The file is mapped and its values, already sorted and unique, go straight
+     *        to buildFromSorted: no sorting and no rotations.
+     *        If anything throws, the tree keeps its old contents.
+     * @param path file to read
+     * @param verify whether to check the checksum
+     * @throw SnapshotException E_IO, E_BAD_FORMAT or E_BAD_CHECKSUM,
+     *        BSTException E_NO_MEMORY if the allocator runs out of nodes
+     */
+    void load(const std::string& path, bool verify = true) {
+        const FrozenAVL<T> snapshot = loadMapped(path, verify);
+        buildFromSorted(snapshot.begin(), snapshot.end());
+    }
+
+    /**
+     * @brief Look up a batch of values.
+     *        FIND_GROUP_SIZE lookups walk down the tree in lockstep: each one takes a
+     *        step in turn and prefetches its next node, so the cache misses of the
+     *        group overlap instead of stalling one walk after the other. A lookup
+     *        that ends hands its place in the group to the next value of the batch.
+     * @param values to look up
+     * @param count number of values
+     * @param results receives for every value whether it is in the tree
+     * @return number of values found
+     */
+    unsigned findMany(const T* values, size_t count, bool* results) const;
+
+    /**
+     * @brief Count the values in a range in O(log n).
+     *        The cached counts give the number of values up to hi and below lo
+     *        with a walk down each, whatever the size of the range.
+     * @param lo smallest value of the range
+     * @param hi largest value of the range
+     * @return number of values from lo to hi, both included (0 if hi < lo)
+     */
+    unsigned countInRange(const T& lo, const T& hi) const;
+
+    /**
+     * @brief Visit the values in a range in sorted order in O(log n + k).
+     *        The walk starts at lower_bound(lo) and steps through the k values in the
+     *        range only, without allocating.
+     * @tparam Visitor callable taking a const T&, returning false to stop the walk
+     *         (or nothing to always go on)
+     * @param lo smallest value of the range
+     * @param hi largest value of the range
+     * @param visitor called for every value from lo to hi, both included
+     * @return true if the whole range was visited, false if the visitor stopped early
+     */
+    template <typename Visitor>
+    bool forEachInRange(const T& lo, const T& hi, Visitor visitor) const;
+
+    /**
+     * @brief Get the height of the tree in O(1).
+     *        The tree keeps its height up to date: add/remove walk back up the path
+     *        until a subtree's height is unchanged, and if the walk gets past the root
+     *        the whole tree grew or shrank by a level.
      *        It is also called in test.cpp to verify correctness.
-     *        (The inline implementation defaults to the BST height method.
-     *        However, you can implement this from scratch if you wish.)
-     * @return height of the tree
+     * @return height of the tree (-1 if it is empty)
      */
     int height() const {
-        return BST<T>::height();
+        return height_;
     }
 
     /**
-     * @brief Get the size of the tree.
-     *        This is mainly used to update the cached counts in the nodes.
+     * @brief Get the size of the tree in O(1).
+     *        The root's cached count is the number of nodes in the tree.
      *        It is also called in test.cpp to verify correctness.
-     *        (The inline implementation defaults to the BST size method. 
-     *        However, you can implement this from scratch if you wish.)
      * @return size of the tree
      */
     unsigned size() const {
-        return BST<T>::size();
+        const typename BST<T>::BinTree root = this->root();
+        return root ? root->count : 0;
+    }
+
+    /**
+     * @brief Remove all the values from the tree.
+     *        The nodes go back to the allocator in batches, without recursion or an
+     *        explicit stack (see releaseNodes). When the allocator is an arena there is
+     *        nothing to hand back, the arena's reset() takes the memory back.
+     */
+    void clear() {
+        releaseNodes(this->getRoot());
+        this->getRoot() = nullptr;
+        height_ = -1;
     }
 
 private:
 
-    // TODO: Add any private methods or data members you need here.
-    //       For the public interface above, as mentioned, the main requirement
-    //       is that the interface works as expected in test.cpp.
+    // number of nodes clear() gathers before handing them back to the allocator
+    // (and buildFromSorted takes from it at a time)
+    static const unsigned CLEAR_BATCH_SIZE = 256;
+
+    // number of values from which assign() sorts on several threads
+    static const size_t PARALLEL_SORT_MIN_SIZE = 1 << 16;
+
+    // number of values (in both trees) from which the set operations fork a thread
+    static const unsigned PARALLEL_SET_MIN_SIZE = 1 << 14;
+
+    // number of lookups findMany walks down the tree in lockstep
+    // - enough misses in flight to cover the memory latency, few enough to stay in registers/L1
+    static const unsigned FIND_GROUP_SIZE = 16;
+
+    /**
+     * @brief Ask for a node to be brought into the cache (a hint, it may do nothing).
+     * @param node to prefetch (may be null)
+     */
+    static void prefetch(const void* node) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(node);
+#else
+        (void)node;
+#endif
+    }
+
+    /**
+     * @brief Shared state of a split, join or set operation.
+     *        Nodes for copied values come from slots taken from the allocator up front,
+     *        so that the worker threads never call the allocator (which may not be
+     *        thread-safe) and nothing can fail once the trees start changing.
+     */
+    struct SetOperation {
+        std::vector<void*> slots; // nodes taken from the allocator up front
+        std::atomic<size_t> usedSlots{0}; // number of slots handed out
+        std::atomic<unsigned> idleThreads{0}; // number of threads that may still be forked
+    };
+
+    /**
+     * @brief Nodes to hand back to the allocator at the end of an operation.
+     *        Whole subtrees are chained through the right pointer of the last node of
+     *        the previous one, so the list is a (lopsided) tree that releaseNodes takes.
+     */
+    struct NodeList {
+        typename BST<T>::BinTree head = nullptr; // first subtree
+        typename BST<T>::BinTree tail = nullptr; // last node of the last subtree
+
+        /**
+         * @brief Chain a subtree after the others in O(its height).
+         * @param tree subtree to add (may be empty)
+         */
+        void push(typename BST<T>::BinTree tree) {
+            if (!tree)
+                return;
+            (tail ? tail->right : head) = tree;
+            for (tail = tree; tail->right; tail = tail->right)
+                ;
+        }
+
+        /**
+         * @brief Chain another list after this one in O(1).
+         * @param list to take the subtrees of
+         */
+        void append(const NodeList& list) {
+            if (!list.head)
+                return;
+            (tail ? tail->right : head) = list.head;
+            tail = list.tail;
+        }
+    };
 
     /**
      * @brief Rotate the tree to the left.
-     *        Note that you may need to update the counts and balance factors.
+     *        The counts and balance factors are updated along (see rotateLeftWithStatsUpdate).
      * @param tree to be rotated
      */
     void rotateLeft(typename BST<T>::BinTree& tree);
 
     /**
      * @brief Rotate the tree to the right.
-     *        Note that you may need to update the counts and balance factors.
+     *        The counts and balance factors are updated along (see rotateRightWithStatsUpdate).
      * @param tree to be rotated
      */
     void rotateRight(typename BST<T>::BinTree& tree);
 
     /**
      * @brief Rotate the left subtree to the left, then the whole tree to the right.
-     *        You may want to use the rotateLeft and rotateRight methods above.
      * @param tree to be rotated
      */
     void rotateLeftRight(typename BST<T>::BinTree& tree);
 
     /**
      * @brief Rotate the right subtree to the right, then the whole tree to the left.
-     *        You may want to use the rotateLeft and rotateRight methods above.
      * @param tree to be rotated
      */
     void rotateRightLeft(typename BST<T>::BinTree& tree);
 
     /**
-     * @brief Balance the tree from the stack of path nodes.
-     * @param pathNodes contain the stack of nodes from the root to the node just before
-     *                  the added/removed node after adding/remove operation
-     * @param stopAtFirst if true, stop after fixing the first unbalanced node
+     * @brief Walk the path nodes back up after an add/remove, fixing their balance
+     *        factors and rotating the unbalanced ones.
+     *        It stops as soon as a subtree's height is unchanged, which after an add
+     *        is at the latest after the first rotation. If it never does, the height
+     *        of the whole tree changed.
+     * @param pathNodes contain the stack of links from the root to the parent of the
+     *                  subtree whose height changed
+     * @param link link of the subtree whose height changed
+     * @param grew true if the subtree grew by a level (add), false if it shrank (remove)
      */
-    void balance(PathStack& pathNodes, bool stopAtFirst = false);
+    void balance(PathStack& pathNodes, typename BST<T>::BinTree* link, bool grew);
 
     /**
      * @brief Balance the tree from the given node.
-     *        This checks the balance factors of the node and its' children to 
+     *        This checks the cached balance factors of the node and its children to
      *        determine which of LL, LR, RR, RL case they are and call the
      *        appropriate rotation methods above.
      * @param tree to be balanced
      */
     void balance(typename BST<T>::BinTree& tree);
 
-    // TODO: Again, you do not need to stick to the private methods above, 
-    //       and likely you will need to add more of your own methods in order
-    //       to make your code more readable and maintainable.
-    void printInorder_(const typename BST<T>::BinTree& tree, std::stringstream& ss) const;
-    void add_(typename BST<T>::BinTree& tree, const T& value, PathStack& pathNodes);
-    void remove_(typename BST<T>::BinTree& tree, const T& value, PathStack& pathNodes);
-    bool isBalanced(const typename BST<T>::BinTree& tree) const;
-
+    /**
+     * @brief Rotate the tree to the left, updating the counts and balance factors.
+     *        The balance factors (right height - left height) follow from the old ones,
+     *        so no height is recomputed.
+     * @param tree to be rotated
+     */
     void rotateLeftWithStatsUpdate(typename BST<T>::BinTree& tree);
+
+    /**
+     * @brief Rotate the tree to the right, updating the counts and balance factors.
+     * @param tree to be rotated
+     */
     void rotateRightWithStatsUpdate(typename BST<T>::BinTree& tree);
+
+    /**
+     * @brief Link the first nodes of a sorted list into a perfectly balanced tree.
+     *        The list is linked through the right pointers and is consumed in order,
+     *        so this is O(size) and cannot fail.
+     * @param list head of the list, moved past the nodes taken
+     * @param size number of nodes to take
+     * @param height returns the height of the tree
+     * @return root of the tree
+     */
+    typename BST<T>::BinTree linkSorted(typename BST<T>::BinTree& list, unsigned size, int& height);
+
+    /**
+     * @brief Sort values and drop the duplicates.
+     *        Above PARALLEL_SORT_MIN_SIZE values, one slice per hardware thread is sorted
+     *        on its own thread and the sorted slices are merged pairwise, also in parallel.
+     * @param values to sort
+     */
+    static void sortUnique(std::vector<T>& values);
+
+    /**
+     * @brief Allocate a node and construct its value.
+     * @param value value of the node
+     * @return the node, a balanced leaf
+     * @throw BSTException E_NO_MEMORY if the allocator runs out of nodes
+     */
+    typename BST<T>::BinTree makeLeaf(const T& value);
+
+    /**
+     * @brief Destroy the nodes of a tree and hand them back to the allocator.
+     *        The nodes are unlinked without recursion or an explicit stack
+     *        (every left child is rotated up until the node to free has none)
+     *        and freed CLEAR_BATCH_SIZE at a time through SimpleAllocator::freeBatch.
+     *        When the allocator is an arena there is nothing to hand back, so the
+     *        tree is only walked if the values need their destructors run.
+     * @param tree to release
+     */
+    void releaseNodes(typename BST<T>::BinTree tree);
+
+    /**
+     * @brief Take nodes from an allocator into the slots of an operation.
+     * @param op the operation
+     * @param allocator to take the nodes from
+     * @param count number of nodes
+     * @throw BSTException E_NO_MEMORY if the allocator runs out of nodes
+     */
+    static void reserveSlots(SetOperation& op, SimpleAllocator* allocator, size_t count);
+
+    /**
+     * @brief Hand the slots an operation did not use back to their allocator.
+     * @param op the operation
+     * @param allocator the slots came from
+     */
+    static void releaseSlots(SetOperation& op, SimpleAllocator* allocator);
+
+    /**
+     * @brief Get the height of a child from the height of its parent in O(1).
+     *        The taller child (either one if balanced) is a level lower, the other two.
+     * @param tree the parent (not empty)
+     * @param height height of the parent
+     * @param right true for the right child, false for the left one
+     * @return height of the child
+     */
+    static int childHeight(const typename BST<T>::BinTreeNode* tree, int height, bool right) {
+        return height - ((right ? tree->balanceFactor >= 0 : tree->balanceFactor <= 0) ? 1 : 2);
+    }
+
+    /**
+     * @brief Get the number of nodes of a tree from its cached count.
+     * @param tree the tree (may be empty)
+     * @return number of nodes
+     */
+    static unsigned nodeCount(const typename BST<T>::BinTreeNode* tree) {
+        return tree ? tree->count : 0;
+    }
+
+    /**
+     * @brief Join two trees with a node in between in O(|height difference| + 1).
+     *        The taller tree is walked down along its inner side to a subtree at most a
+     *        level taller than the other tree, the node takes both as its children, and
+     *        every node on the way back up gets one rotation at most.
+     * @param left tree of the smaller values
+     * @param leftHeight height of left
+     * @param middle detached node of the value in between
+     * @param right tree of the greater values
+     * @param rightHeight height of right
+     * @param height returns the height of the joined tree
+     * @return root of the joined tree
+     */
+    typename BST<T>::BinTree join(typename BST<T>::BinTree left, int leftHeight, typename BST<T>::BinTree middle,
+                                  typename BST<T>::BinTree right, int rightHeight, int& height);
+
+    /**
+     * @brief Join two trees without a node in between in O(log n).
+     *        The last node of the left tree is split off to join them.
+     * @param left tree of the smaller values
+     * @param leftHeight height of left
+     * @param right tree of the greater values
+     * @param rightHeight height of right
+     * @param height returns the height of the joined tree
+     * @return root of the joined tree
+     */
+    typename BST<T>::BinTree join2(typename BST<T>::BinTree left, int leftHeight, typename BST<T>::BinTree right,
+                                   int rightHeight, int& height);
+
+    /**
+     * @brief Split the last node off a tree in O(log n).
+     * @param tree the tree (not empty)
+     * @param height height of the tree
+     * @param rest returns the tree without its last node
+     * @param restHeight returns the height of rest
+     * @return the last node, detached
+     */
+    typename BST<T>::BinTree splitLast(typename BST<T>::BinTree tree, int height, typename BST<T>::BinTree& rest,
+                                       int& restHeight);
+
+    /**
+     * @brief Split a tree around a value in O(log n).
+     *        Every node on the path down is joined back with the side of the path
+     *        it hangs off.
+     * @param tree the tree
+     * @param height height of the tree
+     * @param value to split around
+     * @param left returns the tree of the smaller values
+     * @param leftHeight returns the height of left
+     * @param right returns the tree of the greater values
+     * @param rightHeight returns the height of right
+     * @return the node of the value, detached (null if the value is not in the tree)
+     */
+    typename BST<T>::BinTree split(typename BST<T>::BinTree tree, int height, const T& value,
+                                   typename BST<T>::BinTree& left, int& leftHeight,
+                                   typename BST<T>::BinTree& right, int& rightHeight);
+
+    /**
+     * @brief Copy a tree into nodes from the slots of an operation.
+     *        The copy has the same shape, so the counts and balance factors carry over.
+     * @param op the operation (with a slot for every node)
+     * @param tree to copy
+     * @return root of the copy
+     */
+    typename BST<T>::BinTree copyOf(SetOperation& op, const typename BST<T>::BinTreeNode* tree);
+
+    /**
+     * @brief Run two parts of an operation, on two threads if they are big enough.
+     *        A thread is only forked while the operation has idle threads left,
+     *        otherwise (or if it cannot be started) both parts run on this one.
+     * @param op the operation
+     * @param size number of values the parts deal with
+     * @param first part that may run on a forked thread
+     * @param second part that runs on this thread
+     */
+    template <typename First, typename Second>
+    static void forkJoin(SetOperation& op, unsigned size, First first, Second second);
+
+    /**
+     * @brief Merge another tree into a tree (see unionWith).
+     * @param op the operation (with a slot for every node of theirs)
+     * @param ours the tree
+     * @param oursHeight height of ours
+     * @param theirs the other tree
+     * @param theirsHeight height of theirs
+     * @param height returns the height of the merged tree
+     * @return root of the merged tree
+     */
+    typename BST<T>::BinTree unionOf(SetOperation& op, typename BST<T>::BinTree ours, int oursHeight,
+                                     const typename BST<T>::BinTreeNode* theirs, int theirsHeight, int& height);
+
+    /**
+     * @brief Keep the values of a tree that are in another tree (see intersectWith).
+     * @param op the operation
+     * @param ours the tree
+     * @param oursHeight height of ours
+     * @param theirs the other tree
+     * @param theirsHeight height of theirs
+     * @param released receives the nodes that are no longer in the tree
+     * @param height returns the height of the remaining tree
+     * @return root of the remaining tree
+     */
+    typename BST<T>::BinTree intersectionOf(SetOperation& op, typename BST<T>::BinTree ours, int oursHeight,
+                                            const typename BST<T>::BinTreeNode* theirs, int theirsHeight,
+                                            NodeList& released, int& height);
+
+    /**
+     * @brief Drop the values of a tree that are in another tree (see difference).
+     * @param op the operation
+     * @param ours the tree
+     * @param oursHeight height of ours
+     * @param theirs the other tree
+     * @param theirsHeight height of theirs
+     * @param released receives the nodes that are no longer in the tree
+     * @param height returns the height of the remaining tree
+     * @return root of the remaining tree
+     */
+    typename BST<T>::BinTree differenceOf(SetOperation& op, typename BST<T>::BinTree ours, int oursHeight,
+                                          const typename BST<T>::BinTreeNode* theirs, int theirsHeight,
+                                          NodeList& released, int& height);
+
+    /**
+     * @brief Get an iterator to the first value that is not before a value in O(log n).
+     *        The path goes down to where the value would be, then is cut back to the
+     *        last node where it went left (the first value after the spot).
+     * @param value to look for
+     * @param orEqual true to stop at a value equal to it (lower bound), false to go past it (upper bound)
+     * @return the iterator
+     */
+    const_iterator bound(const T& value, bool orEqual) const;
+
+    /**
+     * @brief Count the values smaller than (or equal to) a value in O(log n).
+     * @param value to compare with
+     * @param orEqual true to count a value equal to it too
+     * @return number of values
+     */
+    unsigned countBelow(const T& value, bool orEqual) const;
+
+    void printInorder_(const typename BST<T>::BinTree& tree, std::stringstream& ss) const;
+
+    int height_; // height of the tree (-1 if it is empty), kept up to date by add/remove/clear
 };
 
 #include "AVL.cpp"
@@ -0,0 +1,288 @@
+/**
+ * @file CompactAVL.cpp
+ * @brief This file contains the compact AVL tree class definition
+ *        (included from CompactAVL.h since the class is a template)
+ */
+
+#include <new>
+
+template <typename T>
+CompactAVL<T>::CompactAVL(SimpleAllocator* allocator)
+    : allocator_(allocator), isOwnAllocator_(false), root_(0), freeList_(0), nextIndex_(1), size_(0) {
+    // index 0 stands for no node, so the first slot of the first chunk is never handed out
+    if (!allocator_) {
+        SimpleAllocatorConfig config(false, 4, 0, SimpleAllocatorConfig::HeaderBlockInfo(), 64);
+        allocator_ = new SimpleAllocator(CHUNK_SIZE, config);
+        isOwnAllocator_ = true;
+    } else if (allocator_->getStats().objectSize < CHUNK_SIZE) {
+        throw SimpleAllocatorException(SimpleAllocatorException::E_BAD_SIZE,
+                                       "CompactAVL: Allocator objects are smaller than a chunk of nodes.");
+    }
+}
+
+template <typename T>
+CompactAVL<T>::~CompactAVL() {
+    clear();
+    if (isOwnAllocator_)
+        delete allocator_;
+}
+
+template <typename T>
+void CompactAVL<T>::add(const T& value) {
+    // walk down to the empty spot, remembering the way
+    uint32_t path[MAX_HEIGHT];
+    unsigned char dirs[MAX_HEIGHT];
+    unsigned depth = 0;
+    for (uint32_t index = root_; index;) {
+        const Node& n = node(index);
+        if (!(value < n.data) && !(n.data < value))
+            throw BSTException(BSTException::E_DUPLICATE, "add: Value is already in the tree.");
+        path[depth] = index;
+        dirs[depth] = n.data < value;
+        index = child(n, dirs[depth]);
+        ++depth;
+    }
+
+    // - this throws before the tree is touched
+    const uint32_t added = makeNode(value);
+    relink(path, dirs, depth, added);
+    ++size_;
+
+    // retrace: every subtree on the way grew by a level until one absorbs it
+    while (depth--) {
+        Node& n = node(path[depth]);
+        const int newBalance = balance(n) + (dirs[depth] ? 1 : -1);
+        if (newBalance == 0) {
+            setBalance(n, 0);
+            return;
+        }
+        if (newBalance == 1 || newBalance == -1) {
+            setBalance(n, newBalance);
+            continue;
+        }
+
+        // the rotation brings the subtree back to its height before the add
+        bool shrunk;
+        relink(path, dirs, depth, rotate(path[depth], dirs[depth], shrunk));
+        return;
+    }
+}
+
+template <typename T>
+void CompactAVL<T>::remove(const T& value) {
+    // walk down to the value, remembering the way
+    uint32_t path[MAX_HEIGHT];
+    unsigned char dirs[MAX_HEIGHT];
+    unsigned depth = 0;
+    uint32_t index = root_;
+    while (index) {
+        const Node& n = node(index);
+        if (!(value < n.data) && !(n.data < value))
+            break;
+        path[depth] = index;
+        dirs[depth] = n.data < value;
+        index = child(n, dirs[depth]);
+        ++depth;
+    }
+    if (!index)
+        throw BSTException(BSTException::E_NOT_FOUND, "remove: Value is not in the tree.");
+
+    // a node with two children takes its successor's value, and the successor goes instead
+    if (node(index).left && child(node(index), 1)) {
+        Node& found = node(index);
+        path[depth] = index;
+        dirs[depth] = 1;
+        ++depth;
+        uint32_t successor = child(found, 1);
+        while (node(successor).left) {
+            path[depth] = successor;
+            dirs[depth] = 0;
+            ++depth;
+            successor = node(successor).left;
+        }
+        found.data = node(successor).data;
+        index = successor;
+    }
+
+    // the node has one child at most, which takes its place
+    const Node& removed = node(index);
+    relink(path, dirs, depth, removed.left ? removed.left : child(removed, 1));
+    freeNode(index);
+    --size_;
+
+    // retrace: every subtree on the way lost a level until one keeps its height
+    while (depth--) {
+        Node& n = node(path[depth]);
+        const int newBalance = balance(n) - (dirs[depth] ? 1 : -1);
+        if (newBalance == 0) {
+            setBalance(n, 0);
+            continue;
+        }
+        if (newBalance == 1 || newBalance == -1) {
+            setBalance(n, newBalance);
+            return;
+        }
+
+        // the taller side is the one the value did not come from
+        bool shrunk;
+        relink(path, dirs, depth, rotate(path[depth], !dirs[depth], shrunk));
+        if (!shrunk)
+            return;
+    }
+}
+
+template <typename T>
+bool CompactAVL<T>::find(const T& value, unsigned& compares) const {
+    compares = 0;
+    for (uint32_t index = root_; index;) {
+        const Node& n = node(index);
+        ++compares;
+        if (value < n.data)
+            index = n.left;
+        else if (n.data < value)
+            index = child(n, 1);
+        else
+            return true;
+    }
+    return false;
+}
+
+template <typename T>
+std::stringstream CompactAVL<T>::printInorder() const {
+    std::stringstream ss;
+    printInorder_(root_, ss);
+    return ss;
+}
+
+template <typename T>
+void CompactAVL<T>::printInorder_(uint32_t index, std::stringstream& ss) const {
+    if (!index)
+        return;
+    const Node& n = node(index);
+    printInorder_(n.left, ss);
+    ss << n.data << " ";
+    printInorder_(child(n, 1), ss);
+}
+
+template <typename T>
+int CompactAVL<T>::height() const {
+    int height = -1;
+    for (uint32_t index = root_; index; ++height) {
+        // a balanced node has subtrees of the same height, either one will do
+        const Node& n = node(index);
+        index = balance(n) < 0 ? n.left : child(n, 1);
+    }
+    return height;
+}
+
+template <typename T>
+void CompactAVL<T>::clear() {
+    // the values only need visiting if they have destructors to run
+    // - a stack of right children, each pushed when its parent is left for the left child
+    if (!std::is_trivially_destructible<T>::value && root_) {
+        uint32_t pending[MAX_HEIGHT];
+        unsigned count = 0;
+        pending[count++] = root_;
+        while (count) {
+            uint32_t index = pending[--count];
+            while (index) {
+                Node& n = node(index);
+                const uint32_t right = child(n, 1);
+                if (right)
+                    pending[count++] = right;
+                index = n.left;
+                n.data.~T();
+            }
+        }
+    }
+
+    for (Node* pChunk : chunks_)
+        allocator_->free(pChunk);
+    chunks_.clear();
+    root_ = 0;
+    freeList_ = 0;
+    nextIndex_ = 1;
+    size_ = 0;
+}
+
+template <typename T>
+uint32_t CompactAVL<T>::makeNode(const T& value) {
+    // reuse a freed node if there is one, else carve the next one out of the last chunk
+    uint32_t index = freeList_;
+    if (!index) {
+        if (nextIndex_ > MAX_NODES)
+            throw BSTException(BSTException::E_NO_MEMORY, "add: No more node indices available.");
+        if ((nextIndex_ >> CHUNK_SHIFT) == chunks_.size()) {
+            chunks_.reserve(chunks_.size() + 1);
+            chunks_.push_back(static_cast<Node*>(allocator_->allocate()));
+        }
+        index = nextIndex_;
+    }
+
+    // - the value is constructed before anything changes, in case its constructor throws
+    Node& n = node(index);
+    new (&n.data) T(value);
+    if (index == freeList_)
+        freeList_ = n.left;
+    else
+        ++nextIndex_;
+    n.left = 0;
+    n.rightAndBalance = 0;
+    setBalance(n, 0);
+    return index;
+}
+
+template <typename T>
+void CompactAVL<T>::freeNode(uint32_t index) {
+    Node& n = node(index);
+    n.data.~T();
+    n.left = freeList_;
+    freeList_ = index;
+}
+
+template <typename T>
+uint32_t CompactAVL<T>::rotate(uint32_t index, int dir, bool& shrunk) {
+    Node& top = node(index);
+    const uint32_t tallIndex = child(top, dir);
+    Node& tall = node(tallIndex);
+    const int sign = dir ? 1 : -1;
+    const int tallBalance = balance(tall);
+
+    // the taller child leans the other way: its inner child comes up (double rotation)
+    if (tallBalance == -sign) {
+        const uint32_t innerIndex = child(tall, !dir);
+        Node& inner = node(innerIndex);
+        const int innerBalance = balance(inner);
+        setChild(top, dir, child(inner, !dir));
+        setChild(tall, !dir, child(inner, dir));
+        setChild(inner, !dir, index);
+        setChild(inner, dir, tallIndex);
+        setBalance(top, innerBalance == sign ? -sign : 0);
+        setBalance(tall, innerBalance == -sign ? sign : 0);
+        setBalance(inner, 0);
+        shrunk = true;
+        return innerIndex;
+    }
+
+    // otherwise the taller child itself comes up (single rotation)
+    setChild(top, dir, child(tall, !dir));
+    setChild(tall, !dir, index);
+    if (tallBalance == 0) {
+        setBalance(top, sign);
+        setBalance(tall, -sign);
+        shrunk = false;
+    } else {
+        setBalance(top, 0);
+        setBalance(tall, 0);
+        shrunk = true;
+    }
+    return tallIndex;
+}
+
+template <typename T>
+void CompactAVL<T>::relink(const uint32_t* path, const unsigned char* dirs, unsigned depth, uint32_t index) {
+    if (depth == 0)
+        root_ = index;
+    else
+        setChild(node(path[depth - 1]), dirs[depth - 1], index);
+}
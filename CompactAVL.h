@@ -0,0 +1,239 @@
+/**
+ * @file CompactAVL.h
+ * @brief This file contains the compact AVL tree class declaration
+ *        An AVL tree whose nodes link to each other with 32-bit indices instead of
+ *        pointers, for big in-memory indexes where the node overhead dominates
+ */
+
+#ifndef COMPACTAVL_H
+#define COMPACTAVL_H
+#include <cstdint>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+#include "BST.h"
+#include "SimpleAllocator.h"
+
+/**
+ * @brief Compact AVL tree class
+ *        - a node is just the value and two 32-bit child indices, with the balance
+ *          factor packed into the top 2 bits of the right index (12 bytes for an int
+ *          instead of the 32 of a BST<int>::BinTreeNode)
+ *        - nodes live in chunks of NODES_PER_CHUNK, one SimpleAllocator block each,
+ *          so an index is | chunk | slot | and index 0 stands for no node
+ *        - freed nodes are kept on a free list of their own and reused by the next adds,
+ *          the chunks only go back to the allocator in clear()
+ *        - add/remove walk down iteratively with the path in a fixed-size array and
+ *          stop retracing as soon as a subtree's height is unchanged
+ *        - there are no per-node counts, so size() is kept by the tree and height()
+ *          follows the taller side down from the root in O(log n)
+ * @tparam T Type of data to be stored in the tree
+ */
+template <typename T>
+class CompactAVL {
+public:
+
+    // nodes per chunk (a power of 2, so that an index splits into chunk and slot with shifts)
+    static const unsigned CHUNK_SHIFT = 10;
+    static const unsigned NODES_PER_CHUNK = 1u << CHUNK_SHIFT;
+
+    // indices have 30 bits, the other 2 hold the balance factor
+    static const uint32_t MAX_NODES = (1u << 30) - 1;
+
+    /**
+     * @brief A node of the compact tree
+     */
+    struct Node {
+        T data; // the value
+        uint32_t left; // index of the left child (0 if none)
+        uint32_t rightAndBalance; // | balance factor + 1 (2 bits) | index of the right child (30 bits) |
+    };
+
+    // bytes of a chunk of nodes, which is the object size the allocator must have
+    static const size_t CHUNK_SIZE = NODES_PER_CHUNK * sizeof(Node);
+
+    /**
+     * @brief Constructor.
+     * @param allocator Pointer to the allocator of the node chunks, with objects of at least
+     *                  CHUNK_SIZE bytes aligned to alignof(T) (ideally to a cache line).
+     *                  If null, the tree makes its own (cache-line aligned).
+     * @throw SimpleAllocatorException E_BAD_SIZE if the allocator's objects cannot hold a chunk
+     */
+    CompactAVL(SimpleAllocator* allocator = nullptr);
+
+    /**
+     * @brief Destructor
+     *        Releases the nodes (see clear) and the tree's own allocator if any.
+     */
+    ~CompactAVL();
+
+    /**
+     * @brief Add a new value to the tree and balance the tree.
+     * @param value to be added to the tree
+     * @throw BSTException E_DUPLICATE if the value already exists in the tree,
+     *        E_NO_MEMORY if MAX_NODES are in use; or whatever the allocator throws
+     *        for a new chunk (the tree is left unchanged either way)
+     */
+    void add(const T& value);
+
+    /**
+     * @brief Remove a value from the tree and balance the tree.
+     * @param value to be removed from the tree
+     * @throw BSTException E_NOT_FOUND if the value does not exist in the tree
+     */
+    void remove(const T& value);
+
+    /**
+     * @brief Find a value in the tree.
+     * @param value to be found
+     * @param compares number of nodes visited (one compare each, like BST::find)
+     * @return true if the value is in the tree
+     */
+    bool find(const T& value, unsigned& compares) const;
+
+    /**
+     * @brief Print the inorder traversal of the tree.
+     * @return stringstream containing the inorder traversal of the tree
+     */
+    std::stringstream printInorder() const;
+
+    /**
+     * @brief Get the height of the tree in O(log n).
+     *        The balance factors tell which child is the taller one all the way down.
+     * @return height of the tree (-1 if it is empty)
+     */
+    int height() const;
+
+    /**
+     * @brief Get the size of the tree in O(1).
+     * @return number of values in the tree
+     */
+    unsigned size() const {
+        return size_;
+    }
+
+    /**
+     * @brief Check whether the tree is empty.
+     * @return true if there are no values in the tree
+     */
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    /**
+     * @brief Remove all the values from the tree.
+     *        Only walks the nodes if the values need their destructors run,
+     *        then hands every chunk back to the allocator.
+     */
+    void clear();
+
+private:
+    // Disable copy constructor and assignment operator
+    CompactAVL(const CompactAVL&) = delete;
+    CompactAVL& operator=(const CompactAVL&) = delete;
+
+    // deepest path add/remove may have to remember
+    // - an AVL tree of MAX_NODES nodes is at most 1.44 * log2(MAX_NODES) ~ 43 levels high
+    static const unsigned MAX_HEIGHT = 48;
+
+    static const uint32_t INDEX_MASK = MAX_NODES;
+    static const unsigned BALANCE_SHIFT = 30;
+
+    /**
+     * @brief Get a node from its index.
+     * @param index index of the node (not 0)
+     * @return the node
+     */
+    Node& node(uint32_t index) const {
+        return chunks_[index >> CHUNK_SHIFT][index & (NODES_PER_CHUNK - 1)];
+    }
+
+    /**
+     * @brief Get a child of a node.
+     * @param n the node
+     * @param dir 0 for the left child, 1 for the right one
+     * @return index of the child (0 if none)
+     */
+    static uint32_t child(const Node& n, int dir) {
+        return dir ? n.rightAndBalance & INDEX_MASK : n.left;
+    }
+
+    /**
+     * @brief Set a child of a node (keeping its balance factor).
+     * @param n the node
+     * @param dir 0 for the left child, 1 for the right one
+     * @param index index of the child (0 for none)
+     */
+    static void setChild(Node& n, int dir, uint32_t index) {
+        if (dir)
+            n.rightAndBalance = (n.rightAndBalance & ~INDEX_MASK) | index;
+        else
+            n.left = index;
+    }
+
+    /**
+     * @brief Get the balance factor of a node.
+     * @param n the node
+     * @return height of the right subtree minus height of the left one (-1, 0 or 1)
+     */
+    static int balance(const Node& n) {
+        return static_cast<int>(n.rightAndBalance >> BALANCE_SHIFT) - 1;
+    }
+
+    /**
+     * @brief Set the balance factor of a node (keeping its right child).
+     * @param n the node
+     * @param balance height of the right subtree minus height of the left one (-1, 0 or 1)
+     */
+    static void setBalance(Node& n, int balance) {
+        n.rightAndBalance = (n.rightAndBalance & INDEX_MASK) | static_cast<uint32_t>(balance + 1) << BALANCE_SHIFT;
+    }
+
+    /**
+     * @brief Take a node off the free list (or a new chunk) and construct its value.
+     * @param value value of the node
+     * @return index of the node, a balanced leaf
+     */
+    uint32_t makeNode(const T& value);
+
+    /**
+     * @brief Destroy the value of a node and put the node on the free list.
+     * @param index index of the node
+     */
+    void freeNode(uint32_t index);
+
+    /**
+     * @brief Rotate a subtree that is 2 levels taller on one side back into balance.
+     *        This is a single rotation if the taller child leans the same way (or not at all),
+     *        a double rotation otherwise.
+     * @param index index of the root of the subtree
+     * @param dir the taller side (0 for left, 1 for right)
+     * @param shrunk set to true if the subtree is now 1 level lower than before the rotation
+     *               (only a remove can leave it as high, when the taller child was balanced)
+     * @return index of the new root of the subtree
+     */
+    uint32_t rotate(uint32_t index, int dir, bool& shrunk);
+
+    /**
+     * @brief Point the parent of a path node (or the root) at another node.
+     * @param path indices of the nodes from the root down
+     * @param dirs the way taken at each of them
+     * @param depth position of the node on the path
+     * @param index index of the node to link in its place
+     */
+    void relink(const uint32_t* path, const unsigned char* dirs, unsigned depth, uint32_t index);
+
+    void printInorder_(uint32_t index, std::stringstream& ss) const;
+
+    SimpleAllocator* allocator_; // allocator of the node chunks
+    bool isOwnAllocator_; // true if the tree made the allocator itself
+    std::vector<Node*> chunks_; // node chunks (index >> CHUNK_SHIFT)
+    uint32_t root_; // index of the root (0 if the tree is empty)
+    uint32_t freeList_; // freed nodes, linked through their left index
+    uint32_t nextIndex_; // first index never handed out (the rest of the last chunk)
+    unsigned size_; // number of values in the tree
+};
+
+#include "CompactAVL.cpp"
+
+#endif // COMPACTAVL_H
@@ -0,0 +1,305 @@
+/**
+ * @file DurableAVL.cpp
+ * @brief This file contains the durable AVL tree class definition
+ *        (included from DurableAVL.h since the class is a template)
+ */
+
+#include <cstring>
+#include <type_traits>
+
+// the log is synced to the disk, and renames made to last, where there is POSIX
+// (elsewhere it is only flushed to the OS)
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define DURABLEAVL_HAS_POSIX 1
+#else
+#define DURABLEAVL_HAS_POSIX 0
+#endif
+
+template <typename T>
+DurableAVL<T>::DurableAVL(const std::string& path, const DurableAVLConfig& config, SimpleAllocator* allocator)
+    : tree_(allocator), config_(config), snapshotPath_(path + ".snapshot"), logPath_(path + ".log"), log_(nullptr),
+      logRecords_(0), recoveredRecords_(0), appended_(0), durable_(0), commitTarget_(0), syncCount_(0),
+      stopping_(false) {
+    static_assert(std::is_trivially_copyable<T>::value, "DurableAVL: T must be trivially copyable.");
+    recover();
+    pending_.resize(sizeof(FrameHeader));
+    flushing_.resize(sizeof(FrameHeader));
+    flusher_ = std::thread(&DurableAVL::flushLoop, this);
+}
+
+template <typename T>
+DurableAVL<T>::~DurableAVL() {
+    // the flusher writes what is left before it stops
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    flushWanted_.notify_one();
+    flusher_.join();
+    std::fclose(log_);
+}
+
+template <typename T>
+void DurableAVL<T>::add(const T& value) {
+    {
+        // - the tree throws before anything is logged
+        std::lock_guard<std::mutex> lock(mutex_);
+        throwIfFailed();
+        tree_.add(value);
+        append(OP_ADD, value);
+    }
+    checkpointIfDue();
+}
+
+template <typename T>
+void DurableAVL<T>::remove(const T& value) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        throwIfFailed();
+        tree_.remove(value);
+        append(OP_REMOVE, value);
+    }
+    checkpointIfDue();
+}
+
+template <typename T>
+void DurableAVL<T>::commit() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const uint64_t target = appended_;
+    if (durable_ < target) {
+        commitTarget_ = std::max(commitTarget_, target);
+        flushWanted_.notify_one();
+        flushed_.wait(lock, [this, target] { return durable_ >= target || !error_.empty(); });
+    }
+    throwIfFailed();
+}
+
+template <typename T>
+void DurableAVL<T>::checkpoint() {
+    // once the log is all synced, the flusher has nothing to write until the next add/remove,
+    // which cannot come before this returns, so the log can be swapped under it
+    commit();
+    tree_.save(snapshotPath_);
+    syncDirectory(snapshotPath_);
+    resetLog(nullptr, 0);
+    logRecords_ = 0;
+}
+
+template <typename T>
+void DurableAVL<T>::append(unsigned char op, const T& value) {
+    // the first record of a batch wakes the flusher (if it is asleep, this is the only syscall)
+    const size_t at = pending_.size();
+    pending_.resize(at + RECORD_SIZE);
+    pending_[at] = op;
+    std::memcpy(&pending_[at + 1], &value, sizeof(T));
+    ++appended_;
+    ++logRecords_;
+    if (at == sizeof(FrameHeader))
+        flushWanted_.notify_one();
+}
+
+template <typename T>
+void DurableAVL<T>::throwIfFailed() const {
+    if (!error_.empty())
+        throw SnapshotException(SnapshotException::E_IO, error_);
+}
+
+template <typename T>
+void DurableAVL<T>::checkpointIfDue() {
+    if (config_.checkpointRecords && logRecords_ >= config_.checkpointRecords)
+        checkpoint();
+}
+
+template <typename T>
+void DurableAVL<T>::recover() {
+    {
+        // - no snapshot is an empty tree
+        std::FILE* snapshot = std::fopen(snapshotPath_.c_str(), "rb");
+        if (snapshot) {
+            std::fclose(snapshot);
+            tree_.load(snapshotPath_);
+        }
+    }
+
+    // read the whole log (no log is an empty one)
+    std::vector<unsigned char> log;
+    if (std::FILE* file = std::fopen(logPath_.c_str(), "rb")) {
+        unsigned char buffer[1 << 16];
+        size_t read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+            log.insert(log.end(), buffer, buffer + read);
+        const bool failed = std::ferror(file);
+        std::fclose(file);
+        if (failed)
+            throw SnapshotException(SnapshotException::E_IO, "DurableAVL: Cannot read " + logPath_ + ".");
+    }
+
+    size_t good = sizeof(LogHeader);
+    if (!log.empty()) {
+        LogHeader header;
+        if (log.size() < sizeof(header))
+            throw SnapshotException(SnapshotException::E_BAD_FORMAT, "DurableAVL: " + logPath_ + " is not a log.");
+        std::memcpy(&header, log.data(), sizeof(header));
+        if (std::memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0)
+            throw SnapshotException(SnapshotException::E_BAD_FORMAT, "DurableAVL: " + logPath_ + " is not a log.");
+        if (header.version != LOG_VERSION || header.valueSize != sizeof(T))
+            throw SnapshotException(SnapshotException::E_BAD_FORMAT,
+                                    "DurableAVL: " + logPath_ + " has another version or value type.");
+
+        // replay the frames up to the first one that is cut short or does not check out
+        while (good + sizeof(FrameHeader) <= log.size()) {
+            FrameHeader frame;
+            std::memcpy(&frame, &log[good], sizeof(frame));
+            const size_t end = good + sizeof(frame) + size_t(frame.records) * RECORD_SIZE;
+            if (frame.magic != FRAME_MAGIC || end > log.size())
+                break;
+            const uint64_t stored = frame.checksum;
+            frame.checksum = 0;
+            if (FrozenAVL<T>::checksum(FrozenAVL<T>::checksum(0, &frame, sizeof(frame)), &log[good + sizeof(frame)],
+                                       end - good - sizeof(frame)) != stored)
+                break;
+
+            for (size_t at = good + sizeof(frame); at < end; at += RECORD_SIZE) {
+                T value;
+                std::memcpy(&value, &log[at + 1], sizeof(T));
+                unsigned compares;
+                const bool found = tree_.find(value, compares);
+                if (log[at] == OP_ADD && !found)
+                    tree_.add(value);
+                else if (log[at] == OP_REMOVE && found)
+                    tree_.remove(value);
+            }
+            recoveredRecords_ += frame.records;
+            good = end;
+        }
+    }
+    logRecords_ = recoveredRecords_;
+
+    // a log that is missing or has a bad tail is written again with the good frames
+    if (good == log.size()) {
+        log_ = std::fopen(logPath_.c_str(), "ab");
+        if (!log_)
+            throw SnapshotException(SnapshotException::E_IO, "DurableAVL: Cannot open " + logPath_ + ".");
+    } else {
+        resetLog(log.size() > sizeof(LogHeader) ? &log[sizeof(LogHeader)] : nullptr,
+                 good - sizeof(LogHeader));
+    }
+}
+
+template <typename T>
+void DurableAVL<T>::writeFrame(std::vector<unsigned char>& batch) {
+    FrameHeader frame;
+    frame.magic = FRAME_MAGIC;
+    frame.records = static_cast<uint32_t>((batch.size() - sizeof(frame)) / RECORD_SIZE);
+    frame.checksum = 0;
+    frame.checksum = FrozenAVL<T>::checksum(FrozenAVL<T>::checksum(0, &frame, sizeof(frame)),
+                                            batch.data() + sizeof(frame), batch.size() - sizeof(frame));
+    std::memcpy(batch.data(), &frame, sizeof(frame));
+
+    // - a write that fails halfway leaves a torn frame, which recovery drops
+    if (std::fwrite(batch.data(), 1, batch.size(), log_) != batch.size() || std::fflush(log_) != 0 || !syncFile(log_))
+        throw SnapshotException(SnapshotException::E_IO, "DurableAVL: Cannot write to " + logPath_ + ".");
+}
+
+template <typename T>
+void DurableAVL<T>::flushLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        // sleep until a batch starts, then let it grow for the interval (unless a commit is waiting)
+        flushWanted_.wait(lock, [this] { return stopping_ || appended_ > durable_; });
+        flushWanted_.wait_for(lock, config_.commitInterval,
+                              [this] { return stopping_ || commitTarget_ > durable_; });
+        if (appended_ == durable_) {
+            if (stopping_)
+                return;
+            continue;
+        }
+
+        // the writers go on into the other buffer while this one is written
+        const uint64_t batchEnd = appended_;
+        pending_.swap(flushing_);
+        lock.unlock();
+        std::string error;
+        try {
+            writeFrame(flushing_);
+        } catch (const SnapshotException& e) {
+            error = e.what();
+        }
+        flushing_.resize(sizeof(FrameHeader));
+        lock.lock();
+
+        // - after a failure, nothing more is written: the adds/removes and commits throw
+        if (!error.empty()) {
+            error_ = error;
+            flushed_.notify_all();
+            return;
+        }
+        durable_ = batchEnd;
+        ++syncCount_;
+        flushed_.notify_all();
+    }
+}
+
+template <typename T>
+void DurableAVL<T>::resetLog(const unsigned char* frames, size_t size) {
+    LogHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+    header.version = LOG_VERSION;
+    header.valueSize = sizeof(T);
+
+    const std::string tempPath = logPath_ + ".tmp";
+    std::FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (!file)
+        throw SnapshotException(SnapshotException::E_IO, "DurableAVL: Cannot create " + tempPath + ".");
+    const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1
+                         && (!size || std::fwrite(frames, 1, size, file) == size) && std::fflush(file) == 0
+                         && syncFile(file);
+    if (std::fclose(file) != 0 || !written) {
+        std::remove(tempPath.c_str());
+        throw SnapshotException(SnapshotException::E_IO, "DurableAVL: Cannot write " + tempPath + ".");
+    }
+    if (std::rename(tempPath.c_str(), logPath_.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        throw SnapshotException(SnapshotException::E_IO,
+                                "DurableAVL: Cannot rename " + tempPath + " to " + logPath_ + ".");
+    }
+    syncDirectory(logPath_);
+
+    std::FILE* log = std::fopen(logPath_.c_str(), "ab");
+    if (!log)
+        throw SnapshotException(SnapshotException::E_IO, "DurableAVL: Cannot open " + logPath_ + ".");
+    if (log_)
+        std::fclose(log_);
+    log_ = log;
+}
+
+template <typename T>
+bool DurableAVL<T>::syncFile(std::FILE* file) {
+#if DURABLEAVL_HAS_POSIX && defined(__APPLE__)
+    return fsync(fileno(file)) == 0;
+#elif DURABLEAVL_HAS_POSIX
+    // - only the data and the size, not the other metadata, which saves a write
+    return fdatasync(fileno(file)) == 0;
+#else
+    (void)file;
+    return true;
+#endif
+}
+
+template <typename T>
+void DurableAVL<T>::syncDirectory(const std::string& path) {
+#if DURABLEAVL_HAS_POSIX
+    const size_t slash = path.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    const int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#else
+    (void)path;
+#endif
+}
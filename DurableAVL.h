@@ -0,0 +1,268 @@
+/**
+ * @file DurableAVL.h
+ * @brief This file contains the durable AVL tree class declaration
+ *        An AVL tree whose adds and removes go to an append-only log, with checkpoints,
+ *        so that it comes back after a restart or a crash
+ */
+
+#ifndef DURABLEAVL_H
+#define DURABLEAVL_H
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AVL.h"
+
+/**
+ * DurableAVL configuration parameters struct
+ */
+struct DurableAVLConfig {
+    /**
+     * Constructor
+     * @param commitInterval how long a batch of records may wait before it is written and synced
+     * @param checkpointRecords records in the log after which the next add/remove takes a checkpoint
+     *                          (0 for only when checkpoint() is called)
+     */
+    DurableAVLConfig(std::chrono::microseconds commitInterval = std::chrono::milliseconds(1),
+                     unsigned checkpointRecords = 1u << 20)
+        : commitInterval(commitInterval), checkpointRecords(checkpointRecords) {}
+
+    std::chrono::microseconds commitInterval; // how long a batch may grow before the flusher syncs it
+    unsigned checkpointRecords; // records in the log that trigger a checkpoint (0 for never)
+};
+
+/**
+ * @brief Durable AVL tree class
+ *        - the tree is an AVL<T> in memory, and every add/remove is also appended as a
+ *          record to a buffer, which costs no syscall
+ *        - a flusher thread writes the buffer to the log as one checksummed frame and
+ *          syncs it (fdatasync), at most commitInterval after the first record of the
+ *          batch (group commit), so a sync covers every operation of the interval
+ *        - commit() waits until everything so far is on the disk
+ *        - a checkpoint saves the tree as a snapshot (AVL::save) and starts the log over
+ *        - on construction the tree is recovered: the snapshot is loaded (AVL::load) and
+ *          the log replayed on top of it, up to the first torn or corrupted frame
+ *        - the files are path + ".snapshot" and path + ".log"
+ *        - like AVL, it is not safe to change from several threads at once
+ * @tparam T Type of data to be stored in the tree (trivially copyable)
+ */
+template <typename T>
+class DurableAVL {
+public:
+
+    /**
+     * @brief Constructor, which recovers the tree from its files (if any) and starts
+     *        the flusher thread.
+     *        The records of the log are replayed so that an add of a value already in
+     *        the tree, or a remove of one not in it, is skipped: a crash during a
+     *        checkpoint leaves the new snapshot with the old log, and replaying the old
+     *        log on it gives the same tree.
+     *        A torn frame at the end of the log (from a crash while writing it) and
+     *        anything after it are dropped from the file.
+     * @param path the files are path + ".snapshot" and path + ".log"
+     * @param config configuration
+     * @param allocator allocator for the nodes of the tree (see AVL)
+     * @throw SnapshotException E_IO if a file cannot be read or written,
+     *        E_BAD_FORMAT or E_BAD_CHECKSUM if a file is not a snapshot or log of T
+     */
+    DurableAVL(const std::string& path, const DurableAVLConfig& config = DurableAVLConfig(),
+               SimpleAllocator* allocator = nullptr);
+
+    /**
+     * @brief Destructor, which commits what is left and stops the flusher thread.
+     */
+    ~DurableAVL();
+
+    DurableAVL(const DurableAVL&) = delete;
+    DurableAVL& operator=(const DurableAVL&) = delete;
+
+    /**
+     * @brief Add a value to the tree and log it.
+     *        It is durable after the next commit (the flusher's or commit()).
+     * @param value to be added
+     * @throw BSTException if the value already exists in the tree,
+     *        SnapshotException E_IO if writing the log has failed
+     */
+    void add(const T& value);
+
+    /**
+     * @brief Remove a value from the tree and log it.
+     *        It is durable after the next commit (the flusher's or commit()).
+     * @param value to be removed
+     * @throw BSTException if the value does not exist in the tree,
+     *        SnapshotException E_IO if writing the log has failed
+     */
+    void remove(const T& value);
+
+    /**
+     * @brief Wait until every add/remove so far is written to the log and synced.
+     *        The flusher writes the batch right away instead of at the end of its
+     *        interval.
+     * @throw SnapshotException E_IO if writing the log has failed
+     */
+    void commit();
+
+    /**
+     * @brief Save the tree as the snapshot and start the log over, in O(N).
+     *        The snapshot replaces the old one by a rename before the log does, so a
+     *        crash at any point leaves a snapshot and a log that recover the tree.
+     * @throw SnapshotException E_IO if a file cannot be written
+     */
+    void checkpoint();
+
+    /**
+     * @brief Get the tree, for the lookups.
+     * @return the tree
+     */
+    const AVL<T>& tree() const {
+        return tree_;
+    }
+
+    /**
+     * @brief Get the number of records in the log (since the last checkpoint).
+     * @return number of records
+     */
+    unsigned logRecords() const {
+        return logRecords_;
+    }
+
+    /**
+     * @brief Get the number of records replayed from the log when the tree was recovered.
+     * @return number of records
+     */
+    unsigned recoveredRecords() const {
+        return recoveredRecords_;
+    }
+
+    /**
+     * @brief Get the number of frames the flusher has written and synced.
+     * @return number of frames
+     */
+    unsigned syncCount() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return syncCount_;
+    }
+
+private:
+
+    // record operations
+    static const unsigned char OP_ADD = 1;
+    static const unsigned char OP_REMOVE = 2;
+
+    // a record is its operation and the bytes of the value, unaligned
+    static const size_t RECORD_SIZE = 1 + sizeof(T);
+
+    // the first bytes of a log file, and the version of the format after them
+    static constexpr char LOG_MAGIC[8] = {'A', 'V', 'L', 'L', 'O', 'G', '\0', '\0'};
+    static const uint32_t LOG_VERSION = 1;
+
+    // the first bytes of a frame ("FRAM")
+    static const uint32_t FRAME_MAGIC = 0x4d415246;
+
+    /**
+     * @brief The start of a log file, followed by the frames.
+     */
+    struct LogHeader {
+        char magic[8]; // LOG_MAGIC
+        uint32_t version; // LOG_VERSION
+        uint32_t valueSize; // sizeof(T)
+    };
+
+    /**
+     * @brief The start of a frame, followed by its records.
+     */
+    struct FrameHeader {
+        uint32_t magic; // FRAME_MAGIC
+        uint32_t records; // number of records
+        uint64_t checksum; // of the header (with this 0) and then the records
+    };
+
+    /**
+     * @brief Append a record to the batch (the tree has already changed).
+     *        The caller holds mutex_.
+     * @param op OP_ADD or OP_REMOVE
+     * @param value the value
+     */
+    void append(unsigned char op, const T& value);
+
+    /**
+     * @brief Throw if writing the log has failed (the caller holds mutex_).
+     * @throw SnapshotException E_IO if it has
+     */
+    void throwIfFailed() const;
+
+    /**
+     * @brief Take a checkpoint if the log has reached config_.checkpointRecords.
+     */
+    void checkpointIfDue();
+
+    /**
+     * @brief Load the snapshot, replay the log and open it for appending.
+     */
+    void recover();
+
+    /**
+     * @brief Write a batch to the log as one frame and sync it (the flusher thread).
+     * @param batch the frame header space and then the records
+     * @throw SnapshotException E_IO if it cannot be written
+     */
+    void writeFrame(std::vector<unsigned char>& batch);
+
+    /**
+     * @brief Loop of the flusher thread: wait for a batch, give it the commit interval
+     *        to grow, then write it, until the destructor stops it.
+     */
+    void flushLoop();
+
+    /**
+     * @brief Replace the log with a new one holding some frames (maybe none),
+     *        by writing it next to the log and renaming it over, and open it for appending.
+     * @param frames frames to keep
+     * @param size number of bytes of the frames
+     * @throw SnapshotException E_IO if it cannot be written
+     */
+    void resetLog(const unsigned char* frames, size_t size);
+
+    /**
+     * @brief Sync the data of a file to the disk (the flush to the OS is done).
+     * @param file the file
+     * @return true if it worked
+     */
+    static bool syncFile(std::FILE* file);
+
+    /**
+     * @brief Sync the directory of a path, so that a rename into it lasts too.
+     *        Some file systems cannot, so it is only a best effort.
+     * @param path the path
+     */
+    static void syncDirectory(const std::string& path);
+
+    AVL<T> tree_; // the tree
+    DurableAVLConfig config_; // configuration
+    std::string snapshotPath_; // path of the snapshot
+    std::string logPath_; // path of the log
+    std::FILE* log_; // the log, open for appending
+    unsigned logRecords_; // records in the log
+    unsigned recoveredRecords_; // records replayed from the log at recovery
+
+    mutable std::mutex mutex_; // guards what follows, down to the thread
+    std::condition_variable flushWanted_; // wakes the flusher
+    std::condition_variable flushed_; // wakes the commits waiting for the flusher
+    std::vector<unsigned char> pending_; // frame header space and the records of the next batch
+    std::vector<unsigned char> flushing_; // the batch being written, swapped with pending_
+    uint64_t appended_; // records appended since the start
+    uint64_t durable_; // records synced since the start
+    uint64_t commitTarget_; // records a commit() is waiting for
+    unsigned syncCount_; // frames written and synced
+    std::string error_; // why writing the log failed (empty if it has not)
+    bool stopping_; // whether the destructor is stopping the flusher
+    std::thread flusher_; // the flusher thread
+};
+
+#include "DurableAVL.cpp"
+
+#endif // DURABLEAVL_H
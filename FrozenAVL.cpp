@@ -0,0 +1,295 @@
+/**
+ * @file FrozenAVL.cpp
+ * @brief This file contains the frozen AVL tree class definition
+ *        (included from FrozenAVL.h since the class is a template)
+ */
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// snapshots are mapped straight from the file (and synced to the disk when saved) where there is mmap
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FROZENAVL_HAS_MMAP 1
+#else
+#define FROZENAVL_HAS_MMAP 0
+#endif
+
+template <typename T>
+template <typename RandomIt>
+FrozenAVL<T>::FrozenAVL(RandomIt first, RandomIt last) : values_(nullptr), size_(0), height_(-1) {
+    const size_t count = static_cast<size_t>(last - first);
+    for (size_t i = 1; i < count; ++i) {
+        if (!(first[i - 1] < first[i]))
+            throw BSTException(BSTException::E_DUPLICATE, "FrozenAVL: Values are not strictly increasing.");
+    }
+    if (!count)
+        return;
+
+    const int height = floorLog2(count);
+    std::shared_ptr<std::vector<T>> values = std::make_shared<std::vector<T>>();
+    values->reserve(count);
+    for (size_t position = 1; position <= count; ++position)
+        values->push_back(first[rankOf(position, count, height)]);
+    values_ = values->data();
+    size_ = count;
+    height_ = height;
+    storage_ = std::move(values);
+}
+
+template <typename T>
+void FrozenAVL<T>::save(const std::string& path) const {
+    static_assert(std::is_trivially_copyable<T>::value, "FrozenAVL::save: T must be trivially copyable.");
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.valueSize = sizeof(T);
+    header.valueAlign = alignof(T);
+    header.count = size_;
+    header.height = height_;
+    header.checksum = checksum(checksum(0, &header, sizeof(header)), values_, size_ * sizeof(T));
+
+    // - the temporary file only replaces the old one once it is all there
+    const std::string tempPath = path + ".tmp";
+    std::FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (!file)
+        throw SnapshotException(SnapshotException::E_IO, "save: Cannot create " + tempPath + ".");
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1
+                   && (!size_ || std::fwrite(values_, sizeof(T), size_, file) == size_) && std::fflush(file) == 0;
+#if FROZENAVL_HAS_MMAP
+    // - on the disk before the rename, or a crash could leave the path naming an empty file
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    if (std::fclose(file) != 0 || !written) {
+        std::remove(tempPath.c_str());
+        throw SnapshotException(SnapshotException::E_IO, "save: Cannot write " + tempPath + ".");
+    }
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        throw SnapshotException(SnapshotException::E_IO, "save: Cannot rename " + tempPath + " to " + path + ".");
+    }
+}
+
+template <typename T>
+FrozenAVL<T> FrozenAVL<T>::loadMapped(const std::string& path, bool verify) {
+    static_assert(std::is_trivially_copyable<T>::value, "FrozenAVL::loadMapped: T must be trivially copyable.");
+    static_assert(sizeof(SnapshotHeader) == 64 && alignof(T) <= sizeof(SnapshotHeader),
+                  "FrozenAVL::loadMapped: The values must be aligned where the header ends.");
+    size_t fileSize;
+    std::shared_ptr<const void> storage = mapFile(path, fileSize);
+    const unsigned char* bytes = static_cast<const unsigned char*>(storage.get());
+
+    // every field is checked before the values are trusted
+    SnapshotHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+        throw SnapshotException(SnapshotException::E_BAD_FORMAT, "loadMapped: " + path + " is not a snapshot.");
+    if (header.version != SNAPSHOT_VERSION)
+        throw SnapshotException(SnapshotException::E_BAD_FORMAT,
+                                "loadMapped: " + path + " has version " + std::to_string(header.version)
+                                    + ", not " + std::to_string(SNAPSHOT_VERSION) + ".");
+    if (header.byteOrder != SNAPSHOT_BYTE_ORDER || header.valueSize != sizeof(T) || header.valueAlign != alignof(T))
+        throw SnapshotException(SnapshotException::E_BAD_FORMAT,
+                                "loadMapped: " + path + " was saved with another value type or byte order.");
+    if (header.count > UINT_MAX || fileSize != sizeof(header) + header.count * sizeof(T)
+        || header.height != (header.count ? floorLog2(header.count) : -1))
+        throw SnapshotException(SnapshotException::E_BAD_FORMAT,
+                                "loadMapped: " + path + " does not have the size its header says.");
+    if (verify) {
+        const uint64_t stored = header.checksum;
+        header.checksum = 0;
+        if (checksum(checksum(0, &header, sizeof(header)), bytes + sizeof(header), header.count * sizeof(T)) != stored)
+            throw SnapshotException(SnapshotException::E_BAD_CHECKSUM, "loadMapped: " + path + " is corrupted.");
+    }
+
+    FrozenAVL tree;
+    tree.values_ = reinterpret_cast<const T*>(bytes + sizeof(header));
+    tree.size_ = header.count;
+    tree.height_ = header.height;
+    tree.storage_ = std::move(storage);
+    return tree;
+}
+
+template <typename T>
+bool FrozenAVL<T>::find(const T& value, unsigned& compares) const {
+    const size_t position = lowerBound(value, compares);
+    return position && !(value < at(position));
+}
+
+template <typename T>
+typename FrozenAVL<T>::const_iterator FrozenAVL<T>::upper_bound(const T& value) const {
+    // same walk as lowerBound, going right on equal values too
+    const size_t count = size_;
+    size_t position = 1;
+    while (position <= count) {
+        prefetch(position * PREFETCH_STRIDE);
+        position = 2 * position + !(value < at(position));
+    }
+    return const_iterator(this, position >> (trailingOnes(position) + 1));
+}
+
+template <typename T>
+unsigned FrozenAVL<T>::countInRange(const T& lo, const T& hi) const {
+    if (hi < lo)
+        return 0;
+    return rankOf(upper_bound(hi).position_, size_, height_) - rank(lo);
+}
+
+template <typename T>
+template <typename Visitor>
+bool FrozenAVL<T>::forEachInRange(const T& lo, const T& hi, Visitor visitor) const {
+    for (const_iterator it = lower_bound(lo); it.position_ && !(hi < *it); ++it) {
+        if constexpr (std::is_void<decltype(visitor(*it))>::value) {
+            visitor(*it);
+        } else if (!visitor(*it)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+size_t FrozenAVL<T>::lowerBound(const T& value, unsigned& compares) const {
+    // go left on values not less than the value, right otherwise, down past the bottom
+    const size_t count = size_;
+    size_t position = 1;
+    compares = 0;
+    while (position <= count) {
+        prefetch(position * PREFETCH_STRIDE);
+        position = 2 * position + (at(position) < value);
+        ++compares;
+    }
+
+    // - the bits below the leading 1 are the turns taken (1 for right), and the answer is
+    //   the node of the last left turn: drop the right turns after it, then the turn itself
+    return position >> (trailingOnes(position) + 1);
+}
+
+template <typename T>
+std::shared_ptr<const void> FrozenAVL<T>::mapFile(const std::string& path, size_t& size) {
+#if FROZENAVL_HAS_MMAP
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw SnapshotException(SnapshotException::E_IO, "loadMapped: Cannot open " + path + ".");
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        close(fd);
+        throw SnapshotException(SnapshotException::E_IO, "loadMapped: Cannot get the size of " + path + ".");
+    }
+    size = static_cast<size_t>(status.st_size);
+    if (size < sizeof(SnapshotHeader)) {
+        close(fd);
+        throw SnapshotException(SnapshotException::E_BAD_FORMAT, "loadMapped: " + path + " is too short to be a snapshot.");
+    }
+
+    // - the mapping keeps the file, so the descriptor can go right away
+    void* pMapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pMapped == MAP_FAILED)
+        throw SnapshotException(SnapshotException::E_IO, "loadMapped: Cannot map " + path + ".");
+    return std::shared_ptr<const void>(pMapped, [size](const void* p) { munmap(const_cast<void*>(p), size); });
+#else
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        throw SnapshotException(SnapshotException::E_IO, "loadMapped: Cannot open " + path + ".");
+    std::fseek(file, 0, SEEK_END);
+    const long end = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    if (end < static_cast<long>(sizeof(SnapshotHeader))) {
+        std::fclose(file);
+        throw SnapshotException(SnapshotException::E_BAD_FORMAT, "loadMapped: " + path + " is too short to be a snapshot.");
+    }
+    size = static_cast<size_t>(end);
+
+    // - aligned like a cache line, as a mapping would be (at least)
+    std::shared_ptr<void> buffer(::operator new(size, std::align_val_t(sizeof(SnapshotHeader))),
+                                 [](void* p) { ::operator delete(p, std::align_val_t(sizeof(SnapshotHeader))); });
+    const bool read = std::fread(buffer.get(), 1, size, file) == size;
+    std::fclose(file);
+    if (!read)
+        throw SnapshotException(SnapshotException::E_IO, "loadMapped: Cannot read " + path + ".");
+    return buffer;
+#endif
+}
+
+template <typename T>
+uint64_t FrozenAVL<T>::checksum(uint64_t hash, const void* data, size_t bytes) {
+    const uint64_t K1 = 0x9e3779b97f4a7c15ull;
+    const uint64_t K2 = 0xc2b2ae3d27d4eb4full;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (; bytes >= sizeof(uint64_t); p += sizeof(uint64_t), bytes -= sizeof(uint64_t)) {
+        // - copied out, since the bytes need not be aligned
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        hash ^= word * K1;
+        hash = ((hash << 31) | (hash >> 33)) * K2;
+    }
+    uint64_t word = 0;
+    if (bytes)
+        std::memcpy(&word, p, bytes);
+    hash ^= (word ^ bytes) * K1;
+    return ((hash << 31) | (hash >> 33)) * K2;
+}
+
+template <typename T>
+unsigned FrozenAVL<T>::rankOf(size_t position, size_t count, int height) {
+    if (!position)
+        return static_cast<unsigned>(count);
+    const int depth = floorLog2(position);
+    const size_t offset = position - (size_t(1) << depth);
+    const size_t perfectRank = ((2 * offset + 1) << (height - depth)) - 1;
+
+    // the leaves of the last level sit at the even ranks of the perfect tree, and only the
+    // first lastLevel of them are there
+    const size_t lastLevel = count - ((size_t(1) << height) - 1);
+    const size_t leavesBefore = (perfectRank + 1) / 2;
+    return static_cast<unsigned>(perfectRank - (leavesBefore > lastLevel ? leavesBefore - lastLevel : 0));
+}
+
+template <typename T>
+typename FrozenAVL<T>::const_iterator& FrozenAVL<T>::const_iterator::operator++() {
+    const size_t count = tree_->size_;
+    if (!position_) {
+        // past the last value, so wrap around to the first one (this is how begin() gets there)
+        position_ = count ? 1 : 0;
+        while (position_ && 2 * position_ <= count)
+            position_ *= 2;
+    } else if (2 * position_ + 1 <= count) {
+        position_ = 2 * position_ + 1;
+        while (2 * position_ <= count)
+            position_ *= 2;
+    } else {
+        // climb while coming up from a right child, then once more
+        position_ >>= trailingOnes(position_) + 1;
+    }
+    return *this;
+}
+
+template <typename T>
+typename FrozenAVL<T>::const_iterator& FrozenAVL<T>::const_iterator::operator--() {
+    // mirror image of operator++
+    const size_t count = tree_->size_;
+    if (!position_) {
+        position_ = count ? 1 : 0;
+        while (position_ && 2 * position_ + 1 <= count)
+            position_ = 2 * position_ + 1;
+    } else if (2 * position_ <= count) {
+        position_ *= 2;
+        while (2 * position_ + 1 <= count)
+            position_ = 2 * position_ + 1;
+    } else {
+        // climb while coming up from a left child, then once more
+        while (position_ > 1 && !(position_ & 1))
+            position_ >>= 1;
+        position_ >>= 1;
+    }
+    return *this;
+}
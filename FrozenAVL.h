@@ -0,0 +1,433 @@
+/**
+ * @file FrozenAVL.h
+ * @brief This file contains the frozen AVL tree class declaration
+ *        An immutable snapshot of a tree in one array, in Eytzinger (BFS) order,
+ *        for trees that are built once and then only read
+ *        The array can be saved to a file and mapped back in, to be read in place
+ */
+
+#ifndef FROZENAVL_H
+#define FROZENAVL_H
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BST.h"
+
+template <typename T>
+class DurableAVL;
+
+/**
+ * @class SnapshotException
+ * @brief this class defines the exceptions thrown when a FrozenAVL is saved
+ *        to or loaded from a file, or a DurableAVL reads or writes its log.
+ *        The specific exception codes are defined in the ExceptionCode enum
+ */
+class SnapshotException {
+public:
+    // Exception codes
+    enum ExceptionCode {
+        E_IO, // the file cannot be opened, mapped, written or renamed
+        E_BAD_FORMAT, // not a snapshot, another version, or made for another value type
+        E_BAD_CHECKSUM // the checksum does not match (the file is corrupted)
+    };
+
+    /**
+     * Constructor
+     * @param code exception code
+     * @param message exception message
+     */
+    SnapshotException(ExceptionCode code, const std::string& message) : code_(code), message_(message) {}
+
+    /**
+     * Get exception code
+     * @return exception code
+     */
+    ExceptionCode code() const {
+        return code_;
+    }
+
+    /**
+     * Get text message describing exception in raw c_str format
+     * @return text message (NUL-terminated)
+     */
+    const char* what() const {
+        return message_.c_str();
+    }
+
+    private:
+        ExceptionCode code_; // Exception code
+        std::string message_; // Exception message
+};
+
+/**
+ * @brief Frozen AVL tree class
+ *        - the values are stored level by level like a binary heap: the children of
+ *          position k (from 1) are 2k and 2k + 1, so there are no pointers at all and
+ *          the top levels, which every lookup reads, share a few cache lines
+ *        - the shape is the complete tree of the size (every level full but the last,
+ *          filled from the left), whose inorder traversal is the sorted order
+ *        - lookups walk down to the bottom without branching on the compares (the next
+ *          position is 2k plus the result of the compare), prefetching the cache line
+ *          that holds the descendants a few levels down (4 for ints)
+ *        - the position a walk ends at gives the rank of the value in O(1)
+ *        - it cannot change: make a new one from the tree (AVL::freeze) instead
+ *        - save() writes the array after a header, and loadMapped() maps the file and
+ *          reads the values where they are, so loading is O(1) apart from the checksum
+ *        - the array is shared by the copies and kept alive (or mapped) until the last
+ *          one goes
+ * @tparam T Type of data to be stored in the tree
+ */
+template <typename T>
+class FrozenAVL {
+public:
+
+    /**
+     * @brief Bidirectional iterator over the values in sorted order.
+     *        It is just the position, and a step is index arithmetic, O(1) amortized.
+     */
+    class const_iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        /**
+         * @brief Constructor of a singular iterator (only to be assigned to).
+         */
+        const_iterator() : tree_(nullptr), position_(0) {}
+
+        reference operator*() const {
+            return tree_->at(position_);
+        }
+
+        pointer operator->() const {
+            return &tree_->at(position_);
+        }
+
+        /**
+         * @brief Move to the next value: the leftmost one of the right subtree, else
+         *        the first ancestor the position comes up to from the left.
+         * @return this iterator
+         */
+        const_iterator& operator++();
+
+        /**
+         * @brief Move to the previous value (from end(), the last one).
+         * @return this iterator
+         */
+        const_iterator& operator--();
+
+        const_iterator operator++(int) {
+            const_iterator old(*this);
+            ++*this;
+            return old;
+        }
+
+        const_iterator operator--(int) {
+            const_iterator old(*this);
+            --*this;
+            return old;
+        }
+
+        bool operator==(const const_iterator& rhs) const {
+            return position_ == rhs.position_;
+        }
+
+        bool operator!=(const const_iterator& rhs) const {
+            return position_ != rhs.position_;
+        }
+
+    private:
+        friend class FrozenAVL;
+
+        const_iterator(const FrozenAVL* tree, size_t position) : tree_(tree), position_(position) {}
+
+        const FrozenAVL* tree_; // the tree
+        size_t position_; // position of the value (from 1, 0 past the last value)
+    };
+
+    using iterator = const_iterator;
+
+    /**
+     * @brief Constructor of an empty tree.
+     */
+    FrozenAVL() : values_(nullptr), size_(0), height_(-1) {}
+
+    /**
+     * @brief Constructor from sorted values in O(N).
+     *        Position k takes the value of its inorder rank, which follows from k.
+     * @tparam RandomIt random access iterator over values of type T
+     * @param first first value
+     * @param last one past the last value
+     * @throw BSTException E_DUPLICATE if the values are not strictly increasing
+     */
+    template <typename RandomIt>
+    FrozenAVL(RandomIt first, RandomIt last);
+
+    /**
+     * @brief Save the tree to a file in O(N).
+     *        The file is a SnapshotHeader (format version, value size, count, height and
+     *        a checksum of it all) and then the array as it is in memory, so it can only be
+     *        read back on a machine with the same byte order and layout of T. It is written
+     *        next to the path and renamed over it, so a failed save leaves no half-written
+     *        snapshot behind.
+     * @param path file to write
+     * @throw SnapshotException E_IO if the file cannot be written
+     */
+    void save(const std::string& path) const;
+
+    /**
+     * @brief Load a tree saved by save() without copying or deserializing it.
+     *        The file is mapped read-only (where there is mmap, else read into memory)
+     *        and the lookups read the values from the mapping. Checking the header is
+     *        O(1), the checksum is O(N) (a pass over the file at memory speed).
+     * @param path file to read
+     * @param verify whether to check the checksum
+     * @return the tree
+     * @throw SnapshotException E_IO if the file cannot be opened or mapped,
+     *        E_BAD_FORMAT if it is not a snapshot of this version and value type,
+     *        E_BAD_CHECKSUM if verify is on and the checksum does not match
+     */
+    static FrozenAVL loadMapped(const std::string& path, bool verify = true);
+
+    /**
+     * @brief Find a value in O(log n) without branching on the compares.
+     * @param value to be found
+     * @param compares number of values compared with, which is the number of levels
+     *                 walked down (the walk always goes to the bottom)
+     * @return true if the value is in the tree
+     */
+    bool find(const T& value, unsigned& compares) const;
+
+    /**
+     * @brief Get an iterator to the first value not less than a value in O(log n).
+     * @param value to look for (it need not be in the tree)
+     * @return iterator to the value (end() if all the values are less)
+     */
+    const_iterator lower_bound(const T& value) const {
+        unsigned compares;
+        return const_iterator(this, lowerBound(value, compares));
+    }
+
+    /**
+     * @brief Get an iterator to the first value greater than a value in O(log n).
+     * @param value to look for (it need not be in the tree)
+     * @return iterator to the value (end() if no value is greater)
+     */
+    const_iterator upper_bound(const T& value) const;
+
+    /**
+     * @brief Count the values smaller than a value in O(log n).
+     *        The walk for the lower bound ends at a position whose rank is computed.
+     * @param value to rank
+     * @return number of values smaller than it (its position if it is in the tree)
+     */
+    unsigned rank(const T& value) const {
+        unsigned compares;
+        return rankOf(lowerBound(value, compares), size_, height_);
+    }
+
+    /**
+     * @brief Count the values in a range in O(log n).
+     * @param lo smallest value of the range
+     * @param hi largest value of the range
+     * @return number of values from lo to hi, both included (0 if hi < lo)
+     */
+    unsigned countInRange(const T& lo, const T& hi) const;
+
+    /**
+     * @brief Visit the values in a range in sorted order in O(log n + k).
+     * @tparam Visitor callable taking a const T&, returning false to stop the walk
+     *         (or nothing to always go on)
+     * @param lo smallest value of the range
+     * @param hi largest value of the range
+     * @param visitor called for every value from lo to hi, both included
+     * @return true if the whole range was visited, false if the visitor stopped early
+     */
+    template <typename Visitor>
+    bool forEachInRange(const T& lo, const T& hi, Visitor visitor) const;
+
+    /**
+     * @brief Get an iterator to the smallest value in O(log n).
+     * @return iterator to the smallest value (end() if the tree is empty)
+     */
+    const_iterator begin() const {
+        return ++end();
+    }
+
+    /**
+     * @brief Get the iterator past the largest value in O(1).
+     * @return end iterator
+     */
+    const_iterator end() const {
+        return const_iterator(this, 0);
+    }
+
+    /**
+     * @brief Get the height of the tree in O(1).
+     * @return height of the tree (-1 if it is empty)
+     */
+    int height() const {
+        return height_;
+    }
+
+    /**
+     * @brief Get the size of the tree in O(1).
+     * @return number of values in the tree
+     */
+    unsigned size() const {
+        return static_cast<unsigned>(size_);
+    }
+
+    /**
+     * @brief Check whether the tree is empty.
+     * @return true if there are no values in the tree
+     */
+    bool empty() const {
+        return !size_;
+    }
+
+private:
+    friend class DurableAVL<T>; // frames its log with the same checksum
+
+    // the first bytes of a snapshot file, and the version of the format after them
+    static constexpr char SNAPSHOT_MAGIC[8] = {'A', 'V', 'L', 'S', 'N', 'A', 'P', '\0'};
+    static const uint32_t SNAPSHOT_VERSION = 1;
+
+    // written as it is, so it reads back the same only with the same byte order
+    static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+    /**
+     * @brief The start of a snapshot file, followed by the values.
+     *        It is 64 bytes, so that the values start on a cache line (the mapping
+     *        starts on a page).
+     */
+    struct SnapshotHeader {
+        char magic[8]; // SNAPSHOT_MAGIC
+        uint32_t version; // SNAPSHOT_VERSION
+        uint32_t byteOrder; // SNAPSHOT_BYTE_ORDER
+        uint32_t valueSize; // sizeof(T)
+        uint32_t valueAlign; // alignof(T)
+        uint64_t count; // number of values
+        int32_t height; // height of the tree
+        uint32_t reserved; // 0
+        uint64_t checksum; // of the header (with this 0) and then the values
+        unsigned char padding[16]; // 0
+    };
+
+    /**
+     * @brief Map a whole file read-only (or read it, where there is no mmap).
+     * @param path file to map
+     * @param size receives the size of the file
+     * @return the bytes, unmapped (or freed) with the last copy of the pointer
+     * @throw SnapshotException E_IO if the file cannot be opened or mapped,
+     *        E_BAD_FORMAT if it is too short to be a snapshot
+     */
+    static std::shared_ptr<const void> mapFile(const std::string& path, size_t& size);
+
+    /**
+     * @brief Go on with a checksum over some more bytes.
+     *        A word of 8 bytes at a time is multiplied in and rotated, which is a few
+     *        cycles a word; the bytes past the last whole word are padded with zeros.
+     * @param hash checksum so far (0 to start)
+     * @param data the bytes
+     * @param bytes number of bytes
+     * @return the checksum
+     */
+    static uint64_t checksum(uint64_t hash, const void* data, size_t bytes);
+
+    // the descendants of position k a few levels down start at k * PREFETCH_STRIDE and
+    // fill (about) a cache line, which the lookups prefetch
+    // - a power of 2, so that they are the descendants on one level
+    static const size_t PREFETCH_STRIDE = sizeof(T) <= 4 ? 16 : sizeof(T) <= 8 ? 8 : sizeof(T) <= 16 ? 4 : 2;
+
+    /**
+     * @brief Get the value at a position.
+     * @param position position of the value (from 1)
+     * @return the value
+     */
+    const T& at(size_t position) const {
+        return values_[position - 1];
+    }
+
+    /**
+     * @brief Walk down to the position of the first value not less than a value.
+     * @param value to look for
+     * @param compares number of values compared with
+     * @return the position (0 if all the values are less)
+     */
+    size_t lowerBound(const T& value, unsigned& compares) const;
+
+    /**
+     * @brief Get the inorder rank of a position in O(1).
+     *        In the perfect tree of the same height, the position at depth d and offset o
+     *        in its level has rank (2o + 1) * 2^(height - d) - 1. The missing leaves of the
+     *        last level are the ones at the right end, each of which shifts the ranks
+     *        after it down by one.
+     * @param position the position (from 1, or 0 for past the last value)
+     * @param count size of the tree
+     * @param height height of the tree
+     * @return the rank (the size for 0)
+     */
+    static unsigned rankOf(size_t position, size_t count, int height);
+
+    /**
+     * @brief Get the index of the highest bit set.
+     * @param x the number (not 0)
+     * @return floor(log2(x))
+     */
+    static int floorLog2(size_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<int>(sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(x));
+#else
+        int log = 0;
+        while (x >>= 1)
+            ++log;
+        return log;
+#endif
+    }
+
+    /**
+     * @brief Get the number of 1 bits at the bottom of a number.
+     * @param x the number
+     * @return number of trailing 1 bits
+     */
+    static int trailingOnes(size_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+        return ~x ? __builtin_ctzll(~static_cast<unsigned long long>(x)) : static_cast<int>(sizeof(x) * 8);
+#else
+        int ones = 0;
+        for (; x & 1; x >>= 1)
+            ++ones;
+        return ones;
+#endif
+    }
+
+    /**
+     * @brief Ask for a position to be brought into the cache (a hint, it may do nothing).
+     *        The position may be past the end, so the address is never dereferenced.
+     * @param position the position
+     */
+    void prefetch(size_t position) const {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(reinterpret_cast<const void*>(reinterpret_cast<uintptr_t>(values_)
+                                                         + (position - 1) * sizeof(T)));
+#else
+        (void)position;
+#endif
+    }
+
+    const T* values_; // values in Eytzinger order (position k at index k - 1)
+    size_t size_; // number of values
+    int height_; // height of the tree (-1 if it is empty)
+    std::shared_ptr<const void> storage_; // what values_ points into: a vector, or the mapped file
+};
+
+#include "FrozenAVL.cpp"
+
+#endif // FROZENAVL_H
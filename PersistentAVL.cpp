@@ -0,0 +1,346 @@
+/**
+ * @file PersistentAVL.cpp
+ * @brief This file contains the persistent AVL tree class definition
+ *        (included from PersistentAVL.h since the class is a template)
+ */
+
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <thread>
+
+template <typename T>
+PersistentAVL<T>::PersistentAVL(SimpleAllocator* allocator)
+    : allocator_(allocator), isOwnAllocator_(false), root_(nullptr), epoch_(1), spareCount_(0),
+      nextReclaim_(RECLAIM_INTERVAL) {
+    if (!allocator_) {
+        allocator_ = new SimpleAllocator(sizeof(Node), SimpleAllocatorConfig(false, 1024, 0));
+        isOwnAllocator_ = true;
+    } else if (allocator_->getStats().objectSize < sizeof(Node)) {
+        throw SimpleAllocatorException(SimpleAllocatorException::E_BAD_SIZE,
+                                       "PersistentAVL: Allocator objects are smaller than a node.");
+    }
+}
+
+template <typename T>
+PersistentAVL<T>::~PersistentAVL() {
+    // the current version goes with the retired nodes, and the spares were never nodes
+    if (Node* root = root_.load(std::memory_order_relaxed)) {
+        retired_.reserve(retired_.size() + root->count);
+        Node* pending[MAX_HEIGHT];
+        unsigned count = 0;
+        pending[count++] = root;
+        while (count) {
+            for (Node* node = pending[--count]; node; node = node->left) {
+                if (node->right)
+                    pending[count++] = node->right;
+                retired_.push_back(node);
+            }
+        }
+    }
+    freeNodes(retired_.data(), retired_.size());
+    allocator_->freeBatch(spares_, spareCount_);
+    if (isOwnAllocator_)
+        delete allocator_;
+}
+
+template <typename T>
+void PersistentAVL<T>::add(const T& value) {
+    reserveNodes();
+    bool grew;
+    publish(insert(root_.load(std::memory_order_relaxed), value, grew));
+}
+
+template <typename T>
+void PersistentAVL<T>::remove(const T& value) {
+    reserveNodes();
+    bool shrunk;
+    publish(erase(root_.load(std::memory_order_relaxed), value, shrunk));
+}
+
+template <typename T>
+void PersistentAVL<T>::clear() {
+    Node* root = root_.load(std::memory_order_relaxed);
+    if (!root)
+        return;
+
+    // - a stack of right children, each pushed when its parent is left for the left child
+    retired_.reserve(retired_.size() + root->count);
+    retiredEpochs_.reserve(retiredEpochs_.size() + 1);
+    Node* pending[MAX_HEIGHT];
+    unsigned count = 0;
+    pending[count++] = root;
+    while (count) {
+        for (Node* node = pending[--count]; node; node = node->left) {
+            if (node->right)
+                pending[count++] = node->right;
+            retire(node);
+        }
+    }
+    publish(nullptr);
+}
+
+template <typename T>
+typename PersistentAVL<T>::Snapshot PersistentAVL<T>::snapshot() const {
+    // pin the epoch first, then read the root: whatever the root reaches is retired in this
+    // epoch or later, so it stays until the slot is released
+    const size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (unsigned i = 0; i < MAX_SNAPSHOTS; ++i) {
+        std::atomic<uint64_t>& slot = slots_[(start + i) % MAX_SNAPSHOTS].epoch;
+        uint64_t free = 0;
+        if (slot.load(std::memory_order_relaxed) == 0 && slot.compare_exchange_strong(free, epoch_.load()))
+            return Snapshot(&slot, root_.load());
+    }
+    throw BSTException(BSTException::E_NO_MEMORY, "snapshot: All the snapshot slots are taken.");
+}
+
+template <typename T>
+bool PersistentAVL<T>::Snapshot::find(const T& value, unsigned& compares) const {
+    compares = 0;
+    for (const Node* node = root_; node;) {
+        ++compares;
+        if (value < node->data)
+            node = node->left;
+        else if (node->data < value)
+            node = node->right;
+        else
+            return true;
+    }
+    return false;
+}
+
+template <typename T>
+std::stringstream PersistentAVL<T>::Snapshot::printInorder() const {
+    std::stringstream ss;
+    printInorder_(root_, ss);
+    return ss;
+}
+
+template <typename T>
+int PersistentAVL<T>::Snapshot::height() const {
+    int height = -1;
+    for (const Node* node = root_; node; ++height) {
+        // a balanced node has subtrees of the same height, either one will do
+        node = node->balanceFactor < 0 ? node->left : node->right;
+    }
+    return height;
+}
+
+template <typename T>
+void PersistentAVL<T>::reserveNodes() {
+    // - the retire lists grow here too, geometrically, so that nothing throws halfway
+    if (spareCount_ < MAX_OP_NODES) {
+        try {
+            allocator_->allocateBatch(spares_ + spareCount_, MAX_OP_NODES - spareCount_);
+        } catch (const SimpleAllocatorException& e) {
+            throw BSTException(BSTException::E_NO_MEMORY, e.what());
+        }
+        spareCount_ = MAX_OP_NODES;
+    }
+    if (retired_.capacity() < retired_.size() + MAX_OP_NODES)
+        retired_.reserve(std::max(2 * retired_.capacity(), retired_.size() + MAX_OP_NODES));
+    if (retiredEpochs_.capacity() == retiredEpochs_.size())
+        retiredEpochs_.reserve(std::max<size_t>(2 * retiredEpochs_.capacity(), 64));
+}
+
+template <typename T>
+typename PersistentAVL<T>::Node* PersistentAVL<T>::makeNode(const T& value) {
+    Node* node = new (spares_[spareCount_ - 1]) Node(value);
+    --spareCount_;
+    return node;
+}
+
+template <typename T>
+typename PersistentAVL<T>::Node* PersistentAVL<T>::copyOf(const Node* node) {
+    Node* copy = new (spares_[spareCount_ - 1]) Node(*node);
+    --spareCount_;
+    retire(node);
+    return copy;
+}
+
+template <typename T>
+typename PersistentAVL<T>::Node* PersistentAVL<T>::insert(Node* node, const T& value, bool& grew) {
+    if (!node) {
+        grew = true;
+        return makeNode(value);
+    }
+
+    // - a duplicate throws on the way down, before anything is copied
+    if (!(value < node->data) && !(node->data < value))
+        throw BSTException(BSTException::E_DUPLICATE, "add: Value is already in the tree.");
+    const bool right = node->data < value;
+    Node* child = insert(link(node, right), value, grew);
+    Node* copy = copyOf(node);
+    link(copy, right) = child;
+    ++copy->count;
+    if (!grew)
+        return copy;
+
+    copy->balanceFactor += right ? 1 : -1;
+    if (copy->balanceFactor == 0) {
+        grew = false;
+        return copy;
+    }
+    if (copy->balanceFactor == 1 || copy->balanceFactor == -1)
+        return copy;
+
+    // the rotation brings the subtree back to its height before the add
+    bool shrunk;
+    grew = false;
+    return rotate(copy, right, true, shrunk);
+}
+
+template <typename T>
+typename PersistentAVL<T>::Node* PersistentAVL<T>::erase(Node* node, const T& value, bool& shrunk) {
+    if (!node)
+        throw BSTException(BSTException::E_NOT_FOUND, "remove: Value is not in the tree.");
+    if (value < node->data || node->data < value) {
+        const bool right = node->data < value;
+        Node* child = erase(link(node, right), value, shrunk);
+        Node* copy = copyOf(node);
+        link(copy, right) = child;
+        --copy->count;
+        return shrunk ? retrace(copy, right, shrunk) : copy;
+    }
+
+    // the node has one child at most, which takes its place
+    retire(node);
+    if (!node->left || !node->right) {
+        shrunk = true;
+        return node->left ? node->left : node->right;
+    }
+
+    // otherwise a new node with the successor's value does
+    const Node* successor;
+    Node* right = eraseSmallest(node->right, successor, shrunk);
+    Node* replacement = makeNode(successor->data);
+    replacement->left = node->left;
+    replacement->right = right;
+    replacement->balanceFactor = node->balanceFactor;
+    replacement->count = node->count - 1;
+    return shrunk ? retrace(replacement, true, shrunk) : replacement;
+}
+
+template <typename T>
+typename PersistentAVL<T>::Node* PersistentAVL<T>::eraseSmallest(Node* node, const Node*& smallest, bool& shrunk) {
+    if (!node->left) {
+        smallest = node;
+        retire(node);
+        shrunk = true;
+        return node->right;
+    }
+    Node* left = eraseSmallest(node->left, smallest, shrunk);
+    Node* copy = copyOf(node);
+    copy->left = left;
+    --copy->count;
+    return shrunk ? retrace(copy, false, shrunk) : copy;
+}
+
+template <typename T>
+typename PersistentAVL<T>::Node* PersistentAVL<T>::retrace(Node* node, bool right, bool& shrunk) {
+    node->balanceFactor -= right ? 1 : -1;
+    if (node->balanceFactor == 0) {
+        shrunk = true;
+        return node;
+    }
+    if (node->balanceFactor == 1 || node->balanceFactor == -1) {
+        shrunk = false;
+        return node;
+    }
+
+    // the taller side is the other one, which was not copied on the way up
+    return rotate(node, !right, false, shrunk);
+}
+
+template <typename T>
+typename PersistentAVL<T>::Node* PersistentAVL<T>::rotate(Node* top, bool right, bool copied, bool& shrunk) {
+    Node* tall = copied ? link(top, right) : copyOf(link(top, right));
+    const int sign = right ? 1 : -1;
+    const int tallBalance = tall->balanceFactor;
+
+    // the taller child leans the other way: its inner child comes up (double rotation)
+    if (tallBalance == -sign) {
+        Node* inner = copied ? link(tall, !right) : copyOf(link(tall, !right));
+        const int innerBalance = inner->balanceFactor;
+        link(top, right) = link(inner, !right);
+        link(tall, !right) = link(inner, right);
+        link(inner, !right) = top;
+        link(inner, right) = tall;
+        top->balanceFactor = innerBalance == sign ? -sign : 0;
+        tall->balanceFactor = innerBalance == -sign ? sign : 0;
+        inner->balanceFactor = 0;
+        updateCount(top);
+        updateCount(tall);
+        updateCount(inner);
+        shrunk = true;
+        return inner;
+    }
+
+    // otherwise the taller child itself comes up (single rotation)
+    link(top, right) = link(tall, !right);
+    link(tall, !right) = top;
+    if (tallBalance == 0) {
+        top->balanceFactor = sign;
+        tall->balanceFactor = -sign;
+        shrunk = false;
+    } else {
+        top->balanceFactor = 0;
+        tall->balanceFactor = 0;
+        shrunk = true;
+    }
+    updateCount(top);
+    updateCount(tall);
+    return tall;
+}
+
+template <typename T>
+void PersistentAVL<T>::publish(Node* root) {
+    // the nodes retired by this change are tagged with the epoch read after the root changed:
+    // a snapshot that still reaches them pinned that epoch or an earlier one
+    root_.store(root);
+    const uint64_t epoch = epoch_.fetch_add(1);
+    retiredEpochs_.push_back(std::make_pair(epoch, retired_.size()));
+    if (retired_.size() >= nextReclaim_)
+        reclaim();
+}
+
+template <typename T>
+void PersistentAVL<T>::reclaim() {
+    // the oldest epoch a snapshot may be in (the current one if there is no snapshot)
+    uint64_t oldest = epoch_.load();
+    for (const Slot& slot : slots_) {
+        const uint64_t pinned = slot.epoch.load();
+        if (pinned && pinned < oldest)
+            oldest = pinned;
+    }
+
+    // the versions retired before it are out of reach
+    size_t versions = 0;
+    while (versions < retiredEpochs_.size() && retiredEpochs_[versions].first < oldest)
+        ++versions;
+    if (versions) {
+        const size_t end = retiredEpochs_[versions - 1].second;
+        freeNodes(retired_.data(), end);
+        retired_.erase(retired_.begin(), retired_.begin() + end);
+        retiredEpochs_.erase(retiredEpochs_.begin(), retiredEpochs_.begin() + versions);
+        for (std::pair<uint64_t, size_t>& version : retiredEpochs_)
+            version.second -= end;
+    }
+    nextReclaim_ = retired_.size() + RECLAIM_INTERVAL;
+}
+
+template <typename T>
+void PersistentAVL<T>::freeNodes(void** nodes, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        static_cast<Node*>(nodes[i])->~Node();
+    allocator_->freeBatch(nodes, count);
+}
+
+template <typename T>
+void PersistentAVL<T>::printInorder_(const Node* node, std::stringstream& ss) {
+    if (!node)
+        return;
+    printInorder_(node->left, ss);
+    ss << node->data << " ";
+    printInorder_(node->right, ss);
+}
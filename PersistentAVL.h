@@ -0,0 +1,369 @@
+/**
+ * @file PersistentAVL.h
+ * @brief This file contains the persistent AVL tree class declaration
+ *        An AVL tree whose versions are immutable, for one writer and many readers
+ *        that must never block
+ */
+
+#ifndef PERSISTENTAVL_H
+#define PERSISTENTAVL_H
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <vector>
+#include "BST.h"
+#include "SimpleAllocator.h"
+
+/**
+ * @brief Persistent AVL tree class
+ *        - add/remove never change a node that a reader may see: they copy the nodes on
+ *          the path (and the ones a rotation moves), O(log n) of them, and publish the new
+ *          root with one atomic store, so every root is a complete, balanced version
+ *        - a reader takes a snapshot(): it pins the current epoch in a slot of its own and
+ *          reads the root, then walks that version without locks, however the writer goes on
+ *        - the nodes a version no longer shares are retired with the epoch they went in, and
+ *          handed back to the allocator once every pinned slot is past that epoch
+ *          (epoch-based reclamation), so only the writer ever calls the allocator
+ *        - the nodes an add/remove may need are taken up front, so it cannot fail halfway
+ *        - add/remove/clear are for one writer thread at a time; snapshot() and the
+ *          snapshots are for any thread
+ *        - T's copy constructor must not throw, since the copies are made on the way back
+ *          up, after the first ones have been retired
+ * @tparam T Type of data to be stored in the tree
+ */
+template <typename T>
+class PersistentAVL {
+    struct Node;
+
+public:
+
+    // snapshots that can be alive at once (each one holds a slot)
+    static const unsigned MAX_SNAPSHOTS = 128;
+
+    /**
+     * @brief A version of the tree, kept as it is for as long as the snapshot lives.
+     *        It only reads, without locks or atomics past its creation. A snapshot that
+     *        lives long holds back the reclamation of every node retired since.
+     *        It must not outlive the tree.
+     */
+    class Snapshot {
+    public:
+
+        /**
+         * @brief Move constructor (the moved-from snapshot is released).
+         * @param rhs snapshot to take over
+         */
+        Snapshot(Snapshot&& rhs) noexcept : slot_(rhs.slot_), root_(rhs.root_) {
+            rhs.slot_ = nullptr;
+            rhs.root_ = nullptr;
+        }
+
+        /**
+         * @brief Destructor, which releases the slot (and the version with it).
+         */
+        ~Snapshot() {
+            if (slot_)
+                slot_->store(0, std::memory_order_release);
+        }
+
+        /**
+         * @brief Move assignment (this snapshot is released, the moved-from one too).
+         * @param rhs snapshot to take over
+         * @return this snapshot
+         */
+        Snapshot& operator=(Snapshot&& rhs) noexcept {
+            if (this != &rhs) {
+                if (slot_)
+                    slot_->store(0, std::memory_order_release);
+                slot_ = rhs.slot_;
+                root_ = rhs.root_;
+                rhs.slot_ = nullptr;
+                rhs.root_ = nullptr;
+            }
+            return *this;
+        }
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        /**
+         * @brief Find a value in this version.
+         * @param value to be found
+         * @param compares number of nodes visited (one compare each, like BST::find)
+         * @return true if the value is in this version
+         */
+        bool find(const T& value, unsigned& compares) const;
+
+        /**
+         * @brief Print the inorder traversal of this version.
+         * @return stringstream containing the inorder traversal
+         */
+        std::stringstream printInorder() const;
+
+        /**
+         * @brief Get the height of this version in O(log n).
+         * @return height (-1 if it is empty)
+         */
+        int height() const;
+
+        /**
+         * @brief Get the size of this version in O(1) (the count of the root).
+         * @return number of values
+         */
+        unsigned size() const {
+            return root_ ? root_->count : 0;
+        }
+
+        /**
+         * @brief Check whether this version is empty.
+         * @return true if there are no values
+         */
+        bool empty() const {
+            return !root_;
+        }
+
+    private:
+        friend class PersistentAVL;
+
+        Snapshot(std::atomic<uint64_t>* slot, const Node* root) : slot_(slot), root_(root) {}
+
+        std::atomic<uint64_t>* slot_; // pinned epoch slot (null once released)
+        const Node* root_; // root of the version
+    };
+
+    /**
+     * @brief Constructor.
+     * @param allocator Pointer to the allocator of the nodes, with objects of at least
+     *                  sizeof(Node) bytes. If null, the tree makes its own.
+     *                  Only the writer thread uses it.
+     * @throw SimpleAllocatorException E_BAD_SIZE if the allocator's objects cannot hold a node
+     */
+    PersistentAVL(SimpleAllocator* allocator = nullptr);
+
+    /**
+     * @brief Destructor
+     *        Releases every node, current or retired (no snapshot may be alive).
+     */
+    ~PersistentAVL();
+
+    /**
+     * @brief Add a value, publishing a new version.
+     *        The path down is copied on the way back up, with the new balance factors
+     *        and counts, and rotated where needed (the rotations only touch copies).
+     * @param value to be added
+     * @throw BSTException E_DUPLICATE if the value already exists in the tree,
+     *        E_NO_MEMORY if the allocator runs out of nodes (the tree is left unchanged)
+     */
+    void add(const T& value);
+
+    /**
+     * @brief Remove a value, publishing a new version.
+     *        A node with two children is replaced by a copy holding its successor's value.
+     *        A rotation on the way up copies the taller sibling (and its inner child).
+     * @param value to be removed
+     * @throw BSTException E_NOT_FOUND if the value does not exist in the tree,
+     *        E_NO_MEMORY if the allocator runs out of nodes (the tree is left unchanged)
+     */
+    void remove(const T& value);
+
+    /**
+     * @brief Publish the empty version, retiring every node of the old one.
+     */
+    void clear();
+
+    /**
+     * @brief Take a snapshot of the current version (any thread).
+     *        A slot is claimed with a compare-and-swap, starting from one picked by the
+     *        thread id, so readers on different threads do not share a cache line.
+     * @return the snapshot
+     * @throw BSTException E_NO_MEMORY if all the MAX_SNAPSHOTS slots are taken
+     */
+    Snapshot snapshot() const;
+
+    /**
+     * @brief Get the size of the current version (writer thread).
+     * @return number of values
+     */
+    unsigned size() const {
+        const Node* root = root_.load(std::memory_order_relaxed);
+        return root ? root->count : 0;
+    }
+
+    /**
+     * @brief Get the number of retired nodes not handed back to the allocator yet.
+     * @return number of nodes
+     */
+    size_t retiredCount() const {
+        return retired_.size();
+    }
+
+private:
+    // Disable copy constructor and assignment operator
+    PersistentAVL(const PersistentAVL&) = delete;
+    PersistentAVL& operator=(const PersistentAVL&) = delete;
+
+    /**
+     * @brief A node, never changed once a version that has it is published
+     */
+    struct Node {
+        Node* left; // left child
+        Node* right; // right child
+        T data; // the value
+        unsigned count; // number of nodes in the subtree
+        int balanceFactor; // height of the right subtree minus the left one's
+
+        Node(const T& value) : left(nullptr), right(nullptr), data(value), count(1), balanceFactor(0) {}
+    };
+
+    /**
+     * @brief A snapshot slot, on a cache line of its own
+     */
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0}; // pinned epoch (0 if the slot is free)
+    };
+
+    // deepest path add/remove may have to copy
+    // - an AVL tree whose size fits in an unsigned is at most 1.44 * 32 ~ 46 levels high
+    static const unsigned MAX_HEIGHT = 48;
+
+    // most nodes an add/remove may need: a copy of each node on the path, the two a rotation
+    // copies at each level (remove), and the one that takes a successor's value
+    static const unsigned MAX_OP_NODES = 3 * MAX_HEIGHT + 1;
+
+    // retired nodes from one reclamation to the next
+    static const size_t RECLAIM_INTERVAL = 1024;
+
+    /**
+     * @brief Get a child of a node.
+     * @param node the node
+     * @param right false for the left child, true for the right one
+     * @return the child (may be null)
+     */
+    static Node*& link(Node* node, bool right) {
+        return right ? node->right : node->left;
+    }
+
+    /**
+     * @brief Set the count of a node from its children's.
+     * @param node the node
+     */
+    static void updateCount(Node* node) {
+        node->count = 1 + (node->left ? node->left->count : 0) + (node->right ? node->right->count : 0);
+    }
+
+    /**
+     * @brief Make sure an add/remove has MAX_OP_NODES spare nodes, before it starts.
+     * @throw BSTException E_NO_MEMORY if the allocator runs out
+     */
+    void reserveNodes();
+
+    /**
+     * @brief Make a leaf out of a spare node.
+     * @param value the value
+     * @return the leaf
+     */
+    Node* makeNode(const T& value);
+
+    /**
+     * @brief Copy a published node into a spare one, and retire it.
+     * @param node the node
+     * @return the copy
+     */
+    Node* copyOf(const Node* node);
+
+    /**
+     * @brief Retire a node of the published version.
+     * @param node the node
+     */
+    void retire(const Node* node) {
+        retired_.push_back(const_cast<Node*>(node));
+    }
+
+    /**
+     * @brief Add a value below a node, copying the path.
+     * @param node root of the subtree (published)
+     * @param value to be added
+     * @param grew receives whether the subtree got higher
+     * @return root of the new subtree
+     */
+    Node* insert(Node* node, const T& value, bool& grew);
+
+    /**
+     * @brief Remove a value below a node, copying the path.
+     * @param node root of the subtree (published)
+     * @param value to be removed
+     * @param shrunk receives whether the subtree got lower
+     * @return root of the new subtree
+     */
+    Node* erase(Node* node, const T& value, bool& shrunk);
+
+    /**
+     * @brief Remove the smallest node below a node, copying the path.
+     * @param node root of the subtree (published)
+     * @param smallest receives the removed node (retired, but still readable)
+     * @param shrunk receives whether the subtree got lower
+     * @return root of the new subtree
+     */
+    Node* eraseSmallest(Node* node, const Node*& smallest, bool& shrunk);
+
+    /**
+     * @brief Update a copied node whose subtree on one side got lower, and rotate
+     *        it if it is out of balance.
+     * @param node the copy
+     * @param right the side that got lower
+     * @param shrunk receives whether the node's subtree got lower
+     * @return root of the new subtree
+     */
+    Node* retrace(Node* node, bool right, bool& shrunk);
+
+    /**
+     * @brief Rotate the taller child (or its inner child) of a copied node up.
+     * @param top the copy, out of balance
+     * @param right the taller side
+     * @param copied whether the nodes that move are copies already (they are for add,
+     *               which came up through them, not for remove)
+     * @param shrunk receives whether the subtree got lower than before the rotation
+     * @return root of the rotated subtree
+     */
+    Node* rotate(Node* top, bool right, bool copied, bool& shrunk);
+
+    /**
+     * @brief Publish a new root, then hand back the retired nodes no snapshot can reach.
+     * @param root the root
+     */
+    void publish(Node* root);
+
+    /**
+     * @brief Hand back the nodes retired before the oldest pinned epoch.
+     */
+    void reclaim();
+
+    /**
+     * @brief Destroy nodes and hand them back to the allocator.
+     * @param nodes the nodes
+     * @param count number of nodes
+     */
+    void freeNodes(void** nodes, size_t count);
+
+    /**
+     * @brief Print the inorder traversal of a subtree.
+     * @param node root of the subtree
+     * @param ss stream to print to
+     */
+    static void printInorder_(const Node* node, std::stringstream& ss);
+
+    SimpleAllocator* allocator_; // allocator of the nodes
+    bool isOwnAllocator_; // whether the tree made the allocator
+    std::atomic<Node*> root_; // root of the current version
+    mutable std::atomic<uint64_t> epoch_; // current epoch (from 1, 0 marks a free slot)
+    mutable Slot slots_[MAX_SNAPSHOTS]; // epochs pinned by the snapshots
+    void* spares_[MAX_OP_NODES]; // blocks taken for the nodes of the next add/remove
+    unsigned spareCount_; // number of spare nodes
+    std::vector<void*> retired_; // retired nodes, in the order of their epochs
+    std::vector<std::pair<uint64_t, size_t>> retiredEpochs_; // epoch of each version and where its nodes end
+    size_t nextReclaim_; // size of retired_ at which to reclaim next
+};
+
+#include "PersistentAVL.cpp"
+
+#endif // PERSISTENTAVL_H
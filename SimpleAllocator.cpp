@@ -6,54 +6,1817 @@
 
 // #define DEBUG
 #include "SimpleAllocator.h"
+#include <algorithm>
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <new>
+#include <unordered_map>
+
+// pages can only be mapped straight from the OS where there is mmap
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define SIMPLEALLOCATOR_HAS_MMAP 1
+#else
+#define SIMPLEALLOCATOR_HAS_MMAP 0
+#endif
+
+// pad bytes are checked with vector compares where the compiler targets them
+// (SSE2 is always there on x86-64, AVX2 needs -mavx2 or -march=native)
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/**
+ * Read the link of a free block
+ * - blocks are only aligned when the config asks for it,
+ *   so the link is copied out bytewise instead of dereferenced
+ * @param pNode free block
+ * @return next free block
+ */
+Node* nextOf(const Node* pNode) {
+    Node* pNext;
+    std::memcpy(&pNext, pNode, sizeof(Node*));
+    return pNext;
+}
+
+/**
+ * Write the link of a free block (see nextOf)
+ * @param pNode free block
+ * @param pNext next free block
+ */
+void setNext(Node* pNode, Node* pNext) {
+    std::memcpy(pNode, &pNext, sizeof(Node*));
+}
+
+/**
+ * Hash a page-aligned address for the page directory
+ * - pages are consecutive-ish in memory so the key is scrambled
+ *   with a multiplicative hash to spread them over the table
+ * @param key page-aligned address
+ * @return hash value
+ */
+size_t hashPageKey(uintptr_t key) {
+    return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/**
+ * Check that every byte of a range holds a pattern
+ * - 32 bytes at a time with AVX2, 16 with SSE2, then a word at a time, then the odd bytes
+ * @param pBytes start of the range
+ * @param size number of bytes
+ * @param pattern expected byte
+ * @return true if they all match
+ */
+bool allBytesAre(const unsigned char* pBytes, size_t size, unsigned char pattern) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i wanted32 = _mm256_set1_epi8(static_cast<char>(pattern));
+    for (; i + 32 <= size; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pBytes + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, wanted32)) != -1)
+            return false;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i wanted16 = _mm_set1_epi8(static_cast<char>(pattern));
+    for (; i + 16 <= size; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBytes + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, wanted16)) != 0xFFFF)
+            return false;
+    }
+#endif
+    const uint64_t wantedWord = 0x0101010101010101ull * pattern;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, pBytes + i, sizeof(uint64_t));
+        if (word != wantedWord)
+            return false;
+    }
+    for (; i < size; ++i) {
+        if (pBytes[i] != pattern)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Add to a counter that only one thread ever writes
+ * - a plain load and store instead of a locked read-modify-write,
+ *   other threads may still read it at any time
+ * @param counter counter to update
+ * @param delta amount to add
+ */
+void bump(std::atomic<unsigned>& counter, unsigned delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+// the lock-free free list head packs an ABA tag above the pointer bits
+// - user space pointers fit in the low 48 bits on 64-bit platforms
+// - the tag goes up on every successful swap of the head, so a thread that read
+//   an old head (and its old next link) can never swap it back in by accident
+const unsigned TAG_SHIFT = sizeof(void*) == 8 ? 48 : 32;
+const uint64_t POINTER_MASK = (uint64_t(1) << TAG_SHIFT) - 1;
+
+/**
+ * Unpack the pointer from a tagged free list head
+ * @param head tagged head
+ * @return block pointer
+ */
+Node* untag(uint64_t head) {
+    return reinterpret_cast<Node*>(static_cast<uintptr_t>(head & POINTER_MASK));
+}
+
+/**
+ * Pack a pointer into a tagged free list head, bumping the tag of the old head
+ * @param pNode block pointer
+ * @param oldHead head being replaced
+ * @return tagged head
+ */
+uint64_t retag(Node* pNode, uint64_t oldHead) {
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(pNode))
+           | (((oldHead >> TAG_SHIFT) + 1) << TAG_SHIFT);
+}
+
+/**
+ * View the link of a free block as an atomic (LOCK_FREE only)
+ * - a thread may read the link of a block that another thread just popped,
+ *   its compare-and-swap then fails on the tag and the value read is thrown away
+ * - blocks are aligned to a pointer in LOCK_FREE mode so the view is always aligned
+ * @param pNode free block
+ * @return the link
+ */
+std::atomic<Node*>& atomicLinkOf(Node* pNode) {
+    return *reinterpret_cast<std::atomic<Node*>*>(pNode);
+}
+
+// a removed page leaves this in its directory slot so that probes carry on past it
+unsigned char* const DIRECTORY_TOMBSTONE = reinterpret_cast<unsigned char*>(uintptr_t(1));
+
+// a directory entry keeps log2 of its page's boundary in the low bits of the page start
+// - every page starts on at least 64 bytes (the page info alone takes 40)
+const uintptr_t ENTRY_SHIFT_MASK = 63;
+
+// mapped pages at least this big get the transparent huge page hint
+const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+// ids handed out to THREAD_CACHED allocators, starting at 1 (0 means no allocator)
+std::atomic<uint64_t> nextAllocatorId(1);
+
+/**
+ * Lock guarding the map of live THREAD_CACHED allocators
+ * @return the lock
+ */
+std::mutex& liveAllocatorsLock() {
+    static std::mutex lock;
+    return lock;
+}
+
+/**
+ * Map of live THREAD_CACHED allocators by id
+ * - an exiting thread only hands its magazines back to allocators still in here
+ * @return the map
+ */
+std::unordered_map<uint64_t, SimpleAllocator*>& liveAllocators() {
+    static std::unordered_map<uint64_t, SimpleAllocator*> allocators;
+    return allocators;
+}
+
+} // namespace
+
+/**
+ * Open addressed hash table of page starts
+ * - a bigger table replaces a full one, the old one is kept around until
+ *   the allocator dies in case another thread is still probing it
+ */
+struct SimpleAllocator::PageDirectory {
+    size_t mask; // number of slots - 1 (the number of slots is a power of 2)
+    std::atomic<unsigned char*>* pSlots; // the slots, nullptr if empty
+    PageDirectory* pRetired; // the smaller table this one replaced (if any)
+};
+
+/**
+ * Info at the start of every page
+ */
+struct SimpleAllocator::PageInfo {
+    Node link; // next page in the page list (the page list sees pages as Nodes)
+    std::atomic<unsigned> objectsInUse; // number of blocks on the page that are in use
+    unsigned freeSeen; // scratch count of the page's blocks found on the free list (trim only)
+    unsigned objects; // number of blocks on the page
+    unsigned shift; // log2 of the power-of-2 boundary the page starts on
+    size_t firstBlockOffset; // offset of the first object from the start of the page
+    size_t size; // size of the page
+};
+
+/**
+ * Magazine of free blocks owned by one thread
+ * - on its own cache line so that threads never share one through their magazines
+ * - the counters are only written by the owning thread but read by getStats
+ * - the allocation numbers for the headers are reserved a magazine's worth at a time
+ */
+struct alignas(64) SimpleAllocator::ThreadCache {
+    Node* pBlocks = nullptr; // free blocks in the magazine
+    std::atomic<unsigned> count{0}; // number of free blocks in the magazine
+    std::atomic<unsigned> allocations{0}; // allocations made from the magazine
+    std::atomic<unsigned> deallocations{0}; // deallocations made into the magazine
+    unsigned lastAllocNum = 0; // allocation number given out last
+    unsigned endAllocNum = 0; // last allocation number reserved
+};
+
+/**
+ * The calling thread's magazines, one per THREAD_CACHED allocator it has used
+ */
+struct ThreadCacheList {
+    uint64_t lastId = 0; // id of the allocator used last
+    SimpleAllocator::ThreadCache* pLast = nullptr; // magazine for the allocator used last
+    std::vector<std::pair<uint64_t, SimpleAllocator::ThreadCache*>> caches; // all magazines by allocator id
+
+    /**
+     * Hand the magazines back to the allocators that are still alive when the thread exits
+     */
+    ~ThreadCacheList() {
+        std::lock_guard<std::mutex> guard(liveAllocatorsLock());
+        for (auto& entry : caches) {
+            auto it = liveAllocators().find(entry.first);
+            if (it != liveAllocators().end())
+                it->second->releaseThreadCache(entry.second);
+        }
+    }
+};
+
+static thread_local ThreadCacheList threadCacheList;
 
 SimpleAllocator::SimpleAllocator(size_t objectSize,
                                  const SimpleAllocatorConfig& config)
-    : config_(config), stats_{}{
+    : config_(config), stats_{}, pageList_(nullptr), freeList_(nullptr),
+      pageDirectory_(nullptr), directoryTombstones_(0), emptyPages_(0), trimFloor_(0), osPageSize_(1),
+      labelChunkUsed_(0), labelCache_{}, arenaSpare_(nullptr), arenaUsed_(0), id_(0), allocNum_(0),
+      freeHead_(0),
+      sharedAllocations_(0), sharedDeallocations_(0), sharedPagesInUse_(0), sharedMostObjects_(0),
+      sharedCapacity_(0), sharedPageBytes_(0) {
     stats_.objectSize = objectSize;
-    config_.useCPPMemManager = true; // always true for this dummy allocator
+
+    // lock-free mode reads the free list links atomically, so they must be aligned
+    // - and the page limit must be known up front to size the page directory
+    if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+        config_.alignmentBoundary = std::max<unsigned>(config_.alignmentBoundary, alignof(Node*));
+        if (config_.maxPages == 0)
+            config_.maxPages = LOCK_FREE_PAGE_LIMIT;
+    }
+
+    // a free block stores the free list link over its object bytes
+    // - so every block must at least be big enough to hold a Node
+    slotSize_ = std::max(objectSize, sizeof(Node));
+
+    // compute the alignment bytes so that every object lands on the boundary
+    // - inter alignment keeps the distance between two objects a multiple of it
+    // - left alignment pushes the first object onto the boundary (see pageLayout)
+    // - without a boundary, the objects still land on the natural alignment of the slot
+    //   (the largest power of 2 dividing it, up to max_align_t, and at least a free list link's)
+    const size_t headerSize = config_.headerBlockInfo.size;
+    const size_t padSize = config_.padBytesSize;
+    const size_t blockSize = headerSize + 2 * padSize + slotSize_;
+    blockBoundary_ = config_.alignmentBoundary;
+    if (blockBoundary_ <= 1) {
+        const size_t natural = std::min(slotSize_ & (~slotSize_ + 1), alignof(std::max_align_t));
+        blockBoundary_ = std::max(natural, alignof(Node*));
+    }
+    config_.interAlignBytesSize = static_cast<unsigned>((blockBoundary_ - blockSize % blockBoundary_) % blockBoundary_);
+    blockStride_ = blockSize + config_.interAlignBytesSize;
+
+    // the first page sets the page size in the stats and the smallest page boundary
+    // - the left alignment depends on the size of the bitmap, so the config reports the first page's
+    if (config_.pageGrowth == SimpleAllocatorConfig::GEOMETRIC_PAGES)
+        config_.maxObjectsPerPage = std::max(config_.maxObjectsPerPage, config_.objectsPerPage);
+    const PageLayout first = pageLayout(nextPageObjects(0));
+    config_.leftAlignBytesSize = static_cast<unsigned>(first.firstBlockOffset - headerSize - padSize
+                                                       - sizeof(PageInfo) - (first.objects + 7) / 8);
+    stats_.pageSize = first.size;
+    pageShift_ = first.shift;
+    pageAlignment_ = size_t(1) << pageShift_;
+    maxPageShift_.store(pageShift_, std::memory_order_relaxed);
+
+    // mapped pages take whole OS pages
+    osPageSize_ = 1;
+#if SIMPLEALLOCATOR_HAS_MMAP
+    if (config_.mapPages)
+        osPageSize_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+
+    // register with the live allocators so that exiting threads can hand their magazines back
+    // - a magazine moves half of itself at a time, so it needs room for at least 2 blocks
+    if (config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED) {
+        config_.magazineSize = std::max(config_.magazineSize, 2u);
+        id_ = nextAllocatorId.fetch_add(1);
+        std::lock_guard<std::mutex> guard(liveAllocatorsLock());
+        liveAllocators()[id_] = this;
+    }
+
+    // a lock-free allocator gets a page directory big enough for every page it may ever have
+    // - so that pages can be added without ever replacing the table
+    if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+        size_t slots = 16;
+        while (slots < size_t(config_.maxPages) * 2)
+            slots *= 2;
+        pageDirectory_.store(new PageDirectory{slots - 1, new std::atomic<unsigned char*>[slots](), nullptr});
+    }
 }
 
 SimpleAllocator::~SimpleAllocator() {
+    // threads that exit from now on keep their magazines to themselves
+    if (config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED) {
+        {
+            std::lock_guard<std::mutex> guard(liveAllocatorsLock());
+            liveAllocators().erase(id_);
+        }
+        for (ThreadCache* pCache : threadCaches_)
+            delete pCache;
+    }
+
+    // (an arena also owns the pages that reset() handed back)
+    for (Node* pPageNode : {pageList_.load(), arenaSpare_}) {
+        while (pPageNode) {
+            unsigned char* pPage = reinterpret_cast<unsigned char*>(pPageNode);
+            pPageNode = pPageNode->pNext;
+            releasePageMemory(pPage, false);
+        }
+    }
+
+    // the block infos of the blocks still in use go with their slab
+    for (MemBlockInfo* pChunk : infoChunks_)
+        delete[] pChunk;
+    for (char* pChunk : labelChunks_)
+        delete[] pChunk;
+#if SIMPLEALLOCATOR_HAS_MMAP
+    for (const auto& released : releasedPages_)
+        munmap(released.first, released.second);
+#endif
+
+    PageDirectory* pDirectory = pageDirectory_.load();
+    while (pDirectory) {
+        PageDirectory* pRetired = pDirectory->pRetired;
+        delete[] pDirectory->pSlots;
+        delete pDirectory;
+        pDirectory = pRetired;
+    }
 }
 
 void* SimpleAllocator::allocate(const char* pLabel) {
     // use cpp mem manager if enabled
     if (config_.useCPPMemManager) {
-        // update stats assuming allocation succeeds
+        // return exact number of bytes requested using char
+        char* pObject = nullptr;
+        try {
+            pObject = new char[stats_.objectSize];
+        } catch (const std::bad_alloc&) {
+            throw SimpleAllocatorException(SimpleAllocatorException::E_NO_MEMORY,
+                                           "allocate: No system memory available.");
+        }
+
+        // update stats only once the allocation succeeded
+        if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+            raiseMostObjectsLockFree(sharedAllocations_.fetch_add(1, std::memory_order_relaxed) + 1);
+            return pObject;
+        }
+        std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+        if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+            guard.lock();
         ++stats_.allocations;
-        ++stats_.mostObjects;
+        ++stats_.objectsInUse;
+        stats_.mostObjects = std::max(stats_.mostObjects, stats_.objectsInUse);
 
-        // return exact number of bytes requested using char
-        return new char[stats_.objectSize];
-    }
-    else {
-        // this is supposed to be the custom allocation code but this is a dummy
-        // - this should never be called in this dummy allocator
-        return nullptr;
+        return pObject;
     }
+
+    if (config_.isArena)
+        return allocateArena(pLabel);
+    if (config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED)
+        return allocateCached(pLabel);
+    if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE)
+        return allocateLockFree(pLabel);
+
+    // grab a new page when the free list runs dry
+    // - this throws if no more pages can be allocated
+    if (!freeList_)
+        allocatePage();
+
+    // record the block in its header before it leaves the free list
+    // - so that a failed external header allocation leaves everything intact
+    unsigned char* pBlock = reinterpret_cast<unsigned char*>(freeList_);
+    writeHeader(pBlock, stats_.allocations + 1, pLabel);
+
+    // pop the block off the free list, mark it in use on its page and sign it as allocated
+    freeList_ = nextOf(freeList_);
+    setInUse(pageOf(pBlock), pBlock, true);
+    if (config_.isDebug)
+        std::memset(pBlock, ALLOCATED_PATTERN, slotSize_);
+
+    // update stats
+    ++stats_.allocations;
+    ++stats_.objectsInUse;
+    --stats_.freeObjects;
+    stats_.mostObjects = std::max(stats_.mostObjects, stats_.objectsInUse);
+
+    return pBlock;
 }
 
 void SimpleAllocator::free(void* pObject) {
+    // freeing a null pointer is a no-op, just like delete
+    if (!pObject)
+        return;
+
     if (config_.useCPPMemManager) {
-        // update stats assuming allocation successful
+        // delete exact number of bytes represented using char
+        delete[] static_cast<char*>(pObject);
+
+        // update stats
+        if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+            sharedDeallocations_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+        if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+            guard.lock();
         ++stats_.deallocations;
-        --stats_.allocations;
+        --stats_.objectsInUse;
+        return;
+    }
+
+    // an arena only takes memory back all at once in reset()
+    if (config_.isArena)
+        return;
+
+    // the pointer must be the start of a block on one of our pages
+    // and that block must currently be in use
+    // - blocks in a magazine stay in use on their pages, so a magazine only has the header to go by
+    unsigned char* pBlock = static_cast<unsigned char*>(pObject);
+    unsigned char* pPage = validateBlock(pBlock);
+    const bool wasInUse = config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED ? isAllocated(pPage, pBlock)
+                                                                                      : setInUse(pPage, pBlock, false);
+    if (!wasInUse)
+        throw SimpleAllocatorException(SimpleAllocatorException::E_MULTIPLE_FREE,
+                                       "free: Block has already been freed.");
+
+    // clear the header and sign the block as freed
+    writeHeader(pBlock, 0);
+    if (config_.isDebug)
+        std::memset(pBlock, FREED_PATTERN, slotSize_);
+
+    if (config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED) {
+        freeCached(pBlock);
+        return;
+    }
+    if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+        Node* pNode = reinterpret_cast<Node*>(pBlock);
+        pushLockFree(pNode, pNode);
+        sharedDeallocations_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // push the block onto the free list
+    Node* pNode = reinterpret_cast<Node*>(pBlock);
+    setNext(pNode, freeList_);
+    freeList_ = pNode;
+
+    // update stats
+    ++stats_.deallocations;
+    --stats_.objectsInUse;
+    ++stats_.freeObjects;
+
+    autoTrim();
+}
+
+void SimpleAllocator::allocateBatch(void** pOut, size_t count, const char* pLabel) {
+    if (count == 0)
+        return;
 
+    // use cpp mem manager if enabled
+    if (config_.useCPPMemManager) {
+        // give back what was allocated so far if we run out of memory
+        size_t allocated = 0;
+        try {
+            for (; allocated < count; ++allocated)
+                pOut[allocated] = new char[stats_.objectSize];
+        } catch (const std::bad_alloc&) {
+            while (allocated)
+                delete[] static_cast<char*>(pOut[--allocated]);
+            throw SimpleAllocatorException(SimpleAllocatorException::E_NO_MEMORY,
+                                           "allocateBatch: No system memory available.");
+        }
+
+        // update stats once for the whole batch
+        const unsigned batch = static_cast<unsigned>(count);
+        if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+            raiseMostObjectsLockFree(sharedAllocations_.fetch_add(batch, std::memory_order_relaxed) + batch);
+            return;
+        }
+        std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+        if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+            guard.lock();
+        stats_.allocations += batch;
+        stats_.objectsInUse += batch;
+        stats_.mostObjects = std::max(stats_.mostObjects, stats_.objectsInUse);
+        return;
+    }
+
+    // an arena just bumps through its pages
+    // - check up front that the page limit leaves room for the whole batch,
+    //   since an arena cannot take back what it already handed out
+    if (config_.isArena) {
+        {
+            std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+            if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+                guard.lock();
+            size_t room = stats_.freeObjects;
+            for (unsigned page = stats_.pagesInUse; config_.maxPages && room < count && page < config_.maxPages; ++page)
+                room += nextPageObjects(page);
+            if (config_.maxPages && count > room)
+                throw SimpleAllocatorException(SimpleAllocatorException::E_NO_PAGE,
+                                               "allocateBatch: The maximum number of pages has been allocated.");
+        }
+        for (size_t i = 0; i < count; ++i)
+            pOut[i] = allocateArena(pLabel);
+        return;
+    }
+
+    // take the whole chain at once (this throws if the pool cannot grow enough)
+    unsigned firstAllocNum = 0;
+    Node* pFirst = takeBlocks(count, firstAllocNum);
+
+    // record every block in its header before touching the blocks themselves
+    // - so that a failed external header allocation can put the chain back as it was
+    Node* pNode = pFirst;
+    Node* pLast = pFirst;
+    size_t stamped = 0;
+    try {
+        for (; stamped < count; ++stamped) {
+            pLast = pNode;
+            pOut[stamped] = pNode;
+            pNode = nextOf(pNode);
+            writeHeader(static_cast<unsigned char*>(pOut[stamped]), firstAllocNum + static_cast<unsigned>(stamped) + 1,
+                        pLabel);
+        }
+    } catch (const SimpleAllocatorException&) {
+        for (size_t i = 0; i < stamped; ++i)
+            writeHeader(static_cast<unsigned char*>(pOut[i]), 0);
+        while (pNode) {
+            pLast = pNode;
+            pNode = nextOf(pNode);
+        }
+        giveBackBlocks(pFirst, pLast, static_cast<unsigned>(count), true);
+        throw;
+    }
+
+    // mark them in use on their pages and sign them as allocated
+    for (size_t i = 0; i < count; ++i) {
+        unsigned char* pBlock = static_cast<unsigned char*>(pOut[i]);
+        setInUse(pageOf(pBlock), pBlock, true);
+        if (config_.isDebug)
+            std::memset(pBlock, ALLOCATED_PATTERN, slotSize_);
+    }
+}
+
+void SimpleAllocator::freeBatch(void** pObjects, size_t count) {
+    if (config_.useCPPMemManager) {
         // delete exact number of bytes represented using char
-        //::operator delete(static_cast<char*>(p_object), stats_.ObjectSize_);
-        delete[] static_cast<char*>(pObject);
+        unsigned freed = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (pObjects[i]) {
+                delete[] static_cast<char*>(pObjects[i]);
+                ++freed;
+            }
+        }
 
-        pObject = nullptr;
-    } 
-    else {
-        // again this should never be called in this dummy allocator
+        // update stats once for the whole batch
+        if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+            sharedDeallocations_.fetch_add(freed, std::memory_order_relaxed);
+            return;
+        }
+        std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+        if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+            guard.lock();
+        stats_.deallocations += freed;
+        stats_.objectsInUse -= freed;
+        return;
     }
+
+    // an arena only takes memory back all at once in reset()
+    if (config_.isArena)
+        return;
+
+    // validate and release every block, chaining them up as we go
+    // - if one of them is bad, the ones before it still go back before the exception leaves
+    Node* pFirst = nullptr;
+    Node* pLast = nullptr;
+    unsigned freed = 0;
+    try {
+        for (size_t i = 0; i < count; ++i) {
+            if (!pObjects[i])
+                continue;
+
+            // the batch goes to the shared free list, so the block leaves its page's count
+            // - but a block in a magazine is still in use there, only its header knows it was freed
+            unsigned char* pBlock = static_cast<unsigned char*>(pObjects[i]);
+            unsigned char* pPage = validateBlock(pBlock);
+            if ((config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED && !isAllocated(pPage, pBlock))
+                || !setInUse(pPage, pBlock, false))
+                throw SimpleAllocatorException(SimpleAllocatorException::E_MULTIPLE_FREE,
+                                               "freeBatch: Block has already been freed.");
+            writeHeader(pBlock, 0);
+            if (config_.isDebug)
+                std::memset(pBlock, FREED_PATTERN, slotSize_);
+
+            Node* pNode = reinterpret_cast<Node*>(pBlock);
+            setNext(pNode, pFirst);
+            pFirst = pNode;
+            if (!pLast)
+                pLast = pNode;
+            ++freed;
+        }
+    } catch (const SimpleAllocatorException&) {
+        if (freed)
+            giveBackBlocks(pFirst, pLast, freed, false);
+        throw;
+    }
+
+    if (freed)
+        giveBackBlocks(pFirst, pLast, freed, false);
+}
+
+void SimpleAllocator::reset() {
+    if (!isArena())
+        return;
+
+    std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+    if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+        guard.lock();
+
+    // every page in the page list has been bumped through, the current one (the head) only up to arenaUsed_
+    Node* pPageNode = pageList_.load(std::memory_order_relaxed);
+    unsigned used = arenaUsed_;
+    while (pPageNode) {
+        unsigned char* pPage = reinterpret_cast<unsigned char*>(pPageNode);
+        Node* pNext = pPageNode->pNext;
+        const PageInfo& info = pageInfo(pPage);
+
+        // clear the in-use bits
+        for (unsigned i = 0; i < (info.objects + 7) / 8; ++i)
+            reinterpret_cast<std::atomic<unsigned char>*>(pPage + sizeof(PageInfo))[i].store(0, std::memory_order_relaxed);
+        pageInfo(pPage).objectsInUse.store(0, std::memory_order_relaxed);
+
+        // only headers and debug signatures need a pass over the blocks
+        if (config_.headerBlockInfo.type != SimpleAllocatorConfig::NO_HEADER || config_.isDebug) {
+            for (unsigned i = 0; i < used; ++i) {
+                unsigned char* pBlock = pPage + info.firstBlockOffset + i * blockStride_;
+                writeHeader(pBlock, 0);
+                if (config_.isDebug)
+                    std::memset(pBlock, FREED_PATTERN, slotSize_);
+            }
+        }
+
+        // park the page for the next allocations
+        pPageNode->pNext = arenaSpare_;
+        arenaSpare_ = pPageNode;
+        pPageNode = pNext;
+        if (pPageNode)
+            used = pageInfo(reinterpret_cast<unsigned char*>(pPageNode)).objects;
+    }
+    pageList_.store(nullptr, std::memory_order_relaxed);
+    arenaUsed_ = 0;
+    emptyPages_.store(stats_.pagesInUse, std::memory_order_relaxed);
+
+    // update stats
+    stats_.deallocations += stats_.objectsInUse;
+    stats_.freeObjects += stats_.objectsInUse;
+    stats_.objectsInUse = 0;
+}
+
+unsigned SimpleAllocator::trim() {
+    if (config_.useCPPMemManager || config_.concurrency == SimpleAllocatorConfig::LOCK_FREE)
+        return 0;
+
+    std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+    if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+        guard.lock();
+
+    // an arena's recycled pages are all empty and off the page list already
+    if (config_.isArena) {
+        unsigned reclaimed = 0;
+        while (arenaSpare_) {
+            unsigned char* pPage = reinterpret_cast<unsigned char*>(arenaSpare_);
+            arenaSpare_ = arenaSpare_->pNext;
+            reclaimPage(pPage);
+            ++reclaimed;
+        }
+        return reclaimed;
+    }
+
+    return trimPages();
+}
+
+std::vector<void*> SimpleAllocator::validatePages() const {
+    std::vector<void*> corrupted;
+    if (config_.useCPPMemManager || !config_.isDebug || config_.padBytesSize == 0)
+        return corrupted;
+
+    // pages only leave the page list under the lock (a lock-free page list only ever grows)
+    std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+    if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED
+        && (config_.concurrency != SimpleAllocatorConfig::LOCK_FREE || config_.isArena))
+        guard.lock();
+
+    // walk every block of every page in address order (an arena's recycled pages included)
+    for (Node* pPageNode : {pageList_.load(std::memory_order_acquire), arenaSpare_}) {
+        for (; pPageNode; pPageNode = pPageNode->pNext) {
+            unsigned char* pPage = reinterpret_cast<unsigned char*>(pPageNode);
+            const PageInfo& info = pageInfo(pPage);
+            unsigned char* pBlock = pPage + info.firstBlockOffset;
+            for (unsigned i = 0; i < info.objects; ++i, pBlock += blockStride_) {
+                if (!padBytesIntact(pBlock))
+                    corrupted.push_back(pBlock);
+            }
+        }
+    }
+    return corrupted;
 }
 
 SimpleAllocatorConfig SimpleAllocator::getConfig() const { return config_; }
 
-SimpleAllocatorStats SimpleAllocator::getStats() const { return stats_; }
+SimpleAllocatorStats SimpleAllocator::getStats() const {
+    if (config_.concurrency == SimpleAllocatorConfig::SINGLE_THREADED)
+        return stats_;
+
+    // arenas keep their stats under the mutex in every mode
+    if (config_.isArena) {
+        std::lock_guard<std::mutex> guard(lock_);
+        return stats_;
+    }
+
+    // rebuild the stats from the relaxed counters
+    // - the counters are read separately, so clamp anything that is momentarily out of step
+    if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+        SimpleAllocatorStats stats = stats_;
+        stats.deallocations = sharedDeallocations_.load(std::memory_order_relaxed);
+        stats.allocations = std::max(stats.deallocations, sharedAllocations_.load(std::memory_order_relaxed));
+        stats.pagesInUse = sharedPagesInUse_.load(std::memory_order_relaxed);
+        stats.objectsInUse = stats.allocations - stats.deallocations;
+        if (!config_.useCPPMemManager) {
+            const unsigned capacity = sharedCapacity_.load(std::memory_order_relaxed);
+            stats.freeObjects = capacity > stats.objectsInUse ? capacity - stats.objectsInUse : 0;
+            stats.pageBytes = sharedPageBytes_.load(std::memory_order_relaxed);
+            if (stats.pagesInUse)
+                stats.largestPageSize = std::max(stats.largestPageSize,
+                                                 pageLayout(nextPageObjects(stats.pagesInUse - 1)).size);
+        }
+        stats.mostObjects = std::max(sharedMostObjects_.load(std::memory_order_relaxed), stats.objectsInUse);
+        return stats;
+    }
+
+    // add up what the magazines did since they were last folded into the shared stats
+    std::lock_guard<std::mutex> guard(lock_);
+    SimpleAllocatorStats stats = stats_;
+    for (const ThreadCache* pCache : threadCaches_) {
+        stats.allocations += pCache->allocations.load(std::memory_order_relaxed);
+        stats.deallocations += pCache->deallocations.load(std::memory_order_relaxed);
+        stats.freeObjects += pCache->count.load(std::memory_order_relaxed);
+    }
+    stats.objectsInUse = stats.allocations - stats.deallocations;
+    stats.mostObjects = std::max(stats.mostObjects, stats.objectsInUse);
+    return stats;
+}
+
+void* SimpleAllocator::allocateArena(const char* pLabel) {
+    std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+    if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+        guard.lock();
+
+    // move on to another page when the current one is used up
+    // - this throws if no more pages can be allocated
+    Node* pCurrent = pageList_.load(std::memory_order_relaxed);
+    if (!pCurrent || arenaUsed_ == pageInfo(reinterpret_cast<unsigned char*>(pCurrent)).objects)
+        nextArenaPage();
+
+    // bump to the next block on the current page and record it in its header
+    unsigned char* pPage = reinterpret_cast<unsigned char*>(pageList_.load(std::memory_order_relaxed));
+    unsigned char* pBlock = pPage + pageInfo(pPage).firstBlockOffset + arenaUsed_ * blockStride_;
+    writeHeader(pBlock, stats_.allocations + 1, pLabel);
+    ++arenaUsed_;
+
+    // mark it in use on its page and sign it as allocated
+    setInUse(pPage, pBlock, true);
+    if (config_.isDebug)
+        std::memset(pBlock, ALLOCATED_PATTERN, slotSize_);
+
+    // update stats
+    ++stats_.allocations;
+    ++stats_.objectsInUse;
+    --stats_.freeObjects;
+    stats_.mostObjects = std::max(stats_.mostObjects, stats_.objectsInUse);
+
+    return pBlock;
+}
+
+void SimpleAllocator::nextArenaPage() {
+    // recycle a page from before the last reset() first
+    if (arenaSpare_) {
+        Node* pPageNode = arenaSpare_;
+        arenaSpare_ = pPageNode->pNext;
+        pPageNode->pNext = pageList_.load(std::memory_order_relaxed);
+        pageList_.store(pPageNode, std::memory_order_relaxed);
+        arenaUsed_ = 0;
+        return;
+    }
+
+    // respect the page limit (0 means no limit)
+    if ((config_.maxPages && stats_.pagesInUse >= config_.maxPages) || config_.objectsPerPage == 0)
+        throw SimpleAllocatorException(SimpleAllocatorException::E_NO_PAGE,
+                                       "allocatePage: The maximum number of pages has been allocated.");
+
+    // a new page goes to the head of the page list, so it becomes the current one
+    const PageInfo& info = pageInfo(createPage(nextPageObjects(stats_.pagesInUse)));
+    arenaUsed_ = 0;
+
+    // update stats
+    ++stats_.pagesInUse;
+    stats_.freeObjects += info.objects;
+    stats_.pageBytes += info.size;
+    stats_.largestPageSize = std::max(stats_.largestPageSize, info.size);
+}
+
+Node* SimpleAllocator::takeBlocks(size_t count, unsigned& firstAllocNum) {
+    const unsigned batch = static_cast<unsigned>(count);
+
+    // a lock-free list can only be walked by whoever owns the blocks,
+    // so the blocks are popped one by one and chained up privately
+    if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+        Node* pFirst = nullptr;
+        Node* pLast = nullptr;
+        for (size_t i = 0; i < count; ++i) {
+            Node* pNode = nullptr;
+            try {
+                pNode = popLockFree();
+            } catch (const SimpleAllocatorException&) {
+                if (pFirst)
+                    pushLockFree(pFirst, pLast);
+                throw;
+            }
+            if (pLast)
+                setNext(pLast, pNode);
+            else
+                pFirst = pNode;
+            pLast = pNode;
+        }
+        setNext(pLast, nullptr);
+
+        firstAllocNum = sharedAllocations_.fetch_add(batch, std::memory_order_relaxed);
+        raiseMostObjectsLockFree(firstAllocNum + batch);
+        return pFirst;
+    }
+
+    std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+    if (config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED)
+        guard.lock();
+
+    // grow the pool until the shared free list holds the whole batch
+    // - this throws if no more pages can be allocated (the new pages just stay free)
+    while (stats_.freeObjects < count)
+        allocatePage();
+
+    // cut the chain off the front of the free list
+    Node* pFirst = freeList_;
+    Node* pLast = pFirst;
+    for (size_t i = 1; i < count; ++i)
+        pLast = nextOf(pLast);
+    freeList_ = nextOf(pLast);
+    setNext(pLast, nullptr);
+
+    // update stats
+    firstAllocNum = stats_.allocations;
+    stats_.allocations += batch;
+    stats_.freeObjects -= batch;
+    if (config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED) {
+        // allocation numbers are drawn from their own counter in this mode
+        if (config_.headerBlockInfo.type != SimpleAllocatorConfig::NO_HEADER)
+            firstAllocNum = allocNum_.fetch_add(batch, std::memory_order_relaxed);
+        sampleMostObjects();
+    } else {
+        stats_.objectsInUse += batch;
+        stats_.mostObjects = std::max(stats_.mostObjects, stats_.objectsInUse);
+    }
+    return pFirst;
+}
+
+void SimpleAllocator::giveBackBlocks(Node* pFirst, Node* pLast, unsigned count, bool cancelled) {
+    if (config_.concurrency == SimpleAllocatorConfig::LOCK_FREE) {
+        pushLockFree(pFirst, pLast);
+        if (cancelled)
+            sharedAllocations_.fetch_sub(count, std::memory_order_relaxed);
+        else
+            sharedDeallocations_.fetch_add(count, std::memory_order_relaxed);
+        return;
+    }
+
+    std::unique_lock<std::mutex> guard(lock_, std::defer_lock);
+    if (config_.concurrency == SimpleAllocatorConfig::THREAD_CACHED)
+        guard.lock();
+
+    // push the chain onto the free list
+    setNext(pLast, freeList_);
+    freeList_ = pFirst;
+
+    // update stats (objects in use are derived from the counters when thread cached)
+    stats_.freeObjects += count;
+    if (cancelled)
+        stats_.allocations -= count;
+    else
+        stats_.deallocations += count;
+    if (config_.concurrency == SimpleAllocatorConfig::SINGLE_THREADED)
+        stats_.objectsInUse -= count;
+
+    if (!cancelled)
+        autoTrim();
+}
+
+void* SimpleAllocator::allocateLockFree(const char* pLabel) {
+    // this grows the pool if the free list is empty, and throws if it cannot
+    Node* pNode = popLockFree();
+    unsigned char* pBlock = reinterpret_cast<unsigned char*>(pNode);
+
+    // the block only becomes ours once it is popped, so the header is written afterwards
+    // - and the block goes back if a failed external header allocation throws
+    const unsigned allocNum = sharedAllocations_.fetch_add(1, std::memory_order_relaxed) + 1;
+    try {
+        writeHeader(pBlock, allocNum, pLabel);
+    } catch (const SimpleAllocatorException&) {
+        sharedAllocations_.fetch_sub(1, std::memory_order_relaxed);
+        pushLockFree(pNode, pNode);
+        throw;
+    }
+
+    // mark it in use on its page and sign it as allocated
+    setInUse(pageOf(pBlock), pBlock, true);
+    if (config_.isDebug)
+        std::memset(pBlock, ALLOCATED_PATTERN, slotSize_);
+
+    raiseMostObjectsLockFree(allocNum);
+    return pBlock;
+}
+
+void SimpleAllocator::raiseMostObjectsLockFree(unsigned allocations) {
+    // the deallocation count may be ahead of ours, in which case nothing new was set
+    const unsigned deallocations = sharedDeallocations_.load(std::memory_order_relaxed);
+    if (allocations > deallocations) {
+        const unsigned inUse = allocations - deallocations;
+        unsigned most = sharedMostObjects_.load(std::memory_order_relaxed);
+        while (inUse > most && !sharedMostObjects_.compare_exchange_weak(most, inUse, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+Node* SimpleAllocator::popLockFree() {
+    uint64_t head = freeHead_.load(std::memory_order_acquire);
+    for (;;) {
+        // grow the pool when the free list is empty
+        // - another thread may have grown it (or freed blocks) in the meantime,
+        //   so only give up if the list is still empty after failing to grow it
+        Node* pNode = untag(head);
+        if (!pNode) {
+            try {
+                allocatePageLockFree();
+            } catch (const SimpleAllocatorException&) {
+                head = freeHead_.load(std::memory_order_acquire);
+                if (!untag(head))
+                    throw;
+                continue;
+            }
+            head = freeHead_.load(std::memory_order_acquire);
+            continue;
+        }
+
+        // the link may be stale if another thread pops the block first,
+        // in which case the tag has moved on and the swap fails
+        Node* pNext = atomicLinkOf(pNode).load(std::memory_order_relaxed);
+        if (freeHead_.compare_exchange_weak(head, retag(pNext, head),
+                                            std::memory_order_acquire, std::memory_order_acquire))
+            return pNode;
+    }
+}
+
+void SimpleAllocator::pushLockFree(Node* pFirst, Node* pLast) {
+    uint64_t head = freeHead_.load(std::memory_order_relaxed);
+    do {
+        atomicLinkOf(pLast).store(untag(head), std::memory_order_relaxed);
+    } while (!freeHead_.compare_exchange_weak(head, retag(pFirst, head),
+                                              std::memory_order_release, std::memory_order_relaxed));
+}
+
+void SimpleAllocator::allocatePageLockFree() {
+    // reserve a page under the page limit before allocating it
+    // - so that racing threads can never go over the limit together
+    unsigned pages = sharedPagesInUse_.load(std::memory_order_relaxed);
+    do {
+        if (pages >= config_.maxPages || config_.objectsPerPage == 0)
+            throw SimpleAllocatorException(SimpleAllocatorException::E_NO_PAGE,
+                                           "allocatePage: The maximum number of pages has been allocated.");
+    } while (!sharedPagesInUse_.compare_exchange_weak(pages, pages + 1, std::memory_order_relaxed));
+
+    // the page reserved sets the size of the page
+    unsigned char* pPage;
+    try {
+        pPage = createPage(nextPageObjects(pages));
+    } catch (const SimpleAllocatorException&) {
+        sharedPagesInUse_.fetch_sub(1, std::memory_order_relaxed);
+        throw;
+    }
+    sharedCapacity_.fetch_add(pageInfo(pPage).objects, std::memory_order_relaxed);
+    sharedPageBytes_.fetch_add(pageInfo(pPage).size, std::memory_order_relaxed);
+
+    // hand all the blocks of the page to the free list in one go
+    pushLockFree(firstBlock(pPage), lastBlock(pPage));
+}
+
+void* SimpleAllocator::allocateCached(const char* pLabel) {
+    // only go to the shared free list when the magazine is empty
+    ThreadCache& cache = getThreadCache();
+    if (!cache.pBlocks) {
+        std::lock_guard<std::mutex> guard(lock_);
+        refillMagazine(cache);
+    }
+
+    // record the block in its header before it leaves the magazine
+    // - allocation numbers are only drawn when there is a header to put them in,
+    //   from a range reserved for the magazine (so they only go up within a thread)
+    // - the number is only used up once the header is written
+    unsigned char* pBlock = reinterpret_cast<unsigned char*>(cache.pBlocks);
+    if (config_.headerBlockInfo.type != SimpleAllocatorConfig::NO_HEADER) {
+        if (cache.lastAllocNum == cache.endAllocNum) {
+            cache.lastAllocNum = allocNum_.fetch_add(config_.magazineSize, std::memory_order_relaxed);
+            cache.endAllocNum = cache.lastAllocNum + config_.magazineSize;
+        }
+        writeHeader(pBlock, cache.lastAllocNum + 1, pLabel);
+        ++cache.lastAllocNum;
+    }
+
+    // pop the block off the magazine and sign it as allocated
+    // - it has been in use on its page since the refill brought it in
+    cache.pBlocks = nextOf(cache.pBlocks);
+    bump(cache.count, static_cast<unsigned>(-1));
+    if (config_.isDebug)
+        std::memset(pBlock, ALLOCATED_PATTERN, slotSize_);
+
+    bump(cache.allocations, 1);
+    return pBlock;
+}
+
+void SimpleAllocator::freeCached(unsigned char* pBlock) {
+    // push the block onto the magazine
+    ThreadCache& cache = getThreadCache();
+    Node* pNode = reinterpret_cast<Node*>(pBlock);
+    setNext(pNode, cache.pBlocks);
+    cache.pBlocks = pNode;
+    bump(cache.count, 1);
+    bump(cache.deallocations, 1);
+
+    // only go to the shared free list when the magazine overflows
+    if (cache.count.load(std::memory_order_relaxed) > config_.magazineSize) {
+        std::lock_guard<std::mutex> guard(lock_);
+        flushMagazine(cache, config_.magazineSize / 2);
+    }
+}
+
+SimpleAllocator::ThreadCache& SimpleAllocator::getThreadCache() {
+    // most of the time the thread keeps using the same allocator
+    ThreadCacheList& list = threadCacheList;
+    if (list.lastId == id_)
+        return *list.pLast;
+
+    for (auto& entry : list.caches) {
+        if (entry.first == id_) {
+            list.lastId = entry.first;
+            list.pLast = entry.second;
+            return *entry.second;
+        }
+    }
+
+    // first use of this allocator on this thread
+    // - forget the magazines of allocators that have died since
+    {
+        std::lock_guard<std::mutex> guard(liveAllocatorsLock());
+        auto dead = [](const std::pair<uint64_t, ThreadCache*>& entry) {
+            return liveAllocators().find(entry.first) == liveAllocators().end();
+        };
+        list.caches.erase(std::remove_if(list.caches.begin(), list.caches.end(), dead), list.caches.end());
+    }
+
+    // - then create a magazine and register it with the allocator
+    ThreadCache* pCache = nullptr;
+    try {
+        pCache = new ThreadCache;
+        list.caches.emplace_back(id_, pCache);
+        std::lock_guard<std::mutex> guard(lock_);
+        threadCaches_.push_back(pCache);
+    } catch (const std::bad_alloc&) {
+        if (pCache && !list.caches.empty() && list.caches.back().second == pCache)
+            list.caches.pop_back();
+        delete pCache;
+        throw SimpleAllocatorException(SimpleAllocatorException::E_NO_MEMORY,
+                                       "allocate: No system memory available for the thread cache.");
+    }
+
+    list.lastId = id_;
+    list.pLast = pCache;
+    return *pCache;
+}
+
+void SimpleAllocator::refillMagazine(ThreadCache& cache) {
+    // only grab a new page if the shared free list has nothing at all
+    // - this throws if no more pages can be allocated
+    const unsigned batch = config_.magazineSize / 2;
+    unsigned moved = 0;
+    while (moved < batch) {
+        if (!freeList_) {
+            if (moved)
+                break;
+            allocatePage();
+        }
+
+        // a block in a magazine counts as in use on its page until it is flushed
+        Node* pNode = freeList_;
+        freeList_ = nextOf(pNode);
+        setInUse(pageOf(pNode), reinterpret_cast<unsigned char*>(pNode), true);
+        setNext(pNode, cache.pBlocks);
+        cache.pBlocks = pNode;
+        ++moved;
+    }
+
+    stats_.freeObjects -= moved;
+    bump(cache.count, moved);
+    sampleMostObjects();
+}
+
+void SimpleAllocator::flushMagazine(ThreadCache& cache, unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+        Node* pNode = cache.pBlocks;
+        cache.pBlocks = nextOf(pNode);
+        setInUse(pageOf(pNode), reinterpret_cast<unsigned char*>(pNode), false);
+        setNext(pNode, freeList_);
+        freeList_ = pNode;
+    }
+
+    stats_.freeObjects += count;
+    bump(cache.count, static_cast<unsigned>(-static_cast<int>(count)));
+    sampleMostObjects();
+    autoTrim();
+}
+
+void SimpleAllocator::releaseThreadCache(ThreadCache* pCache) {
+    std::lock_guard<std::mutex> guard(lock_);
+    flushMagazine(*pCache, pCache->count.load(std::memory_order_relaxed));
+    stats_.allocations += pCache->allocations.load(std::memory_order_relaxed);
+    stats_.deallocations += pCache->deallocations.load(std::memory_order_relaxed);
+    threadCaches_.erase(std::find(threadCaches_.begin(), threadCaches_.end(), pCache));
+    delete pCache;
+}
+
+void SimpleAllocator::sampleMostObjects() {
+    unsigned allocations = stats_.allocations;
+    unsigned deallocations = stats_.deallocations;
+    for (const ThreadCache* pCache : threadCaches_) {
+        allocations += pCache->allocations.load(std::memory_order_relaxed);
+        deallocations += pCache->deallocations.load(std::memory_order_relaxed);
+    }
+    stats_.mostObjects = std::max(stats_.mostObjects, allocations - deallocations);
+}
+
+unsigned char* SimpleAllocator::validateBlock(unsigned char* pBlock) const {
+    // the pointer must lie on one of our pages
+    unsigned char* pPage = findPage(pBlock);
+    if (!pPage)
+        throw SimpleAllocatorException(SimpleAllocatorException::E_BAD_BOUNDARY,
+                                       "free: Block address is not on any page.");
+
+    // and it must be the start of one of the objects on that page
+    const PageInfo& info = pageInfo(pPage);
+    const size_t offset = static_cast<size_t>(pBlock - pPage);
+    if (offset < info.firstBlockOffset || (offset - info.firstBlockOffset) % blockStride_ != 0
+        || (offset - info.firstBlockOffset) / blockStride_ >= info.objects)
+        throw SimpleAllocatorException(SimpleAllocatorException::E_BAD_BOUNDARY,
+                                       "free: Block address is not on a block boundary.");
+
+    // catch buffer overruns/underruns before the block goes back on the list
+    if (config_.isDebug)
+        checkPadBytes(pBlock);
+
+    return pPage;
+}
+
+bool SimpleAllocator::setInUse(unsigned char* pPage, const unsigned char* pBlock, bool inUse) {
+    const size_t index = static_cast<size_t>(pBlock - pPage - pageInfo(pPage).firstBlockOffset) / blockStride_;
+    std::atomic<unsigned char>& bits = reinterpret_cast<std::atomic<unsigned char>*>(pPage + sizeof(PageInfo))[index / 8];
+    const unsigned char mask = static_cast<unsigned char>(1u << (index % 8));
+
+    // neighbouring blocks share the byte, so other threads may flip bits in it too
+    unsigned char oldBits;
+    if (config_.concurrency == SimpleAllocatorConfig::SINGLE_THREADED) {
+        oldBits = bits.load(std::memory_order_relaxed);
+        bits.store(inUse ? oldBits | mask : oldBits & ~mask, std::memory_order_relaxed);
+    } else {
+        oldBits = inUse ? bits.fetch_or(mask) : bits.fetch_and(static_cast<unsigned char>(~mask));
+    }
+    const bool wasInUse = oldBits & mask;
+    if (wasInUse == inUse || config_.concurrency == SimpleAllocatorConfig::LOCK_FREE)
+        return wasInUse;
+
+    // count the blocks in use on the page, and the pages going from or to empty
+    std::atomic<unsigned>& objectsInUse = pageInfo(pPage).objectsInUse;
+    if (config_.concurrency == SimpleAllocatorConfig::SINGLE_THREADED) {
+        const unsigned before = objectsInUse.load(std::memory_order_relaxed);
+        objectsInUse.store(inUse ? before + 1 : before - 1, std::memory_order_relaxed);
+        if (inUse ? before == 0 : before == 1)
+            bump(emptyPages_, inUse ? static_cast<unsigned>(-1) : 1);
+    } else {
+        const unsigned before = inUse ? objectsInUse.fetch_add(1, std::memory_order_relaxed)
+                                      : objectsInUse.fetch_sub(1, std::memory_order_relaxed);
+        if (inUse ? before == 0 : before == 1)
+            emptyPages_.fetch_add(inUse ? static_cast<unsigned>(-1) : 1, std::memory_order_relaxed);
+    }
+    return wasInUse;
+}
+
+bool SimpleAllocator::isAllocated(unsigned char* pPage, const unsigned char* pBlock) const {
+    const SimpleAllocatorConfig::HeaderBlockInfo& info = config_.headerBlockInfo;
+    const unsigned char* pHeader = pBlock - config_.padBytesSize - info.size;
+
+    switch (info.type) {
+    case SimpleAllocatorConfig::BASIC_HEADER:
+        // | alloc num | flag |
+        return pHeader[sizeof(unsigned)];
+
+    case SimpleAllocatorConfig::EXTENDED_HEADER:
+        // | user-defined | use count | alloc num | flag |
+        return pHeader[info.userDefinedSize + sizeof(unsigned short) + sizeof(unsigned)];
+
+    case SimpleAllocatorConfig::EXTERNAL_HEADER: {
+        // | MemBlockInfo* | (null once freed)
+        MemBlockInfo* pInfo;
+        std::memcpy(&pInfo, pHeader, sizeof(MemBlockInfo*));
+        return pInfo != nullptr;
+    }
+
+    default: {
+        // without a header only the in-use bit is left, which stays set while the block is in a magazine
+        const size_t index = static_cast<size_t>(pBlock - pPage - pageInfo(pPage).firstBlockOffset) / blockStride_;
+        const std::atomic<unsigned char>& bits =
+            reinterpret_cast<const std::atomic<unsigned char>*>(pPage + sizeof(PageInfo))[index / 8];
+        return bits.load(std::memory_order_relaxed) & (1u << (index % 8));
+    }
+    }
+}
+
+SimpleAllocator::PageInfo& SimpleAllocator::pageInfo(unsigned char* pPage) const {
+    return *reinterpret_cast<PageInfo*>(pPage);
+}
+
+unsigned SimpleAllocator::trimPages() {
+    if (emptyPages_.load(std::memory_order_relaxed) == 0)
+        return 0;
+
+    // count how many blocks of every page are on the free list
+    for (Node* pPageNode = pageList_.load(std::memory_order_relaxed); pPageNode; pPageNode = pPageNode->pNext)
+        pageInfo(reinterpret_cast<unsigned char*>(pPageNode)).freeSeen = 0;
+    for (Node* pNode = freeList_; pNode; pNode = nextOf(pNode))
+        ++pageInfo(pageOf(pNode)).freeSeen;
+
+    // a page can go if all of its blocks are there
+    // - drop their blocks from the free list, keeping the others in order
+    Node* pKept = nullptr;
+    Node* pKeptLast = nullptr;
+    for (Node* pNode = freeList_; pNode;) {
+        Node* pNext = nextOf(pNode);
+        const PageInfo& info = pageInfo(pageOf(pNode));
+        if (info.freeSeen != info.objects) {
+            if (pKeptLast)
+                setNext(pKeptLast, pNode);
+            else
+                pKept = pNode;
+            pKeptLast = pNode;
+        }
+        pNode = pNext;
+    }
+    if (pKeptLast)
+        setNext(pKeptLast, nullptr);
+    freeList_ = pKept;
+
+    // then take the pages themselves off the page list and hand them back
+    unsigned reclaimed = 0;
+    Node* pPrev = nullptr;
+    for (Node* pPageNode = pageList_.load(std::memory_order_relaxed); pPageNode;) {
+        Node* pNext = pPageNode->pNext;
+        unsigned char* pPage = reinterpret_cast<unsigned char*>(pPageNode);
+        if (pageInfo(pPage).freeSeen == pageInfo(pPage).objects) {
+            if (pPrev)
+                pPrev->pNext = pNext;
+            else
+                pageList_.store(pNext, std::memory_order_relaxed);
+            reclaimPage(pPage);
+            ++reclaimed;
+        } else {
+            pPrev = pPageNode;
+        }
+        pPageNode = pNext;
+    }
+
+    trimFloor_ = emptyPages_.load(std::memory_order_relaxed);
+    return reclaimed;
+}
+
+void SimpleAllocator::autoTrim() {
+    if (!config_.autoTrimPages)
+        return;
+
+    // pages that came back into use since the last trim lower the floor again
+    const unsigned emptyPages = emptyPages_.load(std::memory_order_relaxed);
+    trimFloor_ = std::min(trimFloor_, emptyPages);
+    if (emptyPages > trimFloor_ + config_.autoTrimPages)
+        trimPages();
+}
+
+void SimpleAllocator::reclaimPage(unsigned char* pPage) {
+    const unsigned objects = pageInfo(pPage).objects;
+    const size_t size = pageInfo(pPage).size;
+    removeFromDirectory(pPage);
+    releasePageMemory(pPage, true);
+
+    // update stats
+    --stats_.pagesInUse;
+    stats_.freeObjects -= objects;
+    stats_.pageBytes -= size;
+    ++stats_.pagesReclaimed;
+    emptyPages_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+unsigned char* SimpleAllocator::allocatePageMemory(const PageLayout& layout) {
+    const size_t alignment = size_t(1) << layout.shift;
+#if SIMPLEALLOCATOR_HAS_MMAP
+    if (config_.mapPages) {
+        // reuse the address range of a page trimmed earlier if it fits
+        // - its memory comes back zeroed on first touch
+        const size_t mappedSize = (layout.size + osPageSize_ - 1) / osPageSize_ * osPageSize_;
+        for (size_t i = releasedPages_.size(); i-- > 0;) {
+            unsigned char* pPage = releasedPages_[i].first;
+            if (releasedPages_[i].second == mappedSize && (reinterpret_cast<uintptr_t>(pPage) & (alignment - 1)) == 0) {
+                releasedPages_.erase(releasedPages_.begin() + static_cast<std::ptrdiff_t>(i));
+                return pPage;
+            }
+        }
+
+        // map enough to find an aligned start inside, then unmap the ends around it
+        // - mmap only lines up with the OS page size
+        const size_t extra = alignment > osPageSize_ ? alignment - osPageSize_ : 0;
+        void* pMapped = mmap(nullptr, mappedSize + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pMapped == MAP_FAILED)
+            throw std::bad_alloc();
+        unsigned char* pStart = static_cast<unsigned char*>(pMapped);
+        unsigned char* pPage = reinterpret_cast<unsigned char*>(
+            (reinterpret_cast<uintptr_t>(pStart) + alignment - 1) & ~uintptr_t(alignment - 1));
+        if (pPage > pStart)
+            munmap(pStart, static_cast<size_t>(pPage - pStart));
+        if (pStart + mappedSize + extra > pPage + mappedSize)
+            munmap(pPage + mappedSize, static_cast<size_t>(pStart + mappedSize + extra - (pPage + mappedSize)));
+
+        // big pages may as well be backed by transparent huge pages
+#ifdef MADV_HUGEPAGE
+        if (mappedSize >= HUGE_PAGE_SIZE)
+            madvise(pPage, mappedSize, MADV_HUGEPAGE);
+#endif
+        return pPage;
+    }
+#endif
+    return static_cast<unsigned char*>(::operator new(layout.size, std::align_val_t(alignment)));
+}
+
+void SimpleAllocator::releasePageMemory(unsigned char* pPage, bool keepMapping) {
+    const size_t size = pageInfo(pPage).size;
+    const size_t alignment = size_t(1) << pageInfo(pPage).shift;
+#if SIMPLEALLOCATOR_HAS_MMAP
+    if (config_.mapPages) {
+        // the memory goes back to the OS either way, the address range only if it is not kept
+        const size_t mappedSize = (size + osPageSize_ - 1) / osPageSize_ * osPageSize_;
+        if (keepMapping) {
+            madvise(pPage, mappedSize, MADV_DONTNEED);
+            releasedPages_.emplace_back(pPage, mappedSize);
+        } else {
+            munmap(pPage, mappedSize);
+        }
+        return;
+    }
+#endif
+    (void)keepMapping;
+    (void)size;
+    ::operator delete(pPage, std::align_val_t(alignment));
+}
+
+void SimpleAllocator::allocatePage() {
+    // respect the page limit (0 means no limit)
+    // - a page that holds no objects can never satisfy an allocation either
+    if ((config_.maxPages && stats_.pagesInUse >= config_.maxPages) || config_.objectsPerPage == 0)
+        throw SimpleAllocatorException(SimpleAllocatorException::E_NO_PAGE,
+                                       "allocatePage: The maximum number of pages has been allocated.");
+
+    // the blocks are chained in address order, so they are handed out in that order
+    unsigned char* pPage = createPage(nextPageObjects(stats_.pagesInUse));
+    setNext(lastBlock(pPage), freeList_);
+    freeList_ = firstBlock(pPage);
+
+    // update stats
+    const PageInfo& info = pageInfo(pPage);
+    ++stats_.pagesInUse;
+    stats_.freeObjects += info.objects;
+    stats_.pageBytes += info.size;
+    stats_.largestPageSize = std::max(stats_.largestPageSize, info.size);
+}
+
+unsigned char* SimpleAllocator::createPage(unsigned objects) {
+    // allocate the page on its power-of-2 boundary
+    const PageLayout layout = pageLayout(objects);
+    unsigned char* pPage = nullptr;
+    try {
+        pPage = allocatePageMemory(layout);
+    } catch (const std::bad_alloc&) {
+        throw SimpleAllocatorException(SimpleAllocatorException::E_NO_MEMORY,
+                                       "allocatePage: No system memory available.");
+    }
+
+    // in debug mode sign every byte of the page so that the client can tell
+    // which bytes are unallocated, alignment or pad bytes
+    const size_t headerSize = config_.headerBlockInfo.size;
+    const size_t padSize = config_.padBytesSize;
+    if (config_.isDebug) {
+        std::memset(pPage, ALIGN_PATTERN, layout.size);
+        for (unsigned i = 0; i < objects; ++i) {
+            unsigned char* pBlock = pPage + layout.firstBlockOffset + i * blockStride_;
+            std::memset(pBlock - padSize, PAD_PATTERN, padSize);
+            std::memset(pBlock, UNALLOCATED_PATTERN, slotSize_);
+            std::memset(pBlock + slotSize_, PAD_PATTERN, padSize);
+        }
+    }
+
+    // headers and in-use bits always start out zeroed (not in use, no alloc num, no label)
+    // - and the page starts out empty
+    PageInfo* pInfo = new (pPage) PageInfo;
+    pInfo->objectsInUse.store(0, std::memory_order_relaxed);
+    pInfo->freeSeen = 0;
+    pInfo->objects = objects;
+    pInfo->shift = layout.shift;
+    pInfo->firstBlockOffset = layout.firstBlockOffset;
+    pInfo->size = layout.size;
+    for (unsigned i = 0; i < (objects + 7) / 8; ++i)
+        new (pPage + sizeof(PageInfo) + i) std::atomic<unsigned char>(0);
+    for (unsigned i = 0; i < objects; ++i) {
+        unsigned char* pBlock = pPage + layout.firstBlockOffset + i * blockStride_;
+        std::memset(pBlock - padSize - headerSize, 0, headerSize);
+    }
+
+    // chain the blocks together in address order
+    for (unsigned i = 0; i < objects; ++i) {
+        Node* pNode = reinterpret_cast<Node*>(pPage + layout.firstBlockOffset + i * blockStride_);
+        setNext(pNode, i + 1 < objects
+                           ? reinterpret_cast<Node*>(pPage + layout.firstBlockOffset + (i + 1) * blockStride_)
+                           : nullptr);
+    }
+
+    // register the page in the directory (by its page info)
+    try {
+        addToDirectory(pPage);
+    } catch (const std::bad_alloc&) {
+        releasePageMemory(pPage, true);
+        throw SimpleAllocatorException(SimpleAllocatorException::E_NO_MEMORY,
+                                       "allocatePage: No system memory available.");
+    }
+    if (config_.concurrency != SimpleAllocatorConfig::LOCK_FREE)
+        emptyPages_.fetch_add(1, std::memory_order_relaxed);
+
+    // lookups for blocks on a bigger page than any before have to start from its boundary
+    unsigned maxShift = maxPageShift_.load(std::memory_order_relaxed);
+    while (maxShift < layout.shift
+           && !maxPageShift_.compare_exchange_weak(maxShift, layout.shift, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+    }
+
+    // link the page into the page list
+    Node* pPageNode = reinterpret_cast<Node*>(pPage);
+    pPageNode->pNext = pageList_.load(std::memory_order_relaxed);
+    while (!pageList_.compare_exchange_weak(pPageNode->pNext, pPageNode, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+    }
+
+    return pPage;
+}
+
+SimpleAllocator::PageLayout SimpleAllocator::pageLayout(unsigned objects) const {
+    const size_t headerSize = config_.headerBlockInfo.size;
+    const size_t padSize = config_.padBytesSize;
+    const size_t blockSize = headerSize + 2 * padSize + slotSize_;
+
+    // left alignment pushes the first object onto the boundary
+    // - the bitmap before it grows with the page, so this differs from page size to page size
+    PageLayout layout;
+    layout.objects = objects;
+    const size_t pageHeaderSize = sizeof(PageInfo) + (objects + 7) / 8;
+    const size_t lead = pageHeaderSize + headerSize + padSize;
+    const size_t leftAlignSize = (blockBoundary_ - lead % blockBoundary_) % blockBoundary_;
+    layout.firstBlockOffset = pageHeaderSize + leftAlignSize + headerSize + padSize;
+
+    // the last block on a page does not need the trailing inter alignment
+    layout.size = pageHeaderSize + leftAlignSize;
+    if (objects > 0)
+        layout.size += objects * blockSize + (objects - 1) * size_t(config_.interAlignBytesSize);
+
+    // pages start on the smallest power of 2 that covers a whole page
+    // - so every address on a page shares its page-aligned address with the page start
+    // - and the alignment boundary of the objects holds in absolute terms too
+    layout.shift = 0;
+    while ((size_t(1) << layout.shift) < std::max(layout.size, blockBoundary_))
+        ++layout.shift;
+
+    // pages of several sizes take their whole power of 2 (see nextPageObjects)
+    if (config_.pageGrowth == SimpleAllocatorConfig::GEOMETRIC_PAGES)
+        layout.size = size_t(1) << layout.shift;
+    return layout;
+}
+
+unsigned SimpleAllocator::nextPageObjects(unsigned index) const {
+    if (config_.pageGrowth == SimpleAllocatorConfig::FIXED_PAGES || config_.objectsPerPage == 0)
+        return config_.objectsPerPage;
+
+    // double for every page in use up to the cap (without overflowing on the way)
+    const unsigned cap = config_.maxObjectsPerPage;
+    unsigned objects = config_.objectsPerPage;
+    for (unsigned i = 0; i < index && objects < cap; ++i)
+        objects = objects > cap / 2 ? cap : objects * 2;
+
+    // then fill up the power of 2 the page starts on
+    // - nothing else can sit in the rest of it, so a page found at an address masked
+    //   to the page's boundary is sure to hold the address (see findPage)
+    // - jump by the bytes left (a block also takes a bit in the bitmap), then settle
+    //   on the last count that still fits
+    const PageLayout layout = pageLayout(objects);
+    const size_t used = layout.firstBlockOffset - config_.headerBlockInfo.size - config_.padBytesSize
+                        + objects * blockStride_ - config_.interAlignBytesSize;
+    objects += static_cast<unsigned>((layout.size - std::min(used, layout.size)) / (blockStride_ + 1));
+    while (pageLayout(objects).shift > layout.shift)
+        --objects;
+    while (pageLayout(objects + 1).shift == layout.shift)
+        ++objects;
+    return objects;
+}
+
+Node* SimpleAllocator::firstBlock(unsigned char* pPage) const {
+    return reinterpret_cast<Node*>(pPage + pageInfo(pPage).firstBlockOffset);
+}
+
+Node* SimpleAllocator::lastBlock(unsigned char* pPage) const {
+    const PageInfo& info = pageInfo(pPage);
+    return reinterpret_cast<Node*>(pPage + info.firstBlockOffset + (info.objects - 1) * blockStride_);
+}
+
+unsigned char* SimpleAllocator::pageOf(const void* pBlock) const {
+    if (config_.pageGrowth == SimpleAllocatorConfig::GEOMETRIC_PAGES)
+        return findPage(pBlock);
+    return reinterpret_cast<unsigned char*>(reinterpret_cast<uintptr_t>(pBlock) & ~uintptr_t(pageAlignment_ - 1));
+}
+
+unsigned char* SimpleAllocator::findPage(const void* pAddress) const {
+    // try the address masked to every page boundary in use, biggest first
+    // - a page holds its whole boundary (FIXED_PAGES have just the one boundary, GEOMETRIC_PAGES
+    //   fill theirs), so a page found there holds the address if the address is inside its boundary
+    const uintptr_t address = reinterpret_cast<uintptr_t>(pAddress);
+    for (unsigned shift = maxPageShift_.load(std::memory_order_acquire); shift >= pageShift_; --shift) {
+        const uintptr_t start = address & ~((uintptr_t(1) << shift) - 1);
+        const uintptr_t entry = lookupPage(reinterpret_cast<const unsigned char*>(start));
+        if (entry && address - start < (uintptr_t(1) << (entry & ENTRY_SHIFT_MASK)))
+            return reinterpret_cast<unsigned char*>(start);
+    }
+    return nullptr;
+}
+
+uintptr_t SimpleAllocator::lookupPage(const unsigned char* pStart) const {
+    const PageDirectory* pDirectory = pageDirectory_.load(std::memory_order_acquire);
+    if (!pDirectory)
+        return 0;
+
+    // linear probing from the hashed page-aligned address until an empty slot
+    // - the low bits of an entry are below the smallest page boundary, so they drop out of the key
+    const uintptr_t key = reinterpret_cast<uintptr_t>(pStart) >> pageShift_;
+    for (size_t slot = hashPageKey(key) & pDirectory->mask;; slot = (slot + 1) & pDirectory->mask) {
+        unsigned char* pEntry = pDirectory->pSlots[slot].load(std::memory_order_acquire);
+        if (!pEntry)
+            return 0;
+        if (pEntry != DIRECTORY_TOMBSTONE && (reinterpret_cast<uintptr_t>(pEntry) >> pageShift_) == key)
+            return reinterpret_cast<uintptr_t>(pEntry);
+    }
+}
+
+void SimpleAllocator::addToDirectory(unsigned char* pPage) {
+    // keep the table at most half full (tombstones included) so that probes stay short
+    // - a full table is replaced by one big enough for the pages, without the tombstones
+    // - a lock-free allocator's table is already big enough for every page
+    PageDirectory* pDirectory = pageDirectory_.load(std::memory_order_relaxed);
+    if (config_.concurrency != SimpleAllocatorConfig::LOCK_FREE
+        && (!pDirectory || (stats_.pagesInUse + directoryTombstones_ + 1) * 2 > pDirectory->mask + 1)) {
+        size_t slots = pDirectory ? pDirectory->mask + 1 : 16;
+        while ((stats_.pagesInUse + 1) * 2 > slots)
+            slots *= 2;
+        PageDirectory* pGrown = new PageDirectory{slots - 1, nullptr, pDirectory};
+        try {
+            pGrown->pSlots = new std::atomic<unsigned char*>[slots]();
+        } catch (const std::bad_alloc&) {
+            delete pGrown;
+            throw;
+        }
+
+        for (size_t i = 0; pDirectory && i <= pDirectory->mask; ++i) {
+            unsigned char* pOldPage = pDirectory->pSlots[i].load(std::memory_order_relaxed);
+            if (pOldPage && pOldPage != DIRECTORY_TOMBSTONE)
+                insertIntoDirectory(pGrown, pOldPage);
+        }
+        directoryTombstones_ = 0;
+
+        // single threaded allocators have nobody else probing the old table
+        if (pDirectory && config_.concurrency == SimpleAllocatorConfig::SINGLE_THREADED) {
+            pGrown->pRetired = nullptr;
+            delete[] pDirectory->pSlots;
+            delete pDirectory;
+        }
+
+        pageDirectory_.store(pGrown, std::memory_order_release);
+        pDirectory = pGrown;
+    }
+
+    // the entry keeps the page's boundary next to its start
+    insertIntoDirectory(pDirectory, reinterpret_cast<unsigned char*>(reinterpret_cast<uintptr_t>(pPage)
+                                                                     | pageInfo(pPage).shift));
+}
+
+void SimpleAllocator::removeFromDirectory(unsigned char* pPage) {
+    // the slot cannot just be emptied, that would cut the probe chains running through it
+    PageDirectory* pDirectory = pageDirectory_.load(std::memory_order_relaxed);
+    const uintptr_t key = reinterpret_cast<uintptr_t>(pPage) >> pageShift_;
+    for (size_t slot = hashPageKey(key) & pDirectory->mask;; slot = (slot + 1) & pDirectory->mask) {
+        unsigned char* pEntry = pDirectory->pSlots[slot].load(std::memory_order_relaxed);
+        if (pEntry != DIRECTORY_TOMBSTONE && (reinterpret_cast<uintptr_t>(pEntry) >> pageShift_) == key) {
+            pDirectory->pSlots[slot].store(DIRECTORY_TOMBSTONE, std::memory_order_release);
+            ++directoryTombstones_;
+            return;
+        }
+    }
+}
+
+void SimpleAllocator::insertIntoDirectory(PageDirectory* pDirectory, unsigned char* pEntry) {
+    // claim the first empty slot (lock-free allocators may be adding pages on several threads)
+    const uintptr_t key = reinterpret_cast<uintptr_t>(pEntry) >> pageShift_;
+    size_t slot = hashPageKey(key) & pDirectory->mask;
+    for (;;) {
+        unsigned char* pEmpty = nullptr;
+        if (pDirectory->pSlots[slot].compare_exchange_strong(pEmpty, pEntry, std::memory_order_release,
+                                                             std::memory_order_relaxed))
+            return;
+        slot = (slot + 1) & pDirectory->mask;
+    }
+}
+
+void SimpleAllocator::writeHeader(unsigned char* pBlock, unsigned allocNum, const char* pLabel) {
+    const SimpleAllocatorConfig::HeaderBlockInfo& info = config_.headerBlockInfo;
+    unsigned char* pHeader = pBlock - config_.padBytesSize - info.size;
+    const bool inUse = allocNum != 0;
+
+    switch (info.type) {
+    case SimpleAllocatorConfig::BASIC_HEADER:
+        // | alloc num | flag |
+        std::memcpy(pHeader, &allocNum, sizeof(unsigned));
+        pHeader[sizeof(unsigned)] = inUse;
+        break;
+
+    case SimpleAllocatorConfig::EXTENDED_HEADER: {
+        // | user-defined | use count | alloc num | flag |
+        unsigned char* pUseCount = pHeader + info.userDefinedSize;
+        if (inUse) {
+            unsigned short useCount;
+            std::memcpy(&useCount, pUseCount, sizeof(unsigned short));
+            ++useCount;
+            std::memcpy(pUseCount, &useCount, sizeof(unsigned short));
+        }
+        std::memcpy(pUseCount + sizeof(unsigned short), &allocNum, sizeof(unsigned));
+        pUseCount[sizeof(unsigned short) + sizeof(unsigned)] = inUse;
+        break;
+    }
+
+    case SimpleAllocatorConfig::EXTERNAL_HEADER: {
+        // | MemBlockInfo* |
+        MemBlockInfo* pInfo;
+        std::memcpy(&pInfo, pHeader, sizeof(MemBlockInfo*));
+
+        // hand the info of the previous owner of the block (if any) back to the slab
+        if (pInfo) {
+            releaseBlockInfo(pInfo);
+            pInfo = nullptr;
+        }
+
+        if (inUse)
+            pInfo = acquireBlockInfo(allocNum, pLabel);
+        std::memcpy(pHeader, &pInfo, sizeof(MemBlockInfo*));
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+MemBlockInfo* SimpleAllocator::acquireBlockInfo(unsigned allocNum, const char* pLabel) {
+    std::unique_lock<std::mutex> guard(infoLock_, std::defer_lock);
+    if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+        guard.lock();
+
+    try {
+        // intern the label first, so that a failure leaves the slab as it was
+        char* pInterned = pLabel ? internLabel(pLabel) : nullptr;
+
+        // grow the slab by a chunk
+        // - every vector is grown before the chunk is taken, so that nothing leaks if one of them throws
+        if (freeInfos_.empty()) {
+            const size_t chunkSize = std::max(config_.objectsPerPage, 1u);
+            infoChunks_.reserve(infoChunks_.size() + 1);
+            freeInfos_.reserve(freeInfos_.capacity() + chunkSize);
+            MemBlockInfo* pChunk = new MemBlockInfo[chunkSize];
+            infoChunks_.push_back(pChunk);
+            for (size_t i = chunkSize; i > 0; --i)
+                freeInfos_.push_back(pChunk + i - 1);
+        }
+
+        MemBlockInfo* pInfo = freeInfos_.back();
+        freeInfos_.pop_back();
+        pInfo->inUse = true;
+        pInfo->allocNum = allocNum;
+        pInfo->pLabel = pInterned;
+        return pInfo;
+    } catch (const std::bad_alloc&) {
+        throw SimpleAllocatorException(SimpleAllocatorException::E_NO_MEMORY,
+                                       "allocate: No system memory available for the block info.");
+    }
+}
+
+void SimpleAllocator::releaseBlockInfo(MemBlockInfo* pInfo) {
+    std::unique_lock<std::mutex> guard(infoLock_, std::defer_lock);
+    if (config_.concurrency != SimpleAllocatorConfig::SINGLE_THREADED)
+        guard.lock();
+
+    pInfo->inUse = false;
+    pInfo->pLabel = nullptr;
+    freeInfos_.push_back(pInfo);
+}
+
+char* SimpleAllocator::internLabel(const char* pLabel) {
+    // most labels are literals, so the same address tends to come back with the same string
+    // - the contents are still compared, the client may have reused its buffer for another label
+    std::pair<const char*, char*>& cached =
+        labelCache_[(reinterpret_cast<uintptr_t>(pLabel) >> 3) % LABEL_CACHE_SIZE];
+    if (cached.first == pLabel && std::strcmp(cached.second, pLabel) == 0)
+        return cached.second;
+
+    const std::string_view label(pLabel);
+    auto it = labels_.find(label);
+    if (it == labels_.end()) {
+        // copy it into the last chunk, or into a new one if it does not fit
+        // - the set is grown before the chunk is taken, so that nothing leaks if it throws
+        const size_t bytes = label.size() + 1;
+        labels_.reserve(labels_.size() + 1);
+        if (labelChunks_.empty() || labelChunkUsed_ + bytes > LABEL_CHUNK_SIZE) {
+            labelChunks_.reserve(labelChunks_.size() + 1);
+            labelChunks_.push_back(new char[std::max(bytes, LABEL_CHUNK_SIZE)]);
+            labelChunkUsed_ = 0;
+        }
+        char* pCopy = labelChunks_.back() + labelChunkUsed_;
+        std::memcpy(pCopy, pLabel, bytes);
+        labelChunkUsed_ += bytes;
+        it = labels_.insert(std::string_view(pCopy, label.size())).first;
+    }
+
+    cached = std::make_pair(pLabel, const_cast<char*>(it->data()));
+    return cached.second;
+}
+
+void SimpleAllocator::checkPadBytes(const unsigned char* pBlock) const {
+    if (!padBytesIntact(pBlock))
+        throw SimpleAllocatorException(SimpleAllocatorException::E_CORRUPTED_BLOCK,
+                                       "free: Pad bytes of the block have been overwritten.");
+}
+
+bool SimpleAllocator::padBytesIntact(const unsigned char* pBlock) const {
+    const size_t padSize = config_.padBytesSize;
+    return allBytesAre(pBlock - padSize, padSize, PAD_PATTERN) && allBytesAre(pBlock + slotSize_, padSize, PAD_PATTERN);
+}
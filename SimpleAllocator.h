@@ -11,11 +11,29 @@
 #ifndef SIMPLEALLOCATOR_H
 #define SIMPLEALLOCATOR_H
 #include <string>
+#include <string_view>
 #include <iostream>
+#include <unordered_set>
+#include <vector>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
 
 // Defaults for SimpleAllocator construction when client does not specify
 static const int DEFAULT_OBJECTS_PER_PAGE = 4;
 static const int DEFAULT_MAX_PAGES = 3;
+static const int DEFAULT_MAGAZINE_SIZE = 64;
+static const int DEFAULT_MAX_OBJECTS_PER_PAGE = 4096;
+
+// Page limit for LOCK_FREE allocators configured with maxPages = 0 (no limit)
+// - the page directory of a lock-free allocator is sized up front and never grows
+static const int LOCK_FREE_PAGE_LIMIT = 1 << 16;
+
+// Label arena of EXTERNAL_HEADER allocators
+// - labels longer than a chunk get a chunk of their own
+// - the cache remembers the interned copy of the last labels passed in by their address
+static const size_t LABEL_CHUNK_SIZE = 4096;
+static const size_t LABEL_CACHE_SIZE = 16;
 
 /**
  * @class SimpleAllocatorException
@@ -32,7 +50,8 @@ public:
         E_NO_PAGE, // No page available (max pages reached)
         E_BAD_BOUNDARY, // block address is on a page but not a block boundary
         E_MULTIPLE_FREE, // block has already been freed
-        E_CORRUPTED_BLOCK // block has been corrupted (pad bytes overwritten)
+        E_CORRUPTED_BLOCK, // block has been corrupted (pad bytes overwritten)
+        E_BAD_SIZE // object size has no size class (SizeClassAllocator only)
     };
 
     /**
@@ -90,6 +109,44 @@ struct SimpleAllocatorConfig {
         EXTERNAL_HEADER,
     };
 
+    /**
+     * Different ways of sharing the allocator between threads
+     */
+    enum ConcurrencyMode {
+        // no synchronization at all, the allocator must only be used by one thread at a time
+        SINGLE_THREADED,
+
+        // every thread keeps a magazine of up to magazineSize free blocks
+        // - allocate/free only work on the calling thread's magazine
+        // - the shared free list (guarded by a mutex) is only touched to refill
+        //   an empty magazine or flush a full one, half a magazine at a time
+        // - the blocks of a magazine count as in use on their pages until they are flushed,
+        //   so the fast path leaves the pages alone and spots double frees from the header flag
+        //   (without a header, only frees of blocks already back on the shared free list are caught)
+        THREAD_CACHED,
+
+        // allocate/free go straight to the shared free list without any mutex
+        // - the free list is a lock-free stack whose head carries an ABA tag next to the pointer
+        // - new pages are reserved with an atomic counter that never goes over maxPages
+        //   (or LOCK_FREE_PAGE_LIMIT if maxPages is 0)
+        // - the stats are relaxed atomics, and blocks are aligned to at least a pointer
+        //   so that the free list links can be read atomically
+        LOCK_FREE,
+    };
+
+    /**
+     * Different ways of sizing one page after another
+     */
+    enum PageGrowth {
+        // every page holds objectsPerPage objects
+        FIXED_PAGES,
+
+        // every new page holds twice the objects of the one before it, from objectsPerPage
+        // up to maxObjectsPerPage, so a growing pool needs O(log n) pages instead of O(n)
+        // - the count restarts from the number of pages in use, so pages trimmed away shrink it again
+        GEOMETRIC_PAGES,
+    };
+
     /**
      * Header Block Information
      * - this struct contains information pertaining to different header types
@@ -123,11 +180,18 @@ struct SimpleAllocatorConfig {
      * Constructor
      * @param useCPPMemManager use C++ memory manager (operator new) instead of malloc
      * @param objectsPerPage number of objects per page
-     * @param maxPages maximum number of pages
+     * @param maxPages maximum number of pages (0 means no limit)
      * @param headerBlockInfo header block information
      * @param alignment this refering to the boundary to align to
      * @param padBytes pad bytes
      * @param debug true if debug mode is on
+     * @param concurrency how the allocator is shared between threads
+     * @param magazineSize max free blocks cached per thread (only for THREAD_CACHED)
+     * @param arena true for a monotonic arena (free does nothing, reset recycles all pages)
+     * @param mapPages true to map pages straight from the OS (mmap) instead of operator new
+     * @param autoTrimPages number of empty pages tolerated before they are trimmed automatically (0 = never)
+     * @param pageGrowth how the number of objects per page grows from one page to the next
+     * @param maxObjectsPerPage cap on the objects of a page (only for GEOMETRIC_PAGES)
      */
     SimpleAllocatorConfig(
             bool _useCPPMemManager = false,
@@ -136,7 +200,14 @@ struct SimpleAllocatorConfig {
             const HeaderBlockInfo& headerBlockInfo = HeaderBlockInfo(), 
             unsigned _alignmentBoundary = 0, 
             unsigned _padBytesSize = 0, 
-            bool _isDebug = false) : 
+            bool _isDebug = false,
+            ConcurrencyMode _concurrency = SINGLE_THREADED,
+            unsigned _magazineSize = DEFAULT_MAGAZINE_SIZE,
+            bool _isArena = false,
+            bool _mapPages = false,
+            unsigned _autoTrimPages = 0,
+            PageGrowth _pageGrowth = FIXED_PAGES,
+            unsigned _maxObjectsPerPage = DEFAULT_MAX_OBJECTS_PER_PAGE) : 
         useCPPMemManager(_useCPPMemManager), 
         objectsPerPage(_objectsPerPage), 
         maxPages(_maxPages), 
@@ -145,17 +216,31 @@ struct SimpleAllocatorConfig {
         leftAlignBytesSize(0),
         interAlignBytesSize(0),
         padBytesSize(_padBytesSize), 
-        isDebug(_isDebug){}
+        isDebug(_isDebug),
+        concurrency(_concurrency),
+        magazineSize(_magazineSize),
+        isArena(_isArena),
+        mapPages(_mapPages),
+        autoTrimPages(_autoTrimPages),
+        pageGrowth(_pageGrowth),
+        maxObjectsPerPage(_maxObjectsPerPage){}
 
     bool useCPPMemManager; // Use C++ memory manager (operator new) instead of malloc
-    unsigned objectsPerPage; // Number of objects per page
-    unsigned maxPages; // Maximum number of pages
+    unsigned objectsPerPage; // Number of objects per page (of the first page for GEOMETRIC_PAGES)
+    unsigned maxPages; // Maximum number of pages (0 means no limit)
     HeaderBlockInfo headerBlockInfo; // Header block information
     unsigned alignmentBoundary; // the boundary to align to
     unsigned leftAlignBytesSize; // num bytes in left alignment (computed from alignmentBoundary)
     unsigned interAlignBytesSize; // num bytes in inter alignment (computed from alignmentBoundary)
     unsigned padBytesSize; // num bytes in padding
     bool isDebug; // True if debug mode is on
+    ConcurrencyMode concurrency; // How the allocator is shared between threads
+    unsigned magazineSize; // Max free blocks cached per thread (only for THREAD_CACHED)
+    bool isArena; // True for a monotonic arena (ignored with useCPPMemManager)
+    bool mapPages; // True to map pages with mmap (falls back to operator new where there is no mmap)
+    unsigned autoTrimPages; // Empty pages tolerated before trim() runs by itself (0 = only explicit trims)
+    PageGrowth pageGrowth; // How the number of objects per page grows from one page to the next
+    unsigned maxObjectsPerPage; // Cap on the objects of a page (only for GEOMETRIC_PAGES)
 };
 
 /**
@@ -163,7 +248,7 @@ struct SimpleAllocatorConfig {
  */
 struct MemBlockInfo {
     bool inUse; // True if block is in use
-    char* pLabel; // dynamically allocated NUL-terminated string
+    char* pLabel; // interned NUL-terminated string (owned by the allocator, shared by blocks with the same label)
     unsigned allocNum; // allocation number
 };
 
@@ -183,16 +268,22 @@ struct SimpleAllocatorStats {
         pagesInUse(0), 
         mostObjects(0), 
         allocations(0), 
-        deallocations(0) {}
+        deallocations(0),
+        pagesReclaimed(0),
+        largestPageSize(0),
+        pageBytes(0) {}
 
     size_t objectSize;      // fixed size of each object
-    size_t pageSize;        // fixed size of each page
-    unsigned freeObjects;   // current number of free objects
+    size_t pageSize;        // size of the first page (of every page with FIXED_PAGES)
+    unsigned freeObjects;   // current number of free objects (including the ones cached by threads)
     unsigned objectsInUse; // current number of objects in use
     unsigned pagesInUse; // current number of pages in use
-    unsigned mostObjects; // most objects in use over lifetime
+    unsigned mostObjects; // most objects in use over lifetime (THREAD_CACHED: sampled on every refill/flush)
     unsigned allocations; // total number of allocations over lifetime
     unsigned deallocations; // total number of deallocations over lifetime
+    unsigned pagesReclaimed; // total number of empty pages handed back to the OS over lifetime
+    size_t largestPageSize; // size of the biggest page allocated over lifetime
+    size_t pageBytes; // current total size of the pages in use
 };
 
 /**
@@ -210,6 +301,28 @@ struct Node {
     Node* pNext; // Pointer to next object
 };
 
+/**
+ * Page layout used by the custom (non-CPP mem manager) path
+ * - each page is one contiguous chunk holding objectsPerPage blocks:
+ *
+ *   | page info | in-use bits | left align | header | pad | object | pad | inter align | header | pad | object | pad |
+ *   |           | 1 per block |            |<--------------- block 0 --------------->|<--------- block 1 ------->|
+ *
+ * - the page info starts with the Node that chains the pages together,
+ *   followed by the number of blocks in use on the page (see trim())
+ * - free blocks are chained together through a Node written over the object bytes,
+ *   so allocate/free are just a pop/push on the free list
+ * - every page starts on a power-of-2 boundary at least as big as the page itself,
+ *   so masking any address inside a page gives back the start of that page
+ *   (with GEOMETRIC_PAGES the pages come in several sizes, so the page of an address
+ *   is found by looking up its masked address for every page size in use)
+ * - the page info also records the layout of its page (number of blocks, offset of
+ *   the first one, size), since the bitmap and so the left alignment grow with the page
+ * - with no alignment boundary, the alignment bytes put the objects on the natural
+ *   alignment of their slot instead (whatever the header and pad sizes), so the blocks
+ *   still suit the objects (and the free list links) they hold
+ */
+
 /**
  * The SimpleAllocator class
  */
@@ -245,10 +358,83 @@ public:
 
     /**
      * Free (deallocate) memory
+     * - the block is validated against the page directory in O(1)
+     *   (no matter how many pages there are) before it is taken back
      * @param obj pointer to object to deallocate
+     * @throws SimpleAllocatorException E_BAD_BOUNDARY if the pointer is not the start of a block
+     *         on one of the pages, E_MULTIPLE_FREE if the block is already free,
+     *         E_CORRUPTED_BLOCK if its pad bytes were overwritten (debug only)
      */
     void free(void* pObj);
 
+    /**
+     * Allocate a number of blocks in one go
+     * - the blocks come off the shared free list as one chain (bypassing the
+     *   thread's magazine) and the stats are updated once for the whole batch
+     * @param pOut array that receives the count pointers to allocated memory
+     * @param count number of blocks to allocate
+     * @param pLabel label for every memory block (only for EXTERNAL_HEADER)
+     * @throws SimpleAllocatorException E_NO_PAGE / E_NO_MEMORY if not all of them
+     *         can be allocated, in which case none of them are
+     */
+    void allocateBatch(void** pOut, size_t count, const char* pLabel = 0);
+
+    /**
+     * Free (deallocate) a number of blocks in one go
+     * - every block is validated like in free(), then they all go back
+     *   to the shared free list as one chain and the stats are updated once
+     * - null pointers are skipped
+     * @param pObjects array of pointers to objects to deallocate
+     * @param count number of pointers in the array
+     * @throws SimpleAllocatorException like free(), in which case the blocks before
+     *         the offending one have been freed and the ones after it have not
+     */
+    void freeBatch(void** pObjects, size_t count);
+
+    /**
+     * Hand every block back at once (arena only, does nothing otherwise)
+     * - the pages are kept and recycled by the next allocations, so this is O(pages)
+     *   instead of a free() per object (plus a pass over the blocks handed out
+     *   when there are headers to clear or debug signatures to restore)
+     * - every block still in use counts as deallocated
+     * - any pointer handed out before the reset must not be used afterwards
+     */
+    void reset();
+
+    /**
+     * Hand the pages that are completely free back to the OS
+     * - a page only goes if every one of its blocks is on the shared free list
+     *   (blocks cached in a thread's magazine keep their page alive)
+     * - mapped pages are kept mapped but their memory is dropped with madvise(MADV_DONTNEED),
+     *   so that a later page can reuse the address range without another mmap
+     * - arenas hand back the pages that reset() recycled and nothing has bumped through again
+     * - this walks the shared free list, so it is O(free objects + pages)
+     * - LOCK_FREE allocators never trim (only the owner of a block may follow its link)
+     * @return number of pages handed back
+     */
+    unsigned trim();
+
+    /**
+     * Check the pad bytes of every block on every page in one pass (debug only)
+     * - free() only checks the block being freed, this also catches overruns
+     *   of blocks still in use or sitting on the free list
+     * - the pads are compared 16 or 32 bytes at a time where the compiler targets SSE2/AVX2
+     * - returns nothing if there are no pad bytes or debug mode is off
+     * @return the blocks whose pad bytes were overwritten (the ones free() would
+     *         throw E_CORRUPTED_BLOCK for), in page order
+     */
+    std::vector<void*> validatePages() const;
+
+    /**
+     * Check whether the allocator is a monotonic arena
+     * - in which case free() does nothing and memory only comes back through reset(),
+     *   so clients can skip freeing their objects one by one
+     * @return true if it is an arena
+     */
+    bool isArena() const {
+        return config_.isArena && !config_.useCPPMemManager;
+    }
+
     /**
      * Get the configuration parameters struct
      * @return configuration parameters
@@ -266,10 +452,415 @@ private:
     SimpleAllocator(const SimpleAllocator&) = delete;
     SimpleAllocator& operator=(const SimpleAllocator&) = delete;
 
+    /**
+     * Layout of a page holding a given number of blocks
+     */
+    struct PageLayout {
+        unsigned objects; // number of blocks on the page
+        size_t firstBlockOffset; // offset of the first object from the start of the page
+        size_t size; // size of the page
+        unsigned shift; // log2 of the power-of-2 boundary the page starts on
+    };
+
+    /**
+     * Allocate a new page and thread all its blocks onto the free list
+     * @throws SimpleAllocatorException E_NO_PAGE if maxPages is reached,
+     *         E_NO_MEMORY if operator new fails
+     */
+    void allocatePage();
+
+    /**
+     * Bump allocate the next block of the current arena page (arena only)
+     * @param pLabel label for memory block (only for EXTERNAL_HEADER)
+     * @return pointer to allocated memory
+     */
+    void* allocateArena(const char* pLabel);
+
+    /**
+     * Make a fresh page the current arena page, recycling a page from
+     * before the last reset() if there is one (arena only)
+     * @throws SimpleAllocatorException E_NO_PAGE if maxPages is reached,
+     *         E_NO_MEMORY if operator new fails
+     */
+    void nextArenaPage();
+
+    /**
+     * Trim with the lock held (or on a single threaded allocator), see trim()
+     * @return number of pages handed back
+     */
+    unsigned trimPages();
+
+    /**
+     * Trim if more than autoTrimPages pages are empty (with the lock held)
+     * - pages that the last trim could not hand back (because a magazine still
+     *   holds some of their blocks) do not count towards the limit again
+     */
+    void autoTrim();
+
+    /**
+     * Get memory for a page, from the OS if pages are mapped
+     * @param layout layout of the page
+     * @return start of the page memory, aligned to its power-of-2 boundary
+     * @throws std::bad_alloc if there is no memory
+     */
+    unsigned char* allocatePageMemory(const PageLayout& layout);
+
+    /**
+     * Give the memory of a page back
+     * @param pPage start of the page
+     * @param keepMapping true to drop the memory of a mapped page but keep its address range for reuse
+     */
+    void releasePageMemory(unsigned char* pPage, bool keepMapping);
+
+    /**
+     * Take a page out of the directory, the page list and the stats and hand it back to the OS
+     * @param pPage start of the page (already unlinked from whatever list it was on)
+     */
+    void reclaimPage(unsigned char* pPage);
+
+    /**
+     * Allocate and initialize a new page, without checking the page limit
+     * - the page is registered in the page directory and linked into the page list
+     * - its blocks are chained together in address order, the last one pointing to nullptr
+     * @param objects number of blocks on the page
+     * @return start of the page
+     * @throws SimpleAllocatorException E_NO_MEMORY if operator new fails
+     */
+    unsigned char* createPage(unsigned objects);
+
+    /**
+     * Work out the layout of a page
+     * @param objects number of blocks on the page
+     * @return the layout
+     */
+    PageLayout pageLayout(unsigned objects) const;
+
+    /**
+     * Get the number of blocks for a page, following the growth policy
+     * @param index number of pages in use before this one
+     * @return number of blocks
+     */
+    unsigned nextPageObjects(unsigned index) const;
+
+    /**
+     * Get the first block on a page
+     * @param pPage start of the page
+     * @return the first block
+     */
+    Node* firstBlock(unsigned char* pPage) const;
+
+    /**
+     * Get the last block on a page
+     * @param pPage start of the page
+     * @return the last block
+     */
+    Node* lastBlock(unsigned char* pPage) const;
+
+    /**
+     * Take a chain of blocks off the shared free list for allocateBatch, growing the pool as needed
+     * - the allocations are counted here (and undone by giveBackBlocks if the batch fails)
+     * @param count number of blocks to take
+     * @param firstAllocNum receives the allocation number before the first block's
+     * @return the first block of the chain, the last one pointing to nullptr
+     * @throws SimpleAllocatorException E_NO_PAGE / E_NO_MEMORY if not all of them
+     *         can be taken, in which case none of them are
+     */
+    Node* takeBlocks(size_t count, unsigned& firstAllocNum);
+
+    /**
+     * Put a chain of blocks back onto the shared free list
+     * @param pFirst first block of the chain
+     * @param pLast last block of the chain
+     * @param count number of blocks in the chain
+     * @param cancelled true if the blocks were taken by takeBlocks for a batch that failed
+     *        (undoes their allocations), false if they are being freed (counts deallocations)
+     */
+    void giveBackBlocks(Node* pFirst, Node* pLast, unsigned count, bool cancelled);
+
+    /**
+     * Raise the lock-free high-water mark if the allocations set a new one (LOCK_FREE only)
+     * @param allocations allocation count right after the allocations
+     */
+    void raiseMostObjectsLockFree(unsigned allocations);
+
+    /**
+     * Pop a block off the lock-free free list, growing the pool if it is empty (LOCK_FREE only)
+     * @return the block
+     * @throws SimpleAllocatorException E_NO_PAGE / E_NO_MEMORY if no block can be found
+     */
+    Node* popLockFree();
+
+    /**
+     * Push a chain of blocks onto the lock-free free list (LOCK_FREE only)
+     * @param pFirst first block of the chain
+     * @param pLast last block of the chain
+     */
+    void pushLockFree(Node* pFirst, Node* pLast);
+
+    /**
+     * Reserve a page under the page limit and push its blocks onto the lock-free free list
+     * (LOCK_FREE only)
+     * @throws SimpleAllocatorException E_NO_PAGE / E_NO_MEMORY
+     */
+    void allocatePageLockFree();
+
+    // per-thread magazine of free blocks (THREAD_CACHED only, defined in SimpleAllocator.cpp)
+    struct ThreadCache;
+    // the calling thread's list of magazines, one per allocator (defined in SimpleAllocator.cpp)
+    friend struct ThreadCacheList;
+    // page directory table (defined in SimpleAllocator.cpp)
+    struct PageDirectory;
+    // page info at the start of every page (defined in SimpleAllocator.cpp)
+    struct PageInfo;
+
+    /**
+     * Get the page info of a page
+     * @param pPage start of the page
+     * @return the page info
+     */
+    PageInfo& pageInfo(unsigned char* pPage) const;
+
+    /**
+     * Remove a page from the page directory (by leaving a tombstone in its slot)
+     * @param pPage start of the page
+     */
+    void removeFromDirectory(unsigned char* pPage);
+
+    /**
+     * Allocate straight from the lock-free free list (LOCK_FREE only)
+     * @param pLabel label for memory block (only for EXTERNAL_HEADER)
+     * @return pointer to allocated memory
+     */
+    void* allocateLockFree(const char* pLabel);
+
+    /**
+     * Allocate from the calling thread's magazine (THREAD_CACHED only)
+     * @param pLabel label for memory block (only for EXTERNAL_HEADER)
+     * @return pointer to allocated memory
+     */
+    void* allocateCached(const char* pLabel);
+
+    /**
+     * Free into the calling thread's magazine (THREAD_CACHED only)
+     * @param pBlock validated block to free
+     */
+    void freeCached(unsigned char* pBlock);
+
+    /**
+     * Get the calling thread's magazine for this allocator, creating it on first use
+     * @return the magazine
+     */
+    ThreadCache& getThreadCache();
+
+    /**
+     * Move half a magazine worth of blocks from the shared free list into a magazine
+     * - must be called with lock_ held
+     * @param cache magazine to refill
+     * @throws SimpleAllocatorException if not even one block can be found
+     */
+    void refillMagazine(ThreadCache& cache);
+
+    /**
+     * Move blocks from a magazine back onto the shared free list
+     * - must be called with lock_ held
+     * @param cache magazine to flush
+     * @param count number of blocks to move
+     */
+    void flushMagazine(ThreadCache& cache, unsigned count);
+
+    /**
+     * Hand back a magazine when its thread exits
+     * - all its blocks and stats are folded into the shared ones
+     * @param pCache magazine to release
+     */
+    void releaseThreadCache(ThreadCache* pCache);
+
+    /**
+     * Record the current number of objects in use if it is a new high
+     * - must be called with lock_ held (THREAD_CACHED only)
+     */
+    void sampleMostObjects();
+
+    /**
+     * Check that a pointer is the start of a block that is in use
+     * @param pBlock pointer to check
+     * @return the page the block lies on
+     * @throws SimpleAllocatorException E_BAD_BOUNDARY / E_CORRUPTED_BLOCK
+     */
+    unsigned char* validateBlock(unsigned char* pBlock) const;
+
+    /**
+     * Check the header of a block for whether it is allocated (THREAD_CACHED frees)
+     * - without a header, fall back to the in-use bit of the block on its page
+     * @param pPage page the block lies on
+     * @param pBlock the block
+     * @return true if the block is allocated
+     */
+    bool isAllocated(unsigned char* pPage, const unsigned char* pBlock) const;
+
+    /**
+     * Flip the in-use bit of a block on its page
+     * - and keep the number of blocks in use on the page and the number of
+     *   empty pages up to date (not in LOCK_FREE mode, which never trims)
+     * @param pPage page the block lies on
+     * @param pBlock the block
+     * @param inUse new state
+     * @return previous state
+     */
+    bool setInUse(unsigned char* pPage, const unsigned char* pBlock, bool inUse);
+
+    /**
+     * Get the page a block lies on
+     * - only valid for blocks known to be on one of the pages
+     *   (no directory lookup with FIXED_PAGES, see findPage otherwise)
+     * @param pBlock the block
+     * @return start of the page
+     */
+    unsigned char* pageOf(const void* pBlock) const;
+
+    /**
+     * Look up the page that an address lies on
+     * - a single probe into the page directory keyed by the page-aligned address,
+     *   one per page size in use with GEOMETRIC_PAGES (biggest first, where most blocks are)
+     * @param pAddress any address
+     * @return start of the page holding the address, nullptr if it is not on any page
+     */
+    unsigned char* findPage(const void* pAddress) const;
+
+    /**
+     * Look up a page start in the page directory
+     * @param pStart candidate page start (on the smallest page boundary at least)
+     * @return the page's directory entry (its start with log2 of its boundary in the low bits),
+     *         0 if it is not in the directory
+     */
+    uintptr_t lookupPage(const unsigned char* pStart) const;
+
+    /**
+     * Register a new page in the page directory, growing the directory if needed
+     * @param pPage start of the page
+     * @throws std::bad_alloc if the directory cannot grow
+     */
+    void addToDirectory(unsigned char* pPage);
+
+    /**
+     * Put a page into a free slot of a page directory table
+     * @param pDirectory table to insert into (must have a free slot)
+     * @param pEntry directory entry of the page (see lookupPage)
+     */
+    void insertIntoDirectory(PageDirectory* pDirectory, unsigned char* pEntry);
+
+    /**
+     * Write the header of a block that is being handed out or taken back
+     * @param pBlock pointer to the object bytes of the block
+     * @param allocNum allocation number of the block (0 if it is being freed)
+     * @param pLabel label for the block (only for EXTERNAL_HEADER)
+     * @throws SimpleAllocatorException E_NO_MEMORY if the block info cannot be allocated
+     */
+    void writeHeader(unsigned char* pBlock, unsigned allocNum, const char* pLabel = 0);
+
+    /**
+     * Take a block info off the info slab (EXTERNAL_HEADER only)
+     * - the slab grows by a chunk of objectsPerPage infos when it runs dry
+     * @param allocNum allocation number of the block
+     * @param pLabel label for the block (interned, may be null)
+     * @return the block info, marked in use
+     * @throws SimpleAllocatorException E_NO_MEMORY if the slab or the label cannot grow
+     */
+    MemBlockInfo* acquireBlockInfo(unsigned allocNum, const char* pLabel);
+
+    /**
+     * Put a block info back on the info slab (EXTERNAL_HEADER only)
+     * - its label stays interned for the next block with the same label
+     * @param pInfo the block info
+     */
+    void releaseBlockInfo(MemBlockInfo* pInfo);
+
+    /**
+     * Get the interned copy of a label, copying it into the label arena on first sight
+     * - must be called with infoLock_ held
+     * @param pLabel label
+     * @return the interned label
+     * @throws std::bad_alloc if the label arena cannot grow
+     */
+    char* internLabel(const char* pLabel);
+
+    /**
+     * Check that the pad bytes on both sides of a block are intact
+     * @param pBlock pointer to the object bytes of the block
+     * @throws SimpleAllocatorException E_CORRUPTED_BLOCK if a pad byte was overwritten
+     */
+    void checkPadBytes(const unsigned char* pBlock) const;
+
+    /**
+     * Check the pad bytes on both sides of a block without throwing
+     * @param pBlock pointer to the object bytes of the block
+     * @return true if they are all intact
+     */
+    bool padBytesIntact(const unsigned char* pBlock) const;
+
     // Private stuff
     // - feel free to add your own private stuff
     SimpleAllocatorConfig config_; // Configuration parameters
     SimpleAllocatorStats stats_; // Configuration parameters
+
+    std::atomic<Node*> pageList_; // list of all pages allocated so far
+    Node* freeList_; // list of free blocks across all pages
+    size_t slotSize_; // bytes reserved for the object (at least big enough for a Node)
+    size_t blockStride_; // distance between the objects of two consecutive blocks
+    size_t blockBoundary_; // boundary the objects land on (alignmentBoundary, or the slot's natural one)
+    size_t pageAlignment_; // power-of-2 boundary the first page starts on (>= its size, every page's with FIXED_PAGES)
+    unsigned pageShift_; // log2 of pageAlignment_ (the smallest page boundary)
+    std::atomic<unsigned> maxPageShift_; // log2 of the biggest page boundary so far
+
+    // page directory: open addressed hash table of page starts keyed by (page start >> pageShift_)
+    // - a flat table so that a lookup is a single cache miss on big pools
+    // - published atomically so that threads can look pages up while another one adds a page
+    std::atomic<PageDirectory*> pageDirectory_;
+    unsigned directoryTombstones_; // slots of removed pages in the current table
+
+    // page reclamation
+    // - pages are counted as empty as soon as their last block is freed (THREAD_CACHED: flushed from its magazine)
+    std::atomic<unsigned> emptyPages_; // number of pages without a block in use
+    unsigned trimFloor_; // empty pages the last trim could not hand back
+    size_t osPageSize_; // mapped pages take whole OS pages
+    std::vector<std::pair<unsigned char*, size_t>> releasedPages_; // mapped pages (and their mapped sizes)
+                                                                   // whose memory was dropped, ready for reuse
+
+    // EXTERNAL_HEADER only
+    // - block infos come from a slab of their own and labels are interned in an arena,
+    //   so labelling a block is one pop off the slab instead of two trips to operator new
+    // - both only grow, and are released in one go by the destructor
+    std::mutex infoLock_; // guards the info slab and the labels (unless SINGLE_THREADED)
+    std::vector<MemBlockInfo*> infoChunks_; // chunks of block infos
+    std::vector<MemBlockInfo*> freeInfos_; // block infos not attached to a block
+                                           // (reserved for every info, so pushing back never allocates)
+    std::vector<char*> labelChunks_; // chunks of interned labels
+    size_t labelChunkUsed_; // bytes taken in the last label chunk
+    std::unordered_set<std::string_view> labels_; // interned labels (viewing the label chunks)
+    std::pair<const char*, char*> labelCache_[LABEL_CACHE_SIZE]; // (client label, interned label) by client address
+                                                                 // - checked before hashing, labels tend to be literals
+
+    // arena only
+    // - the current page is the head of the page list, the pages recycled by reset() wait in a list of their own
+    Node* arenaSpare_; // pages handed back by reset() that have not been bumped through again yet
+    unsigned arenaUsed_; // number of blocks handed out from the current page
+
+    // THREAD_CACHED only
+    uint64_t id_; // unique id of the allocator (never reused, unlike its address)
+    mutable std::mutex lock_; // guards the shared free list, the pages, the stats and threadCaches_
+    std::vector<ThreadCache*> threadCaches_; // magazines of all threads using the allocator
+    std::atomic<unsigned> allocNum_; // allocation numbers for the headers (reserved a magazine at a time)
+
+    // LOCK_FREE only
+    // - the free list head is | ABA tag | Node* | packed into 64 bits
+    // - the stats that change on every call are relaxed atomics, each on its own cache line
+    std::atomic<uint64_t> freeHead_;
+    alignas(64) std::atomic<unsigned> sharedAllocations_;
+    alignas(64) std::atomic<unsigned> sharedDeallocations_;
+    alignas(64) std::atomic<unsigned> sharedPagesInUse_;
+    std::atomic<unsigned> sharedMostObjects_;
+    std::atomic<unsigned> sharedCapacity_; // blocks across all pages
+    std::atomic<size_t> sharedPageBytes_; // bytes across all pages
 };
 
 #endif // SIMPLEALLOCATOR_H
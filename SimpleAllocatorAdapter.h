@@ -0,0 +1,164 @@
+/**
+ * @file SimpleAllocatorAdapter.h
+ * @brief SimpleAllocatorAdapter class template definition
+ *        A standard Allocator that hands out SimpleAllocator blocks,
+ *        so that std::map, std::set, std::list etc. can share the pools of the AVL trees
+ */
+
+#ifndef SIMPLEALLOCATORADAPTER_H
+#define SIMPLEALLOCATORADAPTER_H
+#include "SizeClassAllocator.h"
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+/**
+ * The SimpleAllocatorAdapter class template
+ * - single objects (what node based containers ask for) come from the size class
+ *   of sizeof(T) in a SizeClassAllocator
+ * - arrays, objects bigger than the biggest size class and objects aligned beyond
+ *   what their size class guarantees go to operator new instead, which deallocate()
+ *   can tell from the same n and T
+ * - rebinding keeps the pool, so the container's nodes land in the pool whatever
+ *   type they are rebound to, and two adapters are equal if they share a pool
+ * - the pool follows the container on copy/move assignment and swap,
+ *   since memory has to go back to the pool it came from
+ * @tparam T value type
+ */
+template <typename T>
+class SimpleAllocatorAdapter {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    /**
+     * Rebind to another value type (with the same pool)
+     * @tparam U value type
+     */
+    template <typename U>
+    struct rebind {
+        using other = SimpleAllocatorAdapter<U>;
+    };
+
+    /**
+     * Default constructor, using the process wide default pool
+     */
+    SimpleAllocatorAdapter() noexcept : pPool_(&defaultPool()) {}
+
+    /**
+     * Constructor
+     * @param pool pool to allocate from (must outlive every container using it)
+     */
+    explicit SimpleAllocatorAdapter(SizeClassAllocator& pool) noexcept : pPool_(&pool) {}
+
+    /**
+     * Converting constructor (rebind)
+     * @tparam U value type of the other adapter
+     * @param rhs adapter whose pool to use
+     */
+    template <typename U>
+    SimpleAllocatorAdapter(const SimpleAllocatorAdapter<U>& rhs) noexcept : pPool_(&rhs.pool()) {}
+
+    /**
+     * Allocate memory for a number of objects
+     * @param n number of objects
+     * @return pointer to the memory
+     * @throws std::bad_alloc if the memory cannot be allocated
+     */
+    T* allocate(size_t n) {
+        if (!isPooled(n))
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+
+        // standard containers expect bad_alloc rather than the pool's exceptions
+        try {
+            return static_cast<T*>(pPool_->allocate(sizeof(T)));
+        } catch (const SimpleAllocatorException&) {
+            throw std::bad_alloc();
+        }
+    }
+
+    /**
+     * Deallocate memory from allocate()
+     * - the pool throws on a bad free (double free, corrupted pads), which cannot leave
+     *   a noexcept deallocate: it ends the program through std::terminate instead, much
+     *   like a double delete would, rather than carry on with a damaged pool
+     * @param p pointer to the memory
+     * @param n number of objects passed to allocate()
+     */
+    void deallocate(T* p, size_t n) noexcept {
+        if (!isPooled(n)) {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+            return;
+        }
+        pPool_->free(p, sizeof(T));
+    }
+
+    /**
+     * Get the pool
+     * @return the pool
+     */
+    SizeClassAllocator& pool() const noexcept {
+        return *pPool_;
+    }
+
+    /**
+     * Get the process wide default pool
+     * - one pool shared by threads (THREAD_CACHED), each class aligned for objects of its size
+     * - never destroyed, so that containers with static storage can still free into it
+     * @return the pool
+     */
+    static SizeClassAllocator& defaultPool() {
+        static SizeClassAllocator* pPool = new SizeClassAllocator(SimpleAllocatorConfig(
+            false, 64, 0, SimpleAllocatorConfig::HeaderBlockInfo(), 0, 0, false,
+            SimpleAllocatorConfig::THREAD_CACHED));
+        return *pPool;
+    }
+
+private:
+    /**
+     * Check whether a request is served by the pool
+     * - every block of a class has the class alignment (known at compile time), and more
+     *   when the configured boundary is a bigger power of 2: the lowest set bit of the class boundary
+     * @param n number of objects
+     * @return true for a single object that fits a size class with the alignment the class guarantees
+     */
+    bool isPooled(size_t n) const noexcept {
+        if (n != 1 || sizeof(T) > SIZE_CLASS_MAX_SIZE)
+            return false;
+        const size_t sizeClass = SizeClassAllocator::sizeClassOf(sizeof(T));
+        if (alignof(T) <= SizeClassAllocator::classAlignment(sizeClass))
+            return true;
+        const size_t boundary = pPool_->classBoundary(sizeClass);
+        return alignof(T) <= (boundary & (~boundary + 1));
+    }
+
+    SizeClassAllocator* pPool_; // the pool (never null)
+};
+
+/**
+ * Check whether two adapters allocate from the same pool
+ * - memory from one can then be deallocated by the other
+ * @param lhs first adapter
+ * @param rhs second adapter
+ * @return true if they share a pool
+ */
+template <typename T, typename U>
+bool operator==(const SimpleAllocatorAdapter<T>& lhs, const SimpleAllocatorAdapter<U>& rhs) noexcept {
+    return &lhs.pool() == &rhs.pool();
+}
+
+/**
+ * Check whether two adapters allocate from different pools
+ * @param lhs first adapter
+ * @param rhs second adapter
+ * @return true if they do not share a pool
+ */
+template <typename T, typename U>
+bool operator!=(const SimpleAllocatorAdapter<T>& lhs, const SimpleAllocatorAdapter<U>& rhs) noexcept {
+    return !(lhs == rhs);
+}
+
+#endif // SIMPLEALLOCATORADAPTER_H
@@ -0,0 +1,121 @@
+/**
+ * @file SizeClassAllocator.cpp
+ * @brief Implementation of the SizeClassAllocator class.
+ */
+
+#include "SizeClassAllocator.h"
+#include <algorithm>
+#include <new>
+
+SizeClassAllocator::SizeClassAllocator(const SimpleAllocatorConfig& config) : config_(config) {
+    for (std::atomic<SimpleAllocator*>& allocator : allocators_)
+        allocator.store(nullptr, std::memory_order_relaxed);
+}
+
+SizeClassAllocator::~SizeClassAllocator() {
+    for (std::atomic<SimpleAllocator*>& allocator : allocators_)
+        delete allocator.load();
+}
+
+void* SizeClassAllocator::allocate(size_t size, const char* pLabel) {
+    checkSize(size);
+    return classAllocator(sizeClassOf(size)).allocate(pLabel);
+}
+
+void SizeClassAllocator::free(void* pObject, size_t size) {
+    checkSize(size);
+
+    // a class that was never used cannot own the block
+    SimpleAllocator* pAllocator = allocators_[sizeClassOf(size)].load(std::memory_order_acquire);
+    if (!pAllocator) {
+        if (!pObject)
+            return;
+        throw SimpleAllocatorException(SimpleAllocatorException::E_BAD_BOUNDARY,
+                                       "free: Block address is not on any page.");
+    }
+    pAllocator->free(pObject);
+}
+
+SimpleAllocator& SizeClassAllocator::allocatorFor(size_t size) {
+    checkSize(size);
+    return classAllocator(sizeClassOf(size));
+}
+
+unsigned SizeClassAllocator::trim() {
+    unsigned reclaimed = 0;
+    for (std::atomic<SimpleAllocator*>& allocator : allocators_) {
+        SimpleAllocator* pAllocator = allocator.load(std::memory_order_acquire);
+        if (pAllocator)
+            reclaimed += pAllocator->trim();
+    }
+    return reclaimed;
+}
+
+SimpleAllocatorStats SizeClassAllocator::getStats() const {
+    SimpleAllocatorStats stats;
+    for (const std::atomic<SimpleAllocator*>& allocator : allocators_) {
+        const SimpleAllocator* pAllocator = allocator.load(std::memory_order_acquire);
+        if (!pAllocator)
+            continue;
+
+        const SimpleAllocatorStats classStats = pAllocator->getStats();
+        stats.freeObjects += classStats.freeObjects;
+        stats.objectsInUse += classStats.objectsInUse;
+        stats.pagesInUse += classStats.pagesInUse;
+        stats.mostObjects += classStats.mostObjects;
+        stats.allocations += classStats.allocations;
+        stats.deallocations += classStats.deallocations;
+        stats.pagesReclaimed += classStats.pagesReclaimed;
+        stats.largestPageSize = std::max(stats.largestPageSize, classStats.largestPageSize);
+        stats.pageBytes += classStats.pageBytes;
+    }
+    return stats;
+}
+
+SimpleAllocatorStats SizeClassAllocator::getClassStats(size_t sizeClass) const {
+    const SimpleAllocator* pAllocator = allocators_[sizeClass].load(std::memory_order_acquire);
+    if (pAllocator)
+        return pAllocator->getStats();
+
+    SimpleAllocatorStats stats;
+    stats.objectSize = classSize(sizeClass);
+    return stats;
+}
+
+size_t SizeClassAllocator::classBoundary(size_t sizeClass) const {
+    // doubling a boundary adds a factor of 2 until it is a multiple of the class alignment
+    size_t boundary = std::max<size_t>(config_.alignmentBoundary, 1);
+    while (boundary % classAlignment(sizeClass))
+        boundary *= 2;
+    return boundary;
+}
+
+SimpleAllocator& SizeClassAllocator::classAllocator(size_t sizeClass) {
+    SimpleAllocator* pAllocator = allocators_[sizeClass].load(std::memory_order_acquire);
+    if (pAllocator)
+        return *pAllocator;
+
+    // a class serves any object of its size, so its blocks are aligned for the strictest one
+    SimpleAllocatorConfig classConfig = config_;
+    classConfig.alignmentBoundary = static_cast<unsigned>(classBoundary(sizeClass));
+
+    // publish a new allocator unless another thread got there first
+    SimpleAllocator* pCreated = nullptr;
+    try {
+        pCreated = new SimpleAllocator(classSize(sizeClass), classConfig);
+    } catch (const std::bad_alloc&) {
+        throw SimpleAllocatorException(SimpleAllocatorException::E_NO_MEMORY,
+                                       "sizeClass: No system memory available.");
+    }
+    if (allocators_[sizeClass].compare_exchange_strong(pAllocator, pCreated, std::memory_order_acq_rel,
+                                                       std::memory_order_acquire))
+        return *pCreated;
+    delete pCreated;
+    return *pAllocator;
+}
+
+void SizeClassAllocator::checkSize(size_t size) {
+    if (size > SIZE_CLASS_MAX_SIZE)
+        throw SimpleAllocatorException(SimpleAllocatorException::E_BAD_SIZE,
+                                       "sizeClass: Object size is bigger than the biggest size class.");
+}
@@ -0,0 +1,202 @@
+/**
+ * @file SizeClassAllocator.h
+ * @brief SizeClassAllocator class definition
+ *        A front-end that serves objects of many sizes out of one SimpleAllocator
+ *        per size class, so that one pool can back every node type of a process
+ */
+
+#ifndef SIZECLASSALLOCATOR_H
+#define SIZECLASSALLOCATOR_H
+#include "SimpleAllocator.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+// Size classes
+// - 8 byte steps up to 128 bytes, then 4 classes per doubling up to SIZE_CLASS_MAX_SIZE,
+//   so rounding up to a class wastes at most 7 bytes or a fifth of the object
+static const size_t SIZE_CLASS_GRANULE = 8;
+static const size_t SIZE_CLASS_MAX_SIZE = 1024;
+static const size_t SIZE_CLASS_COUNT = 28;
+
+/**
+ * Lookup table from an object size to its size class
+ */
+struct SizeClassTable {
+    unsigned char classOf[SIZE_CLASS_MAX_SIZE / SIZE_CLASS_GRANULE + 1]; // size class by size in granules (rounded up)
+    size_t classSize[SIZE_CLASS_COUNT]; // object size of every size class
+};
+
+/**
+ * Build the size class table (at compile time)
+ * @return the table
+ */
+constexpr SizeClassTable makeSizeClassTable() {
+    SizeClassTable table{};
+    size_t count = 0;
+    for (size_t size = SIZE_CLASS_GRANULE; size <= 128; size += SIZE_CLASS_GRANULE)
+        table.classSize[count++] = size;
+    for (size_t base = 128; base < SIZE_CLASS_MAX_SIZE; base *= 2) {
+        for (size_t step = 1; step <= 4; ++step)
+            table.classSize[count++] = base + step * base / 4;
+    }
+
+    // every size goes to the smallest class that holds it
+    size_t sizeClass = 0;
+    for (size_t granules = 0; granules <= SIZE_CLASS_MAX_SIZE / SIZE_CLASS_GRANULE; ++granules) {
+        while (table.classSize[sizeClass] < granules * SIZE_CLASS_GRANULE)
+            ++sizeClass;
+        table.classOf[granules] = static_cast<unsigned char>(sizeClass);
+    }
+    return table;
+}
+
+static constexpr SizeClassTable SIZE_CLASS_TABLE = makeSizeClassTable();
+static_assert(SIZE_CLASS_TABLE.classSize[SIZE_CLASS_COUNT - 1] == SIZE_CLASS_MAX_SIZE,
+              "the last size class must be SIZE_CLASS_MAX_SIZE");
+
+/**
+ * The SizeClassAllocator class
+ * - owns one SimpleAllocator per size class, all with the same configuration
+ *   (objectsPerPage, maxPages and the rest apply to every class on its own)
+ * - but the alignment boundary of a class is raised to a multiple of the largest power
+ *   of 2 dividing its size (up to max_align_t), so a block suits any object that needs the class
+ * - a class's allocator is only created the first time a size in the class is used
+ * - the caller passes the size back to free(), like a sized delete, so that
+ *   the block goes straight to its class
+ */
+class SizeClassAllocator {
+public:
+    /**
+     * Constructor
+     * @param config configuration of every size class allocator
+     */
+    explicit SizeClassAllocator(const SimpleAllocatorConfig& config);
+
+    /**
+     * Destructor
+     * (never throws)
+     */
+    ~SizeClassAllocator();
+
+    /**
+     * Allocate memory from the size class of a size
+     * @param size object size (at most SIZE_CLASS_MAX_SIZE)
+     * @param pLabel label for memory block (only for EXTERNAL_HEADER)
+     * @return pointer to allocated memory
+     * @throws SimpleAllocatorException E_BAD_SIZE if the size is bigger than the biggest class,
+     *         or whatever the class allocator throws
+     */
+    void* allocate(size_t size, const char* pLabel = 0);
+
+    /**
+     * Free (deallocate) memory back to the size class of a size
+     * @param pObject pointer to object to deallocate
+     * @param size object size passed to allocate()
+     * @throws SimpleAllocatorException E_BAD_SIZE if the size is bigger than the biggest class,
+     *         or whatever the class allocator throws (E_BAD_BOUNDARY for a wrong size)
+     */
+    void free(void* pObject, size_t size);
+
+    /**
+     * Get the allocator of the size class of a size
+     * - to hand to clients that take a SimpleAllocator, e.g. an AVL tree:
+     *   trees of different node types in the same class then share their pages
+     * @param size object size (at most SIZE_CLASS_MAX_SIZE)
+     * @return the class allocator
+     * @throws SimpleAllocatorException E_BAD_SIZE if the size is bigger than the biggest class
+     */
+    SimpleAllocator& allocatorFor(size_t size);
+
+    /**
+     * Hand the completely free pages of every size class back to the OS (see SimpleAllocator::trim)
+     * @return number of pages handed back
+     */
+    unsigned trim();
+
+    /**
+     * Get the size class of a size in O(1)
+     * @param size object size (at most SIZE_CLASS_MAX_SIZE)
+     * @return size class
+     */
+    static constexpr size_t sizeClassOf(size_t size) {
+        return SIZE_CLASS_TABLE.classOf[(size + SIZE_CLASS_GRANULE - 1) / SIZE_CLASS_GRANULE];
+    }
+
+    /**
+     * Get the object size of a size class
+     * @param sizeClass size class
+     * @return biggest object size in the class
+     */
+    static constexpr size_t classSize(size_t sizeClass) {
+        return SIZE_CLASS_TABLE.classSize[sizeClass];
+    }
+
+    /**
+     * Get the alignment the blocks of a size class are guaranteed to have
+     * - the largest power of 2 dividing the class size (up to max_align_t),
+     *   so a block suits any object whose size is in the class
+     * @param sizeClass size class
+     * @return alignment in bytes
+     */
+    static constexpr size_t classAlignment(size_t sizeClass) {
+        return std::min(classSize(sizeClass) & (~classSize(sizeClass) + 1), alignof(std::max_align_t));
+    }
+
+    /**
+     * Get the configuration of the size class allocators
+     * @return configuration parameters
+     */
+    const SimpleAllocatorConfig& getConfig() const {
+        return config_;
+    }
+
+    /**
+     * Get the alignment boundary the allocator of a size class uses
+     * - the configured boundary, doubled until the class alignment divides it,
+     *   so the blocks keep the class alignment whatever boundary was configured
+     * @param sizeClass size class
+     * @return boundary in bytes
+     */
+    size_t classBoundary(size_t sizeClass) const;
+
+    /**
+     * Get the combined statistics of all size classes
+     * - objectSize and pageSize are 0 since the classes differ
+     * - mostObjects adds up the peaks of the classes, which need not have happened together
+     * @return statistics
+     */
+    SimpleAllocatorStats getStats() const;
+
+    /**
+     * Get the statistics of one size class
+     * @param sizeClass size class
+     * @return statistics (all zero but the object size if the class was never used)
+     */
+    SimpleAllocatorStats getClassStats(size_t sizeClass) const;
+
+private:
+    // Disable copy constructor and assignment operator
+    SizeClassAllocator(const SizeClassAllocator&) = delete;
+    SizeClassAllocator& operator=(const SizeClassAllocator&) = delete;
+
+    /**
+     * Get the allocator of a size class, creating it on first use
+     * - racing threads may both create one, only the first one published is kept
+     * @param sizeClass size class
+     * @return the class allocator
+     */
+    SimpleAllocator& classAllocator(size_t sizeClass);
+
+    /**
+     * Check that a size has a size class
+     * @param size object size
+     * @throws SimpleAllocatorException E_BAD_SIZE if it is bigger than the biggest class
+     */
+    static void checkSize(size_t size);
+
+    SimpleAllocatorConfig config_; // configuration of every size class allocator
+    std::atomic<SimpleAllocator*> allocators_[SIZE_CLASS_COUNT]; // allocator per size class, nullptr until used
+};
+
+#endif // SIZECLASSALLOCATOR_H
@@ -0,0 +1,1343 @@
+/**
+ * @file bench.cpp
+ * @brief Benchmarks for the SimpleAllocator.
+ *        Unlike test.cpp, the outputs here are timings that differ from
+ *        machine to machine, so there are no expected outputs to compare against.
+ *        Run all of them with `make bench`, or a single one with `./bench-app <bench-number>`.
+ */
+
+#include "AVL.h"
+#include "CompactAVL.h"
+#include "DurableAVL.h"
+#include "FrozenAVL.h"
+#include "PersistentAVL.h"
+#include "SimpleAllocator.h"
+#include "SimpleAllocatorAdapter.h"
+#include "SizeClassAllocator.h"
+#include "prng.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using std::cout;
+using std::endl;
+
+/**
+ * @brief Helper function to get the time elapsed since a starting point
+ * @param start starting point
+ * @return elapsed time in nanoseconds
+ */
+static double elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Helper function to shuffle a vector of pointers with the repo's prng
+ * @param ptrs pointers to shuffle
+ */
+static void shufflePtrs(std::vector<void*>& ptrs) {
+    Utils::srand(8, 3);
+    for (size_t i = ptrs.size(); i > 1; --i) {
+        size_t j = static_cast<size_t>(Utils::randInt(0, static_cast<int>(i) - 1));
+        std::swap(ptrs[i - 1], ptrs[j]);
+    }
+}
+
+/**
+ * @brief Measure the free() latency as the number of pages grows
+ *        - every free is validated against the page directory,
+ *          so the latency should stay flat no matter how many pages there are
+ *        - the total number of objects is fixed so that only the page count
+ *          changes and not the amount of memory the frees touch
+ *        - the blocks are freed in random order so that consecutive frees
+ *          land on different pages
+ */
+static void benchFreeLatency() {
+    cout << "=== free() latency vs maxPages (validated, random order) ===" << endl;
+
+    const unsigned totalObjects = 1u << 18;
+    for (unsigned maxPages : {16u, 256u, 4096u, 16384u, 65536u}) {
+        const unsigned objectsPerPage = totalObjects / maxPages;
+        SimpleAllocatorConfig config(false, objectsPerPage, maxPages);
+        SimpleAllocator allocator(48, config);
+
+        // fill every page
+        std::vector<void*> ptrs(size_t(objectsPerPage) * maxPages);
+        for (void*& p : ptrs)
+            p = allocator.allocate();
+        shufflePtrs(ptrs);
+
+        // time just touching every block in the same order first
+        // - this is the cache miss cost that any free has to pay on big pools
+        auto start = std::chrono::steady_clock::now();
+        for (void* p : ptrs)
+            *static_cast<volatile char*>(p) = 0;
+        double touchNs = elapsedNs(start);
+
+        // time freeing all of them
+        shufflePtrs(ptrs);
+        start = std::chrono::steady_clock::now();
+        for (void* p : ptrs)
+            allocator.free(p);
+        double freeNs = elapsedNs(start);
+
+        cout << "  maxPages: " << std::setw(6) << maxPages
+             << ", frees: " << std::setw(8) << ptrs.size() << std::fixed << std::setprecision(1)
+             << ", ns/free: " << std::setw(6) << freeNs / ptrs.size()
+             << ", ns/touch: " << std::setw(6) << touchNs / ptrs.size()
+             << ", ns/free over touch: " << std::setw(6) << (freeNs - touchNs) / ptrs.size() << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Run a node churn workload on a number of threads sharing one allocator
+ *        - every thread keeps a small window of live objects, allocating and freeing
+ *          in a pattern similar to inserting into and removing from a tree
+ * @param threads number of threads
+ * @param opsPerThread number of allocate/free pairs per thread
+ * @param allocate function to allocate one object
+ * @param deallocate function to free one object
+ * @return throughput in millions of allocate/free pairs per second
+ */
+template <typename Allocate, typename Deallocate>
+static double churn(unsigned threads, unsigned opsPerThread, Allocate allocate, Deallocate deallocate) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            const unsigned window = 256;
+            std::vector<void*> live(window, nullptr);
+            for (unsigned i = 0; i < opsPerThread; ++i) {
+                void*& slot = live[(i * 7) % window];
+                if (slot)
+                    deallocate(slot);
+                slot = allocate();
+            }
+            for (void* p : live)
+                deallocate(p);
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    return threads * double(opsPerThread) / elapsedNs(start) * 1000.0;
+}
+
+/**
+ * @brief Compare the allocation throughput of THREAD_CACHED and LOCK_FREE allocators
+ *        against a SINGLE_THREADED one guarded by a mutex as the thread count grows
+ *        - the thread cached one should scale with the cores,
+ *          the mutex guarded one serializes every call
+ *        - the lock-free one never blocks but all threads contend on one head
+ */
+static void benchThreadCache() {
+    cout << "=== Mops/s (allocate + free pairs) vs threads, shared allocator ===" << endl;
+
+    const unsigned opsPerThread = 1u << 20;
+    const unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        // baseline: one big lock around the allocator
+        SimpleAllocator locked(48, SimpleAllocatorConfig(false, 256, 0));
+        std::mutex lock;
+        double lockedMops = churn(threads, opsPerThread,
+            [&]() { std::lock_guard<std::mutex> guard(lock); return locked.allocate(); },
+            [&](void* p) { std::lock_guard<std::mutex> guard(lock); locked.free(p); });
+
+        // per-thread magazines in front of the shared free list
+        SimpleAllocatorConfig config(false, 256, 0);
+        config.concurrency = SimpleAllocatorConfig::THREAD_CACHED;
+        SimpleAllocator cached(48, config);
+        double cachedMops = churn(threads, opsPerThread,
+            [&]() { return cached.allocate(); },
+            [&](void* p) { cached.free(p); });
+
+        // no lock at all, every call swaps the shared free list head
+        config.concurrency = SimpleAllocatorConfig::LOCK_FREE;
+        SimpleAllocator lockFree(48, config);
+        double lockFreeMops = churn(threads, opsPerThread,
+            [&]() { return lockFree.allocate(); },
+            [&](void* p) { lockFree.free(p); });
+
+        cout << "  threads: " << std::setw(3) << threads << std::fixed << std::setprecision(1)
+             << ", mutex: " << std::setw(7) << lockedMops
+             << ", thread cached: " << std::setw(7) << cachedMops
+             << ", lock-free: " << std::setw(7) << lockFreeMops << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare allocating and freeing in batches against one call per object
+ *        - the batch calls take/give back a whole chain and update the stats once,
+ *          which matters most when every call has to take the lock
+ */
+static void benchBatch() {
+    cout << "=== ns/object (allocate + free), one by one vs allocateBatch/freeBatch ===" << endl;
+
+    const unsigned rounds = 1u << 12;
+    const char* modeNames[] = {"single", "thread cached", "lock-free"};
+    for (SimpleAllocatorConfig::ConcurrencyMode mode : {SimpleAllocatorConfig::SINGLE_THREADED,
+                                                        SimpleAllocatorConfig::THREAD_CACHED,
+                                                        SimpleAllocatorConfig::LOCK_FREE}) {
+        for (unsigned batch : {16u, 256u}) {
+            SimpleAllocatorConfig config(false, 256, 0);
+            config.concurrency = mode;
+            SimpleAllocator allocator(48, config);
+            std::vector<void*> ptrs(batch);
+
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned r = 0; r < rounds; ++r) {
+                for (void*& p : ptrs)
+                    p = allocator.allocate();
+                for (void* p : ptrs)
+                    allocator.free(p);
+            }
+            double singleNs = elapsedNs(start);
+
+            start = std::chrono::steady_clock::now();
+            for (unsigned r = 0; r < rounds; ++r) {
+                allocator.allocateBatch(ptrs.data(), batch);
+                allocator.freeBatch(ptrs.data(), batch);
+            }
+            double batchNs = elapsedNs(start);
+
+            const double objects = double(rounds) * batch;
+            cout << "  mode: " << std::setw(13) << modeNames[mode] << ", batch: " << std::setw(4) << batch
+                 << std::fixed << std::setprecision(1)
+                 << ", one by one: " << std::setw(6) << singleNs / objects
+                 << ", batched: " << std::setw(6) << batchNs / objects << endl;
+        }
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare fixed and geometric page growth while a pool fills up
+ *        - geometric pages need O(log n) page allocations instead of O(n),
+ *          at the cost of one directory probe per page size in free()
+ */
+static void benchPageGrowth() {
+    cout << "=== pages, ns/allocate and ns/free (random order) filling a pool, FIXED_PAGES vs GEOMETRIC_PAGES ===" << endl;
+
+    const char* growthNames[] = {"fixed", "geometric"};
+    for (unsigned objects : {1u << 12, 1u << 16, 1u << 20}) {
+        for (SimpleAllocatorConfig::PageGrowth growth : {SimpleAllocatorConfig::FIXED_PAGES,
+                                                         SimpleAllocatorConfig::GEOMETRIC_PAGES}) {
+            SimpleAllocatorConfig config(false, 16, 0);
+            config.pageGrowth = growth;
+            config.maxObjectsPerPage = 1u << 14;
+            SimpleAllocator allocator(48, config);
+            std::vector<void*> ptrs(objects);
+
+            auto start = std::chrono::steady_clock::now();
+            for (void*& p : ptrs)
+                p = allocator.allocate();
+            double allocateNs = elapsedNs(start);
+            const unsigned pages = allocator.getStats().pagesInUse;
+
+            shufflePtrs(ptrs);
+            start = std::chrono::steady_clock::now();
+            for (void* p : ptrs)
+                allocator.free(p);
+            double freeNs = elapsedNs(start);
+
+            cout << "  objects: " << std::setw(8) << objects << ", growth: " << std::setw(9) << growthNames[growth]
+                 << ", pages: " << std::setw(6) << pages << std::fixed << std::setprecision(1)
+                 << ", ns/allocate: " << std::setw(6) << allocateNs / objects
+                 << ", ns/free: " << std::setw(6) << freeNs / objects << endl;
+        }
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare allocating objects of mixed sizes from a SizeClassAllocator
+ *        against one SimpleAllocator per object size picked by hand
+ *        - the size class lookup is a table read, so routing should cost next to nothing
+ */
+static void benchSizeClasses() {
+    cout << "=== ns/object (allocate + free) for mixed sizes, one allocator per size vs size classes ===" << endl;
+
+    const size_t sizes[] = {24, 40, 56, 96};
+    const unsigned objects = 1u << 16;
+    const unsigned rounds = 16;
+    std::vector<void*> ptrs(objects);
+
+    SimpleAllocatorConfig config(false, 256, 0);
+    SimpleAllocator perSize[] = {{sizes[0], config}, {sizes[1], config}, {sizes[2], config}, {sizes[3], config}};
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; ++r) {
+        for (unsigned i = 0; i < objects; ++i)
+            ptrs[i] = perSize[i % 4].allocate();
+        for (unsigned i = 0; i < objects; ++i)
+            perSize[i % 4].free(ptrs[i]);
+    }
+    double perSizeNs = elapsedNs(start);
+
+    SizeClassAllocator pool(config);
+    start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; ++r) {
+        for (unsigned i = 0; i < objects; ++i)
+            ptrs[i] = pool.allocate(sizes[i % 4]);
+        for (unsigned i = 0; i < objects; ++i)
+            pool.free(ptrs[i], sizes[i % 4]);
+    }
+    double poolNs = elapsedNs(start);
+
+    const double total = double(rounds) * objects;
+    cout << std::fixed << std::setprecision(1) << "  per size: " << std::setw(6) << perSizeNs / total
+         << ", size classes: " << std::setw(6) << poolNs / total << endl << endl;
+}
+
+/**
+ * @brief Run a std::set<int> workload: insert random keys, look every one up, erase them all
+ * @tparam Set set type
+ * @param set empty set to fill
+ * @param keys keys to insert
+ * @return time taken in nanoseconds
+ */
+template <typename Set>
+static double setWorkload(Set& set, const std::vector<int>& keys) {
+    auto start = std::chrono::steady_clock::now();
+    for (int key : keys)
+        set.insert(key);
+    size_t found = 0;
+    for (int key : keys)
+        found += set.count(key);
+    for (int key : keys)
+        set.erase(key);
+    double ns = elapsedNs(start);
+    if (found != keys.size() || !set.empty())
+        cout << "  set workload went wrong" << endl;
+    return ns;
+}
+
+/**
+ * @brief Compare std::set<int> with the default allocator against SimpleAllocatorAdapter
+ *        - on a pool of its own (single threaded) and on the process wide default pool (thread cached)
+ */
+static void benchSetAdapter() {
+    cout << "=== ns/key (insert + find + erase), std::set<int> default allocator vs SimpleAllocatorAdapter ===" << endl;
+
+    for (int keyCount : {1 << 10, 1 << 16, 1 << 20}) {
+        std::vector<int> keys(keyCount);
+        Utils::srand(8, 3);
+        for (int& key : keys)
+            key = Utils::randInt(0, keyCount * 4);
+
+        std::set<int> heapSet;
+        double heapNs = setWorkload(heapSet, keys);
+
+        SizeClassAllocator pool(SimpleAllocatorConfig(false, 1024, 0));
+        std::set<int, std::less<int>, SimpleAllocatorAdapter<int>> pooledSet{SimpleAllocatorAdapter<int>(pool)};
+        double pooledNs = setWorkload(pooledSet, keys);
+
+        std::set<int, std::less<int>, SimpleAllocatorAdapter<int>> defaultPoolSet;
+        double defaultPoolNs = setWorkload(defaultPoolSet, keys);
+
+        cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1)
+             << ", default allocator: " << std::setw(6) << heapNs / keyCount
+             << ", own pool: " << std::setw(6) << pooledNs / keyCount
+             << ", default pool: " << std::setw(6) << defaultPoolNs / keyCount << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Measure the cost of the debug-mode pad checks
+ *        - allocate + free with and without debug mode (pads checked on every free)
+ *        - and one validatePages() sweep over every block
+ */
+static void benchPadChecks() {
+    cout << "=== debug-mode pad checks: ns/object (allocate + free) and ns/block (validatePages) ===" << endl;
+
+    const unsigned objects = 1u << 16;
+    std::vector<void*> ptrs(objects);
+    for (unsigned padSize : {8u, 32u, 128u}) {
+        double ns[2];
+        double sweepNs = 0;
+        for (bool debug : {false, true}) {
+            SimpleAllocatorConfig config(false, 256, 0, SimpleAllocatorConfig::HeaderBlockInfo(), 0, padSize, debug);
+            SimpleAllocator allocator(48, config);
+
+            // the first round only creates the pages
+            std::chrono::steady_clock::time_point start;
+            for (int round = 0; round < 2; ++round) {
+                start = std::chrono::steady_clock::now();
+                for (void*& p : ptrs)
+                    p = allocator.allocate();
+                for (void* p : ptrs)
+                    allocator.free(p);
+            }
+            ns[debug] = elapsedNs(start);
+
+            start = std::chrono::steady_clock::now();
+            if (!allocator.validatePages().empty())
+                cout << "  unexpected corrupted blocks" << endl;
+            sweepNs = elapsedNs(start);
+        }
+
+        cout << "  pad bytes: " << std::setw(4) << padSize << std::fixed << std::setprecision(1)
+             << ", no debug: " << std::setw(6) << ns[0] / objects
+             << ", debug: " << std::setw(6) << ns[1] / objects
+             << ", validatePages: " << std::setw(6) << sweepNs / objects << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Measure the cost of the headers
+ *        - allocate + free of a block without a header, with a basic header,
+ *          and with an external header without and with a label (a few labels repeating)
+ */
+static void benchExternalHeaders() {
+    cout << "=== external headers: ns/object (allocate + free) ===" << endl;
+
+    const unsigned objects = 1u << 16;
+    const char* labels[] = {"node", "leaf", "root", "scratch"};
+    std::vector<void*> ptrs(objects);
+    for (SimpleAllocatorConfig::ConcurrencyMode mode :
+         {SimpleAllocatorConfig::SINGLE_THREADED, SimpleAllocatorConfig::THREAD_CACHED}) {
+        double ns[4];
+        const SimpleAllocatorConfig::HeaderType types[] = {
+            SimpleAllocatorConfig::NO_HEADER, SimpleAllocatorConfig::BASIC_HEADER,
+            SimpleAllocatorConfig::EXTERNAL_HEADER, SimpleAllocatorConfig::EXTERNAL_HEADER};
+        for (int kind = 0; kind < 4; ++kind) {
+            SimpleAllocatorConfig config(false, 256, 0, SimpleAllocatorConfig::HeaderBlockInfo(types[kind]), 0, 0,
+                                         false, mode);
+            SimpleAllocator allocator(48, config);
+
+            // the first round only creates the pages (and the block infos)
+            std::chrono::steady_clock::time_point start;
+            for (int round = 0; round < 2; ++round) {
+                start = std::chrono::steady_clock::now();
+                for (unsigned i = 0; i < objects; ++i)
+                    ptrs[i] = allocator.allocate(kind == 3 ? labels[i % 4] : nullptr);
+                for (void* p : ptrs)
+                    allocator.free(p);
+            }
+            ns[kind] = elapsedNs(start);
+        }
+
+        cout << "  " << (mode == SimpleAllocatorConfig::SINGLE_THREADED ? "single threaded:" : "thread cached:  ")
+             << std::fixed << std::setprecision(1)
+             << " no header: " << std::setw(6) << ns[0] / objects
+             << ", basic: " << std::setw(6) << ns[1] / objects
+             << ", external: " << std::setw(6) << ns[2] / objects
+             << ", external + label: " << std::setw(6) << ns[3] / objects << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Link pointer nodes into a perfectly balanced tree over consecutive keys
+ * @param nodes node of every key, by key
+ * @param first first key of the subtree
+ * @param last one past the last key of the subtree
+ * @return root of the subtree
+ */
+static AVL<int>::BinTreeNode* linkBalanced(std::vector<AVL<int>::BinTreeNode*>& nodes, int first, int last) {
+    if (first == last)
+        return nullptr;
+    const int middle = first + (last - first) / 2;
+    AVL<int>::BinTreeNode* node = nodes[middle];
+    node->left = linkBalanced(nodes, first, middle);
+    node->right = linkBalanced(nodes, middle + 1, last);
+    return node;
+}
+
+/**
+ * @brief Compare the node layouts of AVL<int> and CompactAVL<int> at 10M keys
+ *        - bytes/node is the page memory of the node allocator over the number of keys
+ *        - the compact tree is filled with add() in random order; the pointer nodes are allocated
+ *          in the same order and linked into a perfectly balanced tree (which favours the pointer
+ *          layout slightly), so that only the layout differs and not how AVL::add balances
+ *        - find() walks the same way in both, one compare per node visited
+ */
+static void benchCompactLayout() {
+    cout << "=== 10M int keys: bytes/node and ns/find, AVL<int> nodes vs CompactAVL<int> ===" << endl;
+
+    const int keyCount = 10000000;
+    const unsigned lookups = 1u << 21;
+    std::vector<int> keys(keyCount);
+    std::iota(keys.begin(), keys.end(), 0);
+    Utils::srand(8, 3);
+    for (int i = keyCount; i > 1; --i)
+        std::swap(keys[i - 1], keys[Utils::randInt(0, i - 1)]);
+    std::vector<int> probes(lookups);
+    for (int& probe : probes)
+        probe = Utils::randInt(0, keyCount - 1);
+
+    // pointer layout
+    {
+        SimpleAllocatorConfig config(false, 4096, 0, SimpleAllocatorConfig::HeaderBlockInfo(), 8);
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), config);
+        std::vector<AVL<int>::BinTreeNode*> nodes(keyCount);
+        for (int key : keys) {
+            nodes[key] = static_cast<AVL<int>::BinTreeNode*>(allocator.allocate());
+            nodes[key]->data = key;
+        }
+        AVL<int>::BinTreeNode* root = linkBalanced(nodes, 0, keyCount);
+
+        auto start = std::chrono::steady_clock::now();
+        unsigned found = 0;
+        unsigned compares = 0;
+        for (int probe : probes) {
+            for (AVL<int>::BinTreeNode* node = root; node;) {
+                ++compares;
+                if (probe < node->data) {
+                    node = node->left;
+                } else if (node->data < probe) {
+                    node = node->right;
+                } else {
+                    ++found;
+                    break;
+                }
+            }
+        }
+        const double ns = elapsedNs(start);
+        if (found != lookups)
+            cout << "  pointer lookups went wrong" << endl;
+        cout << "  AVL<int> nodes:  " << std::fixed << std::setprecision(1) << "bytes/node: " << std::setw(5)
+             << double(allocator.getStats().pageBytes) / keyCount << ", compares/find: " << std::setw(5)
+             << double(compares) / lookups << ", ns/find: " << std::setw(6) << ns / lookups << endl;
+    }
+
+    // compact layout
+    {
+        SimpleAllocatorConfig config(false, 16, 0, SimpleAllocatorConfig::HeaderBlockInfo(), 64);
+        SimpleAllocator allocator(CompactAVL<int>::CHUNK_SIZE, config);
+        CompactAVL<int> compact(&allocator);
+        for (int key : keys)
+            compact.add(key);
+
+        auto start = std::chrono::steady_clock::now();
+        unsigned found = 0;
+        unsigned compares = 0;
+        for (int probe : probes) {
+            unsigned probeCompares;
+            found += compact.find(probe, probeCompares);
+            compares += probeCompares;
+        }
+        const double ns = elapsedNs(start);
+        if (found != lookups)
+            cout << "  compact lookups went wrong" << endl;
+        cout << "  CompactAVL<int>: " << std::fixed << std::setprecision(1) << "bytes/node: " << std::setw(5)
+             << double(allocator.getStats().pageBytes) / keyCount << ", compares/find: " << std::setw(5)
+             << double(compares) / lookups << ", ns/find: " << std::setw(6) << ns / lookups << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Measure AVL<int> add and remove on a pool
+ *        - the path is traced in a fixed-size array and the retracing stops as soon as
+ *          a subtree's height is unchanged, so the pool allocation is the only one per add
+ *        - size() and height() are O(1), so polling them costs the same at any size
+ */
+static void benchAvlUpdates() {
+    cout << "=== AVL<int> on a pool: ns/add, ns/remove (random order) and ns/poll of size() + height() ===" << endl;
+
+    for (int keyCount : {1 << 10, 1 << 16, 1 << 20}) {
+        std::vector<int> keys(keyCount);
+        std::iota(keys.begin(), keys.end(), 0);
+        Utils::srand(8, 3);
+        for (int i = keyCount; i > 1; --i)
+            std::swap(keys[i - 1], keys[Utils::randInt(0, i - 1)]);
+
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+        AVL<int> avl(&allocator);
+        auto start = std::chrono::steady_clock::now();
+        for (int key : keys)
+            avl.add(key);
+        const double addNs = elapsedNs(start);
+
+        // what a monitor polling the tree would pay
+        const unsigned polls = 1u << 20;
+        start = std::chrono::steady_clock::now();
+        unsigned long long polled = 0;
+        for (unsigned i = 0; i < polls; ++i)
+            polled += avl.size() + avl.height();
+        const double pollNs = elapsedNs(start);
+        if (polled == 0)
+            cout << "  polling went wrong" << endl;
+
+        // remove in another order than the adds
+        std::reverse(keys.begin(), keys.end());
+        start = std::chrono::steady_clock::now();
+        for (int key : keys)
+            avl.remove(key);
+        const double removeNs = elapsedNs(start);
+
+        cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1)
+             << ", add: " << std::setw(6) << addNs / keyCount << ", remove: " << std::setw(6) << removeNs / keyCount
+             << ", size() + height(): " << std::setw(4) << pollNs / polls << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare a percentile from select() against parsing printInorder()
+ *        - the old way formats the whole tree into a string and reads it back, O(n)
+ *        - percentile() walks one path down with the cached counts, O(log n)
+ */
+static void benchPercentiles() {
+    cout << "=== AVL<int> p99: ns/query, printInorder() parsed vs percentile() ===" << endl;
+
+    for (int keyCount : {1 << 10, 1 << 16, 1 << 20}) {
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+        AVL<int> avl(&allocator);
+        Utils::srand(8, 3);
+        for (int i = 0; i < keyCount; ++i) {
+            try {
+                avl.add(Utils::randInt(0, keyCount * 4));
+            } catch (const BSTException&) {
+                // duplicates are skipped
+            }
+        }
+        const unsigned count = avl.size();
+        const unsigned target = static_cast<unsigned>(std::ceil(0.99 * count)) - 1;
+
+        // a few parses are enough, they take milliseconds on the big trees
+        const unsigned parses = 8;
+        long long parsed = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < parses; ++i) {
+            std::stringstream ss = avl.printInorder();
+            int value = 0;
+            for (unsigned k = 0; k <= target; ++k)
+                ss >> value;
+            parsed += value;
+        }
+        const double parseNs = elapsedNs(start) / parses;
+
+        const unsigned queries = 1u << 20;
+        long long selected = 0;
+        start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < queries; ++i)
+            selected += avl.percentile(99);
+        const double selectNs = elapsedNs(start) / queries;
+        if (parsed / parses != selected / queries)
+            cout << "  percentiles disagree" << endl;
+
+        cout << "  keys: " << std::setw(8) << count << std::fixed << std::setprecision(1)
+             << ", printInorder(): " << std::setw(12) << parseNs << ", percentile(): " << std::setw(6) << selectNs
+             << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare filling an AVL<int> with one add per key against the bulk builds
+ *        - N adds walk down, retrace and rotate N times, O(N log N) with a pool allocation each
+ *        - buildFromSorted takes the nodes in batches and links them in one O(N) pass
+ *        - assign sorts (and dedups) a copy of unsorted keys first, then builds the same way
+ */
+static void benchBulkBuild() {
+    cout << "=== AVL<int> filled from sorted keys: ns/key, add() loop vs buildFromSorted(), and assign() of shuffled keys ===" << endl;
+
+    for (int keyCount : {1 << 10, 1 << 16, 1 << 20}) {
+        std::vector<int> keys(keyCount);
+        std::iota(keys.begin(), keys.end(), 0);
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+
+        double addNs, buildNs, assignNs;
+        {
+            AVL<int> avl(&allocator);
+            auto start = std::chrono::steady_clock::now();
+            for (int key : keys)
+                avl.add(key);
+            addNs = elapsedNs(start);
+        }
+        {
+            AVL<int> avl(&allocator);
+            auto start = std::chrono::steady_clock::now();
+            avl.buildFromSorted(keys.begin(), keys.end());
+            buildNs = elapsedNs(start);
+            if (avl.size() != unsigned(keyCount))
+                cout << "  build went wrong" << endl;
+        }
+        {
+            Utils::srand(8, 3);
+            for (int i = keyCount; i > 1; --i)
+                std::swap(keys[i - 1], keys[Utils::randInt(0, i - 1)]);
+            AVL<int> avl(&allocator);
+            auto start = std::chrono::steady_clock::now();
+            avl.assign(keys.begin(), keys.end());
+            assignNs = elapsedNs(start);
+            if (avl.size() != unsigned(keyCount))
+                cout << "  assign went wrong" << endl;
+        }
+
+        cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1)
+             << ", add(): " << std::setw(6) << addNs / keyCount << ", buildFromSorted(): " << std::setw(5)
+             << buildNs / keyCount << ", assign(): " << std::setw(6) << assignNs / keyCount << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare merging two AVL<int> sets value by value against the join-based set operations
+ *        - add()/remove() of every value of the other set is O(m log n) on one core
+ *        - unionWith/intersectWith/difference split and join whole subtrees, O(m log(n / m + 1)),
+ *          and fork the halves onto other cores above AVL::PARALLEL_SET_MIN_SIZE values
+ *        - both sets hold keyCount random keys out of 2 * keyCount, so about half of them are shared
+ */
+static void benchSetAlgebra() {
+    cout << "=== AVL<int> sets of random keys: ms/operation, value by value vs split/join ("
+         << std::thread::hardware_concurrency() << " hardware threads) ===" << endl;
+
+    for (int keyCount : {1 << 16, 1 << 20, 1 << 22}) {
+        std::vector<int> keys(keyCount), otherKeys(keyCount);
+        Utils::srand(8, 3);
+        for (int i = 0; i < keyCount; ++i) {
+            keys[i] = Utils::randInt(0, 2 * keyCount);
+            otherKeys[i] = Utils::randInt(0, 2 * keyCount);
+        }
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+        AVL<int> other(&allocator);
+        other.assign(otherKeys.begin(), otherKeys.end());
+        std::vector<int> otherValues(otherKeys);
+        std::sort(otherValues.begin(), otherValues.end());
+        otherValues.erase(std::unique(otherValues.begin(), otherValues.end()), otherValues.end());
+
+        // one value at a time: add/remove every value of the other set, skipping the misses
+        double addNs, removeNs;
+        unsigned addSize, removeSize;
+        {
+            AVL<int> avl(&allocator);
+            avl.assign(keys.begin(), keys.end());
+            auto start = std::chrono::steady_clock::now();
+            for (int value : otherValues) {
+                try {
+                    avl.add(value);
+                } catch (const BSTException&) {
+                    // already in the set
+                }
+            }
+            addNs = elapsedNs(start);
+            addSize = avl.size();
+        }
+        {
+            AVL<int> avl(&allocator);
+            avl.assign(keys.begin(), keys.end());
+            auto start = std::chrono::steady_clock::now();
+            for (int value : otherValues) {
+                try {
+                    avl.remove(value);
+                } catch (const BSTException&) {
+                    // not in the set
+                }
+            }
+            removeNs = elapsedNs(start);
+            removeSize = avl.size();
+        }
+
+        // whole subtrees at a time
+        double unionNs, intersectNs, differenceNs;
+        {
+            AVL<int> avl(&allocator);
+            avl.assign(keys.begin(), keys.end());
+            auto start = std::chrono::steady_clock::now();
+            avl.unionWith(other);
+            unionNs = elapsedNs(start);
+            if (avl.size() != addSize)
+                cout << "  union went wrong" << endl;
+        }
+        {
+            AVL<int> avl(&allocator);
+            avl.assign(keys.begin(), keys.end());
+            const unsigned size = avl.size();
+            auto start = std::chrono::steady_clock::now();
+            avl.intersectWith(other);
+            intersectNs = elapsedNs(start);
+            if (avl.size() + removeSize != size)
+                cout << "  intersection went wrong" << endl;
+        }
+        {
+            AVL<int> avl(&allocator);
+            avl.assign(keys.begin(), keys.end());
+            auto start = std::chrono::steady_clock::now();
+            avl.difference(other);
+            differenceNs = elapsedNs(start);
+            if (avl.size() != removeSize)
+                cout << "  difference went wrong" << endl;
+        }
+
+        cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1) << ", add(): "
+             << std::setw(7) << addNs / 1e6 << ", unionWith(): " << std::setw(7) << unionNs / 1e6 << ", remove(): "
+             << std::setw(7) << removeNs / 1e6 << ", difference(): " << std::setw(7) << differenceNs / 1e6
+             << ", intersectWith(): " << std::setw(7) << intersectNs / 1e6 << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare summing an AVL<int> through printInorder() against its iterators
+ *        - printInorder formats every value into a string that has to be parsed back
+ *        - the iterators walk the nodes in place, with the path in a fixed-size array
+ */
+static void benchIteration() {
+    cout << "=== AVL<int> sum of all values: ns/value, printInorder() parsed vs forward and reverse iterators ===" << endl;
+
+    for (int keyCount : {1 << 10, 1 << 16, 1 << 20}) {
+        std::vector<int> keys(keyCount);
+        std::iota(keys.begin(), keys.end(), 0);
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+        AVL<int> avl(&allocator);
+        avl.buildFromSorted(keys.begin(), keys.end());
+
+        auto start = std::chrono::steady_clock::now();
+        long long parsed = 0;
+        std::stringstream ss = avl.printInorder();
+        for (int value; ss >> value;)
+            parsed += value;
+        const double parseNs = elapsedNs(start);
+
+        // a few rounds, a single one is too short on the small trees
+        const int rounds = 8;
+        start = std::chrono::steady_clock::now();
+        long long forward = 0;
+        for (int i = 0; i < rounds; ++i) {
+            for (int value : avl)
+                forward += value;
+        }
+        const double forwardNs = elapsedNs(start) / rounds;
+
+        start = std::chrono::steady_clock::now();
+        long long reverse = 0;
+        for (int i = 0; i < rounds; ++i) {
+            for (auto it = avl.rbegin(); it != avl.rend(); ++it)
+                reverse += *it;
+        }
+        const double reverseNs = elapsedNs(start) / rounds;
+        if (forward != parsed * rounds || reverse != forward)
+            cout << "  sums disagree" << endl;
+
+        cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1)
+             << ", printInorder(): " << std::setw(6) << parseNs / keyCount << ", iterator: " << std::setw(5)
+             << forwardNs / keyCount << ", reverse_iterator: " << std::setw(5) << reverseNs / keyCount << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare window queries on an AVL<int> done with a full traversal against the range API
+ *        - a full traversal visits every node to find the few dozen in the window
+ *        - forEachInRange starts at the window's lower bound, O(log n + k)
+ *        - countInRange uses the cached counts, O(log n) whatever the window
+ */
+static void benchRangeQueries() {
+    cout << "=== AVL<int> window of ~32 keys: ns/query, full traversal vs forEachInRange() vs countInRange() ===" << endl;
+
+    for (int keyCount : {1 << 10, 1 << 16, 1 << 20}) {
+        // every other int, so a window of 64 ints holds 32 keys
+        std::vector<int> keys(keyCount);
+        for (int i = 0; i < keyCount; ++i)
+            keys[i] = i * 2;
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+        AVL<int> avl(&allocator);
+        avl.buildFromSorted(keys.begin(), keys.end());
+
+        const int windows = 1 << 12;
+        std::vector<int> starts(windows);
+        Utils::srand(8, 3);
+        for (int& start : starts)
+            start = Utils::randInt(0, 2 * keyCount - 64);
+
+        // a few full traversals are enough, they take milliseconds on the big trees
+        const int traversals = 16;
+        long long fullSum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < traversals; ++i) {
+            for (int value : avl) {
+                if (value >= starts[i] && value <= starts[i] + 63)
+                    fullSum += value;
+            }
+        }
+        const double fullNs = elapsedNs(start) / traversals;
+
+        long long rangeSum = 0;
+        long long checkSum = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < windows; ++i) {
+            long long sum = 0;
+            avl.forEachInRange(starts[i], starts[i] + 63, [&sum](int value) { sum += value; });
+            rangeSum += sum;
+            if (i < traversals)
+                checkSum += sum;
+        }
+        const double rangeNs = elapsedNs(start) / windows;
+
+        unsigned long long counted = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < windows; ++i)
+            counted += avl.countInRange(starts[i], starts[i] + 63);
+        const double countNs = elapsedNs(start) / windows;
+        if (checkSum != fullSum || counted != 32ull * windows || rangeSum == 0)
+            cout << "  window queries disagree" << endl;
+
+        cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1)
+             << ", full traversal: " << std::setw(12) << fullNs << ", forEachInRange(): " << std::setw(6) << rangeNs
+             << ", countInRange(): " << std::setw(6) << countNs << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare batches of lookups in an AVL<int> done with find() one by one against findMany()
+ *        - find() walks down for one value at a time, stalling on a cache miss at every level
+ *        - findMany() walks AVL::FIND_GROUP_SIZE values down in lockstep, prefetching their next nodes
+ *        - the biggest tree (256 MB of nodes) is well past the L3 cache
+ */
+static void benchFindMany() {
+    cout << "=== AVL<int> random lookups in batches of 256: ns/lookup, find() loop vs findMany() ===" << endl;
+
+    for (int keyCount : {1 << 16, 1 << 20, 1 << 23}) {
+        std::vector<int> keys(keyCount);
+        for (int i = 0; i < keyCount; ++i)
+            keys[i] = i * 2;
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+        AVL<int> avl(&allocator);
+        avl.buildFromSorted(keys.begin(), keys.end());
+
+        // half of the values are in the tree (the even ones)
+        const int batchSize = 256;
+        const int batches = 4096;
+        std::vector<int> values(batchSize * batches);
+        Utils::srand(8, 3);
+        for (int& value : values)
+            value = Utils::randInt(0, 2 * keyCount - 1);
+
+        unsigned loopFound = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int batch = 0; batch < batches; ++batch) {
+            for (int i = 0; i < batchSize; ++i) {
+                unsigned compares;
+                loopFound += avl.find(values[batch * batchSize + i], compares);
+            }
+        }
+        const double loopNs = elapsedNs(start);
+
+        unsigned manyFound = 0;
+        bool results[batchSize];
+        start = std::chrono::steady_clock::now();
+        for (int batch = 0; batch < batches; ++batch)
+            manyFound += avl.findMany(&values[batch * batchSize], batchSize, results);
+        const double manyNs = elapsedNs(start);
+        if (loopFound != manyFound)
+            cout << "  lookups disagree" << endl;
+
+        cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1)
+             << ", find(): " << std::setw(6) << loopNs / values.size() << ", findMany(): " << std::setw(6)
+             << manyNs / values.size() << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare random lookups in an AVL<int> against its frozen snapshot
+ *        - AVL::find() chases a pointer per level, to a node anywhere in the pool
+ *        - FrozenAVL::find() walks an array in Eytzinger order without branching on the compares,
+ *          prefetching 4 levels ahead, so the top levels stay in cache and the misses overlap
+ *        - std::lower_bound on a sorted vector is there as the plain array baseline
+ */
+static void benchFrozen() {
+    cout << "=== AVL<int> random lookups: ns/find, AVL vs FrozenAVL (Eytzinger) vs sorted vector ===" << endl;
+
+    for (int keyCount : {1 << 16, 1 << 20, 1 << 23}) {
+        std::vector<int> keys(keyCount);
+        for (int i = 0; i < keyCount; ++i)
+            keys[i] = i * 2;
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+        AVL<int> avl(&allocator);
+        avl.buildFromSorted(keys.begin(), keys.end());
+        auto start = std::chrono::steady_clock::now();
+        const FrozenAVL<int> frozen = avl.freeze();
+        const double freezeNs = elapsedNs(start);
+
+        // half of the values are in the tree (the even ones)
+        const int lookups = 1 << 20;
+        std::vector<int> values(lookups);
+        Utils::srand(8, 3);
+        for (int& value : values)
+            value = Utils::randInt(0, 2 * keyCount - 1);
+
+        unsigned avlFound = 0;
+        start = std::chrono::steady_clock::now();
+        for (int value : values) {
+            unsigned compares;
+            avlFound += avl.find(value, compares);
+        }
+        const double avlNs = elapsedNs(start) / lookups;
+
+        unsigned frozenFound = 0;
+        start = std::chrono::steady_clock::now();
+        for (int value : values) {
+            unsigned compares;
+            frozenFound += frozen.find(value, compares);
+        }
+        const double frozenNs = elapsedNs(start) / lookups;
+
+        unsigned vectorFound = 0;
+        start = std::chrono::steady_clock::now();
+        for (int value : values)
+            vectorFound += std::binary_search(keys.begin(), keys.end(), value);
+        const double vectorNs = elapsedNs(start) / lookups;
+        if (avlFound != frozenFound || avlFound != vectorFound)
+            cout << "  lookups disagree" << endl;
+
+        cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1)
+             << ", freeze() ns/key: " << std::setw(5) << freezeNs / keyCount << ", AVL: " << std::setw(6) << avlNs
+             << ", FrozenAVL: " << std::setw(6) << frozenNs << ", sorted vector: " << std::setw(6) << vectorNs
+             << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @brief Compare the ways of getting a tree back at startup
+ *        - assign() rebuilds it from the source values (in random order), as without snapshots
+ *        - loadMapped() maps a snapshot saved by save() and answers lookups from the mapping;
+ *          it is O(1) without the checksum, and the checksum is one pass over the file
+ *        - load() maps the snapshot and feeds it to buildFromSorted for a tree that can change
+ *        - the file was just written, so it is read from the page cache, not the disk
+ */
+static void benchSnapshots() {
+    cout << "=== AVL<int> startup: ms to get a tree back, rebuilt vs from a saved snapshot ===" << endl;
+
+    const std::string path = "bench-snapshot.bin";
+    for (int keyCount : {1000000, 10000000}) {
+        std::vector<int> source(keyCount);
+        Utils::srand(8, 3);
+        for (int& value : source)
+            value = Utils::randInt(0, 4 * keyCount);
+
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+        auto start = std::chrono::steady_clock::now();
+        {
+            AVL<int> avl(&allocator);
+            avl.assign(source.begin(), source.end());
+            const double assignMs = elapsedNs(start) / 1e6;
+
+            start = std::chrono::steady_clock::now();
+            avl.save(path);
+            const double saveMs = elapsedNs(start) / 1e6;
+            cout << "  keys: " << std::setw(8) << keyCount << std::fixed << std::setprecision(1)
+                 << ", unique: " << std::setw(8) << avl.size() << ", assign(): " << std::setw(7) << assignMs
+                 << ", save(): " << std::setw(7) << saveMs << endl;
+        }
+
+        // the lookups after each load check that it gives the same tree
+        const int lookups = 1 << 16;
+        std::vector<int> values(lookups);
+        for (int& value : values)
+            value = Utils::randInt(0, 4 * keyCount);
+
+        start = std::chrono::steady_clock::now();
+        const FrozenAVL<int> verified = AVL<int>::loadMapped(path);
+        const double verifiedMs = elapsedNs(start) / 1e6;
+        start = std::chrono::steady_clock::now();
+        const FrozenAVL<int> mapped = AVL<int>::loadMapped(path, false);
+        const double mappedMs = elapsedNs(start) / 1e6;
+        unsigned mappedFound = 0;
+        start = std::chrono::steady_clock::now();
+        for (int value : values) {
+            unsigned compares;
+            mappedFound += mapped.find(value, compares);
+        }
+        const double mappedFindNs = elapsedNs(start) / lookups;
+
+        AVL<int> loaded(&allocator);
+        start = std::chrono::steady_clock::now();
+        loaded.load(path, false);
+        const double loadMs = elapsedNs(start) / 1e6;
+        unsigned loadedFound = 0;
+        for (int value : values) {
+            unsigned compares;
+            loadedFound += loaded.find(value, compares);
+        }
+        if (mappedFound != loadedFound || verified.size() != loaded.size())
+            cout << "  loads disagree" << endl;
+
+        cout << "  loadMapped() checked: " << std::setw(7) << verifiedMs << ", unchecked: " << std::setw(7)
+             << mappedMs << " (then ns/find: " << std::setw(5) << mappedFindNs << ")"
+             << ", load(): " << std::setw(7) << loadMs << endl;
+    }
+    std::remove(path.c_str());
+    cout << endl;
+}
+
+/**
+ * @brief Compare the add throughput of a DurableAVL<int> at different commit intervals
+ *        - AVL::add() alone is the bound, with nothing logged
+ *        - commit() after every add is one write and fdatasync per add, the cost of
+ *          making each one durable before going on
+ *        - with group commit the adds only append to a buffer, and the flusher thread writes
+ *          and syncs a frame per interval, so the longer the interval the fewer the syncs
+ *          (but the more adds a crash can lose)
+ *        - the last row adds a checkpoint every 2^16 records
+ *        - the ops/sec count up to the final commit()
+ */
+static void benchDurableLog() {
+    cout << "=== DurableAVL<int> adds: ops/sec by commit interval, with the syncs (frames) it took ===" << endl;
+
+    const std::string path = "bench-durable";
+    const int opCount = 1 << 18;
+    std::vector<int> keys(opCount);
+    for (int i = 0; i < opCount; ++i)
+        keys[i] = i;
+    Utils::srand(8, 3);
+    for (int i = opCount - 1; i > 0; --i)
+        std::swap(keys[i], keys[Utils::randInt(0, i)]);
+
+    SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+    {
+        AVL<int> avl(&allocator);
+        auto start = std::chrono::steady_clock::now();
+        for (int key : keys)
+            avl.add(key);
+        cout << "  " << std::left << std::setw(32) << "AVL::add() alone:" << std::right << std::setw(10) << std::fixed
+             << std::setprecision(0) << opCount / (elapsedNs(start) / 1e9) << " ops/sec" << endl;
+    }
+
+    // - far fewer adds for this one, at a sync each
+    const int syncedCount = 1 << 11;
+    {
+        std::remove((path + ".log").c_str());
+        DurableAVL<int> durable(path, DurableAVLConfig(std::chrono::microseconds(0), 0), &allocator);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < syncedCount; ++i) {
+            durable.add(keys[i]);
+            durable.commit();
+        }
+        cout << "  " << std::left << std::setw(32) << "commit() after every add:" << std::right << std::setw(10)
+             << syncedCount / (elapsedNs(start) / 1e9) << " ops/sec, syncs: " << std::setw(6) << durable.syncCount()
+             << endl;
+    }
+
+    struct Run {
+        std::chrono::microseconds interval;
+        unsigned checkpointRecords;
+    };
+    for (const Run& run : {Run{std::chrono::microseconds(0), 0}, Run{std::chrono::microseconds(100), 0},
+                           Run{std::chrono::microseconds(1000), 0}, Run{std::chrono::microseconds(10000), 0},
+                           Run{std::chrono::microseconds(1000), 1u << 16}}) {
+        std::remove((path + ".log").c_str());
+        std::remove((path + ".snapshot").c_str());
+        DurableAVL<int> durable(path, DurableAVLConfig(run.interval, run.checkpointRecords), &allocator);
+        auto start = std::chrono::steady_clock::now();
+        for (int key : keys)
+            durable.add(key);
+        durable.commit();
+        std::ostringstream label;
+        label << "interval " << run.interval.count() << " us" << (run.checkpointRecords ? " + checkpoints:" : ":");
+        cout << "  " << std::left << std::setw(32) << label.str() << std::right << std::setw(10)
+             << opCount / (elapsedNs(start) / 1e9) << " ops/sec, syncs: " << std::setw(6) << durable.syncCount()
+             << endl;
+    }
+    std::remove((path + ".log").c_str());
+    std::remove((path + ".snapshot").c_str());
+    cout << endl;
+}
+
+/**
+ * @brief Run reader threads and a writer thread together for a while
+ * @param readers number of reader threads
+ * @param read called in a loop by every reader with its thread number and its count of values
+ *             found (which keeps the finds from being optimized away), returns the finds it did
+ * @param write called in a loop by the writer
+ * @param readMops receives the millions of finds per second of all the readers
+ * @param writeKops receives the thousands of writes per second
+ */
+template <typename Read, typename Write>
+static void readWhileWriting(unsigned readers, Read read, Write write, double& readMops, double& writeKops) {
+    const auto duration = std::chrono::milliseconds(200);
+    std::atomic<bool> stop(false);
+    std::vector<unsigned long long> finds(readers), found(readers);
+    std::vector<std::thread> threads;
+    for (unsigned r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            unsigned long long done = 0;
+            unsigned long long hits = 0;
+            while (!stop.load(std::memory_order_relaxed))
+                done += read(r, hits);
+            finds[r] = done;
+            found[r] = hits;
+        });
+    }
+    unsigned long long writes = 0;
+    std::thread writer([&] {
+        while (!stop.load(std::memory_order_relaxed)) {
+            write();
+            ++writes;
+        }
+    });
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(duration);
+    stop.store(true);
+    writer.join();
+    for (std::thread& thread : threads)
+        thread.join();
+    const double seconds = elapsedNs(start) / 1e9;
+    readMops = std::accumulate(finds.begin(), finds.end(), 0ull) / seconds / 1e6;
+    if (std::accumulate(found.begin(), found.end(), 0ull) > std::accumulate(finds.begin(), finds.end(), 0ull))
+        cout << "  more values found than looked up" << endl;
+    writeKops = writes / seconds / 1e3;
+}
+
+/**
+ * @brief Compare the read throughput of an AVL<int> behind a reader-writer lock against a
+ *        PersistentAVL<int>, by reader threads, while a writer runs
+ *        - the tree holds 2^20 even keys and the writer adds and removes odd ones nonstop
+ *        - every read is a batch of 64 random finds under one shared lock, or in one snapshot
+ *        - with the lock, the readers wait whenever the writer holds it (and the writer waits
+ *          for them); with snapshots, nobody waits, and the writer copies paths instead
+ *        - the readers only scale up to the hardware threads
+ */
+static void benchPersistentReads() {
+    cout << "=== Mfinds/s (and writer kops/s) vs reader threads, shared_mutex AVL vs PersistentAVL ("
+         << std::thread::hardware_concurrency() << " hardware threads) ===" << endl;
+
+    const int keyCount = 1 << 20;
+    const int batchSize = 64;
+    std::vector<int> keys(keyCount);
+    for (int i = 0; i < keyCount; ++i)
+        keys[i] = 2 * i;
+
+    SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 1024, 0));
+    AVL<int> locked(&allocator);
+    locked.buildFromSorted(keys.begin(), keys.end());
+    std::shared_mutex lock;
+    PersistentAVL<int> persistent;
+    for (int key : keys)
+        persistent.add(key);
+
+    // - a small generator per reader, since Utils::randInt is not thread safe
+    auto nextKey = [](uint32_t& state) {
+        state = state * 1664525u + 1013904223u;
+        return static_cast<int>(state >> 11) % (2 * keyCount);
+    };
+    auto writeKey = [](unsigned long long count) { return static_cast<int>(2 * (count / 2 % keyCount) + 1); };
+
+    // - the writes go on from one run to the next, so that every add has its remove
+    unsigned long long lockedWrites = 0;
+    unsigned long long persistentWrites = 0;
+
+    const unsigned maxReaders = std::max(4u, std::thread::hardware_concurrency());
+    for (unsigned readers = 1; readers <= maxReaders; readers *= 2) {
+        std::vector<uint32_t> states(readers);
+        for (unsigned r = 0; r < readers; ++r)
+            states[r] = r + 1;
+
+        double lockedMops, lockedKops;
+        readWhileWriting(readers,
+            [&](unsigned r, unsigned long long& hits) {
+                std::shared_lock<std::shared_mutex> guard(lock);
+                for (int i = 0; i < batchSize; ++i) {
+                    unsigned compares;
+                    hits += locked.find(nextKey(states[r]), compares);
+                }
+                return batchSize;
+            },
+            [&]() {
+                std::unique_lock<std::shared_mutex> guard(lock);
+                const unsigned long long count = lockedWrites++;
+                if (count % 2)
+                    locked.remove(writeKey(count));
+                else
+                    locked.add(writeKey(count));
+            },
+            lockedMops, lockedKops);
+
+        double persistentMops, persistentKops;
+        readWhileWriting(readers,
+            [&](unsigned r, unsigned long long& hits) {
+                const PersistentAVL<int>::Snapshot snapshot = persistent.snapshot();
+                for (int i = 0; i < batchSize; ++i) {
+                    unsigned compares;
+                    hits += snapshot.find(nextKey(states[r]), compares);
+                }
+                return batchSize;
+            },
+            [&]() {
+                const unsigned long long count = persistentWrites++;
+                if (count % 2)
+                    persistent.remove(writeKey(count));
+                else
+                    persistent.add(writeKey(count));
+            },
+            persistentMops, persistentKops);
+
+        cout << "  readers: " << std::setw(2) << readers << std::fixed << std::setprecision(2)
+             << ", shared_mutex AVL: " << std::setw(6) << lockedMops << " (" << std::setw(7) << std::setprecision(1)
+             << lockedKops << ")" << std::setprecision(2) << ", PersistentAVL: " << std::setw(6) << persistentMops
+             << " (" << std::setw(7) << std::setprecision(1) << persistentKops << ")" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * The main function that runs the benchmarks
+ * @param argc number of command line arguments
+ * @param argv array of command line arguments (optional benchmark number, 0 runs all)
+ */
+int main(int argc, char* argv[]) {
+    int bench = 0;
+    if (argc > 1)
+        bench = atoi(argv[1]);
+
+    if (bench == 0 || bench == 1)
+        benchFreeLatency();
+    if (bench == 0 || bench == 2)
+        benchThreadCache();
+    if (bench == 0 || bench == 3)
+        benchBatch();
+    if (bench == 0 || bench == 4)
+        benchPageGrowth();
+    if (bench == 0 || bench == 5)
+        benchSizeClasses();
+    if (bench == 0 || bench == 6)
+        benchSetAdapter();
+    if (bench == 0 || bench == 7)
+        benchPadChecks();
+    if (bench == 0 || bench == 8)
+        benchExternalHeaders();
+    if (bench == 0 || bench == 9)
+        benchCompactLayout();
+    if (bench == 0 || bench == 10)
+        benchAvlUpdates();
+    if (bench == 0 || bench == 11)
+        benchPercentiles();
+    if (bench == 0 || bench == 12)
+        benchBulkBuild();
+    if (bench == 0 || bench == 13)
+        benchSetAlgebra();
+    if (bench == 0 || bench == 14)
+        benchIteration();
+    if (bench == 0 || bench == 15)
+        benchRangeQueries();
+    if (bench == 0 || bench == 16)
+        benchFindMany();
+    if (bench == 0 || bench == 17)
+        benchFrozen();
+    if (bench == 0 || bench == 18)
+        benchSnapshots();
+    if (bench == 0 || bench == 19)
+        benchDurableLog();
+    if (bench == 0 || bench == 20)
+        benchPersistentReads();
+
+    return 0;
+}
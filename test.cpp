@@ -14,17 +14,29 @@
 #define FUDGE 4
 
 #include "AVL.h"
+#include "CompactAVL.h"
+#include "DurableAVL.h"
+#include "FrozenAVL.h"
+#include "PersistentAVL.h"
 #include "SimpleAllocator.h"
+#include "SimpleAllocatorAdapter.h"
+#include "SizeClassAllocator.h"
 #include "prng.h"
 #include <iostream>
+#include <list>
 #include <map>
+#include <set>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <typeinfo>
 #include <sstream>
 #include <cstring>
+#include <thread>
 
 using std::cout;
 using std::endl;
@@ -473,6 +485,198 @@ void findInt(AVL<T>& avl, int val) {
     cout << endl;
 }
 
+/**
+ * @brief Check the cached balance factor and count of every node against the subtrees
+ * @tparam T type of AVL
+ * @param tree root of the subtree
+ * @param height returns the height of the subtree
+ * @param count returns the number of nodes in the subtree
+ * @return true if every node in the subtree is consistent and balanced
+ */
+template <typename T>
+bool checkNodeStats(const typename AVL<T>::BinTreeNode* tree, int& height, unsigned& count) {
+    if (!tree) {
+        height = -1;
+        count = 0;
+        return true;
+    }
+    int leftHeight, rightHeight;
+    unsigned leftCount, rightCount;
+    const bool childrenOk = checkNodeStats<T>(tree->left, leftHeight, leftCount)
+                            && checkNodeStats<T>(tree->right, rightHeight, rightCount);
+    height = 1 + std::max(leftHeight, rightHeight);
+    count = 1 + leftCount + rightCount;
+    return childrenOk && tree->balanceFactor == rightHeight - leftHeight && tree->count == count
+           && tree->balanceFactor >= -1 && tree->balanceFactor <= 1;
+}
+
+/**
+ * @brief Stress a shared LOCK_FREE allocator from several threads
+ *        - every thread builds and shrinks its own AVL tree, but all the trees
+ *          take their nodes from the one allocator without any locking
+ *        - only the deterministic results are printed (sizes and counts),
+ *          the number of pages depends on how the threads interleave
+ * @param threads number of threads
+ * @param size number of ints each thread adds (half of them are removed again)
+ */
+void stressLockFree(unsigned threads, int size) {
+    cout << "Running stressLockFree..." << endl;
+    cout << endl;
+
+    // one allocator shared by all the trees
+    SimpleAllocatorConfig config(false, 64, 0);
+    config.concurrency = SimpleAllocatorConfig::LOCK_FREE;
+    SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), config);
+
+    // every thread adds its ints and then removes the even ones
+    std::vector<AVL<int>*> trees;
+    for (unsigned t = 0; t < threads; ++t)
+        trees.push_back(new AVL<int>(&allocator));
+    std::vector<std::thread> workers;
+    std::vector<std::string> errors(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            try {
+                for (int i = 0; i < size; ++i)
+                    trees[t]->add(i * 7919 % size);
+                for (int i = 0; i < size; i += 2)
+                    trees[t]->remove(i);
+            } catch (std::exception& e) {
+                errors[t] = e.what();
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+
+    // print the trees and the allocator counters
+    for (unsigned t = 0; t < threads; ++t) {
+        cout << "  thread " << t << ": ";
+        if (errors[t].empty())
+            cout << "size " << trees[t]->size() << endl;
+        else
+            cout << "!!! " << errors[t] << endl;
+    }
+    SimpleAllocatorStats stats = allocator.getStats();
+    cout << "  allocations: " << stats.allocations << ", deallocations: " << stats.deallocations
+         << ", objectsInUse: " << stats.objectsInUse << endl;
+    cout << "  objectsInUse + freeObjects = pagesInUse * objectsPerPage: "
+         << (stats.objectsInUse + stats.freeObjects == stats.pagesInUse * 64 ? "yes" : "no") << endl;
+
+    // the trees give their nodes back on destruction
+    for (AVL<int>* tree : trees)
+        delete tree;
+    stats = allocator.getStats();
+    cout << "  objectsInUse after destroying the trees: " << stats.objectsInUse << endl;
+
+    // the peak is kept up to date when the objects come from the C++ memory manager too
+    SimpleAllocatorConfig cppConfig(true);
+    cppConfig.concurrency = SimpleAllocatorConfig::LOCK_FREE;
+    SimpleAllocator cppAllocator(sizeof(AVL<int>::BinTreeNode), cppConfig);
+    std::vector<void*> objects;
+    for (int i = 0; i < 10; ++i)
+        objects.push_back(cppAllocator.allocate());
+    for (void* pObject : objects)
+        cppAllocator.free(pObject);
+    stats = cppAllocator.getStats();
+    cout << "  with the C++ memory manager, mostObjects after 10 allocations and frees: " << stats.mostObjects
+         << ", objectsInUse: " << stats.objectsInUse << endl;
+    cout << endl;
+}
+
+/**
+ * @brief Stress a shared THREAD_CACHED allocator from several threads
+ *        - the magazines are small, so every thread refills and flushes its own often
+ *        - the threads free nodes that other threads allocated (the main thread
+ *          destroys the first trees), and their magazines are folded back into the
+ *          allocator when they exit
+ *        - only the deterministic results are printed (sizes and counts),
+ *          the number of pages depends on how the threads interleave
+ * @param threads number of threads
+ * @param size number of ints each thread adds (half of them are removed again)
+ */
+void stressThreadCached(unsigned threads, int size) {
+    cout << "Running stressThreadCached..." << endl;
+    cout << endl;
+
+    // one allocator shared by all the trees, with magazines of 8 blocks
+    SimpleAllocatorConfig config(false, 64, 0);
+    config.concurrency = SimpleAllocatorConfig::THREAD_CACHED;
+    config.magazineSize = 8;
+    SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), config);
+
+    // every thread adds its ints and then removes the even ones, into a tree that outlives it
+    std::vector<AVL<int>*> trees;
+    for (unsigned t = 0; t < threads; ++t)
+        trees.push_back(new AVL<int>(&allocator));
+    std::vector<std::thread> workers;
+    std::vector<std::string> errors(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            try {
+                for (int i = 0; i < size; ++i)
+                    trees[t]->add(i * 7919 % size);
+                for (int i = 0; i < size; i += 2)
+                    trees[t]->remove(i);
+            } catch (std::exception& e) {
+                errors[t] = e.what();
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+
+    // the threads are gone, so their magazines are back on the shared free list
+    for (unsigned t = 0; t < threads; ++t) {
+        cout << "  thread " << t << ": ";
+        if (errors[t].empty())
+            cout << "size " << trees[t]->size() << endl;
+        else
+            cout << "!!! " << errors[t] << endl;
+    }
+    SimpleAllocatorStats stats = allocator.getStats();
+    cout << "  allocations: " << stats.allocations << ", deallocations: " << stats.deallocations
+         << ", objectsInUse: " << stats.objectsInUse << endl;
+    cout << "  objectsInUse + freeObjects = pagesInUse * objectsPerPage: "
+         << (stats.objectsInUse + stats.freeObjects == stats.pagesInUse * 64 ? "yes" : "no") << endl;
+
+    // then the threads churn trees of their own while the main thread destroys the first ones
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            try {
+                for (int round = 0; round < 4; ++round) {
+                    AVL<int> churned(&allocator);
+                    for (int i = 0; i < size / 4; ++i)
+                        churned.add(i * 7919 % (size / 4));
+                    for (int i = 0; i < size / 4; i += 3)
+                        churned.remove(i);
+                }
+            } catch (std::exception& e) {
+                errors[t] = e.what();
+            }
+        });
+    }
+    for (AVL<int>* tree : trees)
+        delete tree;
+    for (std::thread& worker : workers)
+        worker.join();
+    for (unsigned t = 0; t < threads; ++t) {
+        if (!errors[t].empty())
+            cout << "  thread " << t << ": !!! " << errors[t] << endl;
+    }
+
+    // every node has come back, through one magazine or another
+    stats = allocator.getStats();
+    cout << "  after churning and destroying the trees, allocations: " << stats.allocations
+         << ", deallocations: " << stats.deallocations << endl;
+    cout << "  allocations == deallocations: " << (stats.allocations == stats.deallocations ? "yes" : "no")
+         << ", objectsInUse: " << stats.objectsInUse << endl;
+    cout << "  freeObjects = pagesInUse * objectsPerPage: "
+         << (stats.freeObjects == stats.pagesInUse * 64 ? "yes" : "no") << endl;
+    cout << endl;
+}
+
 /**
  * The main function that configure and run all the test cases.
  * NOTE that in the practical test, the actual test cases will be
@@ -529,6 +733,1196 @@ int main(int argc, char* argv[]) {
         inorderSS = avl.printInorder();
         cout << "Inorder traversal: " << inorderSS.str() << endl;
         break;
+    case 7:
+        cout << "=== Test several AVL trees sharing a lock-free allocator across threads ===" << endl << endl;
+        stressLockFree(4, 5000);
+        break;
+    case 8: {
+        cout << "=== Test clearing a large AVL tree with batched frees ===" << endl << endl;
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 64, 0));
+        AVL<int> bigAVL(&allocator);
+        addInts<int>(bigAVL, 1000, true, true);
+        removeInts<int>(bigAVL, true);
+        SimpleAllocatorStats stats = allocator.getStats();
+        cout << "allocations: " << stats.allocations << ", deallocations: " << stats.deallocations
+             << ", objectsInUse: " << stats.objectsInUse << ", freeObjects: " << stats.freeObjects << endl;
+        break;
+    }
+    case 9: {
+        cout << "=== Test throwing away AVL trees backed by an arena ===" << endl << endl;
+        SimpleAllocatorConfig config(false, 64, 0);
+        config.isArena = true;
+        SimpleAllocator arena(sizeof(AVL<int>::BinTreeNode), config);
+        for (int round = 0; round < 3; ++round) {
+            {
+                AVL<int> arenaAVL(&arena);
+                addInts<int>(arenaAVL, 20, false, round > 0);
+                findInt<int>(arenaAVL, 7);
+            }
+            SimpleAllocatorStats stats = arena.getStats();
+            cout << "round " << round << " before reset, objectsInUse: " << stats.objectsInUse
+                 << ", pagesInUse: " << stats.pagesInUse << endl;
+            arena.reset();
+            stats = arena.getStats();
+            cout << "round " << round << " after reset, objectsInUse: " << stats.objectsInUse
+                 << ", freeObjects: " << stats.freeObjects << ", deallocations: " << stats.deallocations << endl
+                 << endl;
+        }
+        break;
+    }
+    case 10: {
+        cout << "=== Test handing the pages of a cleared AVL tree back to the OS ===" << endl << endl;
+        SimpleAllocatorConfig config(false, 64, 0);
+        config.mapPages = true;
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), config);
+        AVL<int> bigAVL(&allocator);
+        addInts<int>(bigAVL, 1000, true, true);
+        SimpleAllocatorStats stats = allocator.getStats();
+        cout << "after adding, pagesInUse: " << stats.pagesInUse << ", objectsInUse: " << stats.objectsInUse << endl;
+        bigAVL.clear();
+        stats = allocator.getStats();
+        cout << "after clearing, pagesInUse: " << stats.pagesInUse << ", freeObjects: " << stats.freeObjects << endl;
+        cout << "trim handed back " << allocator.trim() << " pages" << endl;
+        stats = allocator.getStats();
+        cout << "after trimming, pagesInUse: " << stats.pagesInUse << ", freeObjects: " << stats.freeObjects
+             << ", pagesReclaimed: " << stats.pagesReclaimed << endl << endl;
+        addInts<int>(bigAVL, 100, true, true);
+        stats = allocator.getStats();
+        cout << "after adding again, pagesInUse: " << stats.pagesInUse << ", objectsInUse: " << stats.objectsInUse
+             << endl;
+        break;
+    }
+    case 11: {
+        cout << "=== Test growing the pages of a growing AVL tree geometrically ===" << endl << endl;
+        // the page sizes depend on the node size, so only how they compare is printed
+        SimpleAllocatorConfig fixedConfig(false, 4, 0);
+        SimpleAllocator fixedAllocator(sizeof(AVL<int>::BinTreeNode), fixedConfig);
+        AVL<int> fixedAVL(&fixedAllocator);
+        addInts<int>(fixedAVL, 1000, true, true);
+        SimpleAllocatorStats stats = fixedAllocator.getStats();
+        cout << "fixed pages, pagesInUse: " << stats.pagesInUse << ", largest page is the first: " << std::boolalpha
+             << (stats.largestPageSize == stats.pageSize) << endl << endl;
+
+        SimpleAllocatorConfig config(false, 4, 0);
+        config.pageGrowth = SimpleAllocatorConfig::GEOMETRIC_PAGES;
+        config.maxObjectsPerPage = 256;
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), config);
+        AVL<int> bigAVL(&allocator);
+        addInts<int>(bigAVL, 1000, true, true);
+        stats = allocator.getStats();
+        cout << "geometric pages, at most 10 pages: " << (stats.pagesInUse <= 10)
+             << ", largest page bigger than the first: " << (stats.largestPageSize > stats.pageSize)
+             << ", objectsInUse: " << stats.objectsInUse << endl;
+        bigAVL.clear();
+        cout << "trim handed back all pages: " << (allocator.trim() == stats.pagesInUse) << endl;
+        stats = allocator.getStats();
+        cout << "after trimming, pagesInUse: " << stats.pagesInUse << ", pageBytes: " << stats.pageBytes
+             << std::noboolalpha << endl;
+        break;
+    }
+    case 12: {
+        cout << "=== Test one size class allocator for objects and trees of several sizes ===" << endl << endl;
+        SizeClassAllocator pool(SimpleAllocatorConfig(false, 16, 0));
+        for (size_t size : {1, 8, 9, 100, 128, 129, 300, 1024}) {
+            const size_t sizeClass = SizeClassAllocator::sizeClassOf(size);
+            cout << "size: " << size << ", size class: " << sizeClass
+                 << ", class size: " << SizeClassAllocator::classSize(sizeClass) << endl;
+        }
+        try {
+            pool.allocate(SIZE_CLASS_MAX_SIZE + 1);
+        } catch (const SimpleAllocatorException& e) {
+            cout << "exception: " << e.what() << endl;
+        }
+        cout << endl;
+
+        // raw objects of a few sizes
+        std::vector<void*> objects;
+        for (size_t size : {24, 24, 100, 100, 100}) {
+            objects.push_back(pool.allocate(size));
+            std::memset(objects.back(), 0, size);
+        }
+        SimpleAllocatorStats stats = pool.getClassStats(SizeClassAllocator::sizeClassOf(100));
+        cout << "class of 100 bytes, objectSize: " << stats.objectSize << ", objectsInUse: " << stats.objectsInUse
+             << endl << endl;
+
+        // and two trees of different node types sharing the pool
+        AVL<int> intAVL(&pool.allocatorFor(sizeof(AVL<int>::BinTreeNode)));
+        AVL<double> doubleAVL(&pool.allocatorFor(sizeof(AVL<double>::BinTreeNode)));
+        addInts<int>(intAVL, 100, true, true);
+        for (int i = 0; i < 50; ++i)
+            doubleAVL.add(i + 0.5);
+        stats = pool.getStats();
+        cout << "combined, objectsInUse: " << stats.objectsInUse << ", allocations: " << stats.allocations << endl;
+
+        const size_t sizes[] = {24, 24, 100, 100, 100};
+        for (size_t i = 0; i < objects.size(); ++i)
+            pool.free(objects[i], sizes[i]);
+        intAVL.clear();
+        doubleAVL.clear();
+        stats = pool.getStats();
+        cout << "after freeing, objectsInUse: " << stats.objectsInUse << ", deallocations: " << stats.deallocations
+             << endl;
+        break;
+    }
+    case 13: {
+        cout << "=== Test standard containers on a SimpleAllocator pool next to an AVL tree ===" << endl << endl;
+        // a default config: every size class is aligned for objects of its size on its own
+        SizeClassAllocator pool(SimpleAllocatorConfig(false, 16, 0));
+        SimpleAllocatorAdapter<int> adapter(pool);
+        std::set<int, std::less<int>, SimpleAllocatorAdapter<int>> intSet(adapter);
+        std::map<int, int, std::less<int>, SimpleAllocatorAdapter<std::pair<const int, int>>> intMap(adapter);
+        std::list<int, SimpleAllocatorAdapter<int>> intList(adapter);
+        AVL<int> intAVL(&pool.allocatorFor(sizeof(AVL<int>::BinTreeNode)));
+        for (int i = 0; i < 100; ++i) {
+            intSet.insert(i * 7 % 100);
+            intAVL.add(i * 7 % 100);
+            if (i % 2 == 0)
+                intMap[i] = i * i;
+            if (i % 5 == 0)
+                intList.push_back(i);
+        }
+        cout << "set size: " << intSet.size() << ", AVL size: " << intAVL.size() << ", map size: " << intMap.size()
+             << ", list size: " << intList.size() << endl;
+        unsigned compares = 0;
+        bool allFound = true;
+        for (int value : intSet)
+            allFound = allFound && intAVL.find(value, compares);
+        cout << "every set value in the AVL: " << std::boolalpha << allFound << ", first: " << *intSet.begin() << ", last: " << *intSet.rbegin() << ", map[42]: " << intMap[42]
+             << endl;
+        SimpleAllocatorStats stats = pool.getStats();
+        cout << "pool objectsInUse: " << stats.objectsInUse << endl;
+
+        // adapters are equal when they share a pool, whatever their value type
+        SizeClassAllocator otherPool(SimpleAllocatorConfig(false, 16, 0));
+        cout << "same pool equal: " << (adapter == SimpleAllocatorAdapter<double>(pool))
+             << ", other pool equal: " << (adapter == SimpleAllocatorAdapter<int>(otherPool)) << endl;
+
+        // the pool follows the container on assignment
+        SimpleAllocatorAdapter<int> otherAdapter(otherPool);
+        std::set<int, std::less<int>, SimpleAllocatorAdapter<int>> copySet(otherAdapter);
+        copySet = intSet;
+        cout << "copy uses the first pool: " << (copySet.get_allocator() == adapter) << std::noboolalpha << endl;
+        stats = pool.getStats();
+        cout << "pool objectsInUse after copying: " << stats.objectsInUse << endl;
+
+        copySet.clear();
+        intSet.clear();
+        intMap.clear();
+        intList.clear();
+        intAVL.clear();
+        stats = pool.getStats();
+        cout << "after clearing, pool objectsInUse: " << stats.objectsInUse << ", deallocations: " << stats.deallocations
+             << endl;
+
+        // objects aligned beyond their size class go to operator new, the others to the pool
+        struct Triple {
+            double values[3];
+        };
+        struct alignas(64) Line {
+            char bytes[64];
+        };
+        SimpleAllocatorAdapter<Triple> tripleAdapter(pool);
+        SimpleAllocatorAdapter<Line> lineAdapter(pool);
+        Triple* pTriple = tripleAdapter.allocate(1);
+        Line* pLine = lineAdapter.allocate(1);
+        stats = pool.getStats();
+        cout << "Triple pooled: " << std::boolalpha << (stats.objectsInUse == 1)
+             << ", aligned: " << (reinterpret_cast<uintptr_t>(pTriple) % alignof(Triple) == 0)
+             << ", Line aligned on 64: " << (reinterpret_cast<uintptr_t>(pLine) % 64 == 0) << std::noboolalpha << endl;
+        tripleAdapter.deallocate(pTriple, 1);
+        lineAdapter.deallocate(pLine, 1);
+        stats = pool.getStats();
+        cout << "after deallocating, pool objectsInUse: " << stats.objectsInUse << endl;
+
+        // unless the configured boundary already aligns the class for them
+        SizeClassAllocator widePool(SimpleAllocatorConfig(false, 16, 0, SimpleAllocatorConfig::HeaderBlockInfo(), 64));
+        SimpleAllocatorAdapter<Line> wideAdapter(widePool);
+        pLine = wideAdapter.allocate(1);
+        stats = widePool.getStats();
+        cout << "Line pooled with a 64 byte boundary: " << std::boolalpha << (stats.objectsInUse == 1)
+             << ", aligned on 64: " << (reinterpret_cast<uintptr_t>(pLine) % 64 == 0) << std::noboolalpha << endl;
+        wideAdapter.deallocate(pLine, 1);
+        break;
+    }
+    case 14: {
+        cout << "=== Test sweeping the pad bytes of every page for overruns ===" << endl << endl;
+        SimpleAllocatorConfig config(false, 8, 0, SimpleAllocatorConfig::HeaderBlockInfo(), 0, 24, true);
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), config);
+        AVL<int> bigAVL(&allocator);
+        addInts<int>(bigAVL, 100, true, true);
+        cout << "corrupted blocks before the overruns: " << allocator.validatePages().size() << endl;
+
+        // overrun two blocks in use and underrun a free one
+        std::vector<unsigned char*> blocks;
+        for (int i = 0; i < 3; ++i)
+            blocks.push_back(static_cast<unsigned char*>(allocator.allocate()));
+        allocator.free(blocks[2]);
+        blocks[0][sizeof(AVL<int>::BinTreeNode)] = 0;
+        blocks[1][sizeof(AVL<int>::BinTreeNode) + 23] = 0;
+        blocks[2][-1] = 0;
+        std::vector<void*> corrupted = allocator.validatePages();
+        cout << "corrupted blocks after the overruns: " << corrupted.size() << endl;
+        for (int i = 0; i < 3; ++i) {
+            cout << "  block " << i << " reported: " << std::boolalpha
+                 << (std::find(corrupted.begin(), corrupted.end(), blocks[i]) != corrupted.end()) << std::noboolalpha
+                 << endl;
+        }
+        try {
+            allocator.free(blocks[0]);
+        } catch (const SimpleAllocatorException& e) {
+            cout << "free of block 0, exception: " << e.what() << endl;
+        }
+
+        // repair the pads so that the blocks can go back
+        blocks[0][sizeof(AVL<int>::BinTreeNode)] = SimpleAllocator::PAD_PATTERN;
+        blocks[1][sizeof(AVL<int>::BinTreeNode) + 23] = SimpleAllocator::PAD_PATTERN;
+        blocks[2][-1] = SimpleAllocator::PAD_PATTERN;
+        allocator.free(blocks[0]);
+        allocator.free(blocks[1]);
+        cout << "corrupted blocks after the repair: " << allocator.validatePages().size() << endl;
+        break;
+    }
+    case 15: {
+        cout << "=== Test external header block infos and interned labels ===" << endl << endl;
+        SimpleAllocatorConfig config(false, 4, 0, SimpleAllocatorConfig::HeaderBlockInfo(SimpleAllocatorConfig::EXTERNAL_HEADER));
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), config);
+        auto blockInfo = [&](void* pBlock) {
+            MemBlockInfo* pInfo;
+            std::memcpy(&pInfo, static_cast<unsigned char*>(pBlock) - config.headerBlockInfo.size, sizeof(MemBlockInfo*));
+            return pInfo;
+        };
+
+        // the same label from two different buffers is stored once
+        char nodeLabel[] = "node";
+        const char* labels[] = {"node", nodeLabel, "leaf", "node", nullptr, "leaf"};
+        std::vector<void*> blocks;
+        for (const char* pLabel : labels)
+            blocks.push_back(allocator.allocate(pLabel));
+        for (void* pBlock : blocks) {
+            const MemBlockInfo* pInfo = blockInfo(pBlock);
+            cout << "allocNum: " << pInfo->allocNum << ", inUse: " << pInfo->inUse
+                 << ", label: " << (pInfo->pLabel ? pInfo->pLabel : "(none)") << endl;
+        }
+        cout << std::boolalpha << "\"node\" labels shared: "
+             << (blockInfo(blocks[0])->pLabel == blockInfo(blocks[1])->pLabel
+                 && blockInfo(blocks[0])->pLabel == blockInfo(blocks[3])->pLabel)
+             << ", \"leaf\" labels shared: " << (blockInfo(blocks[2])->pLabel == blockInfo(blocks[5])->pLabel)
+             << ", distinct labels apart: " << (blockInfo(blocks[0])->pLabel != blockInfo(blocks[2])->pLabel) << endl;
+
+        // a freed block's info goes back to the slab for the next block
+        MemBlockInfo* pFreedInfo = blockInfo(blocks[2]);
+        allocator.free(blocks[2]);
+        cout << "freed block has an info: " << (blockInfo(blocks[2]) != nullptr) << endl;
+        blocks[2] = allocator.allocate("root");
+        cout << "info reused: " << (blockInfo(blocks[2]) == pFreedInfo) << ", label: " << blockInfo(blocks[2])->pLabel
+             << std::noboolalpha << endl << endl;
+
+        // the first two blocks are left in use, their infos go with the allocator
+        for (size_t i = 2; i < blocks.size(); ++i)
+            allocator.free(blocks[i]);
+        AVL<int> avl(&allocator);
+        addInts<int>(avl, 20, true, true);
+        break;
+    }
+    case 16: {
+        cout << "=== Test the compact AVL tree with 32-bit node indices ===" << endl << endl;
+        cout << "compact node size for int: " << sizeof(CompactAVL<int>::Node) << endl;
+
+        // the same shuffled values in a compact tree and a regular one
+        const int size = 100;
+        int values[size];
+        generateShuffledInts(size, values);
+        SimpleAllocatorConfig config(false, 2, 0, SimpleAllocatorConfig::HeaderBlockInfo(), 64);
+        SimpleAllocator allocator(CompactAVL<int>::CHUNK_SIZE, config);
+        CompactAVL<int> compact(&allocator);
+        AVL<int> avl;
+        for (int value : values) {
+            compact.add(value);
+            avl.add(value);
+        }
+        cout << "compact size: " << compact.size() << ", height: " << compact.height()
+             << ", chunks in use: " << allocator.getStats().objectsInUse << endl;
+        cout << std::boolalpha << "same inorder as AVL: " << (compact.printInorder().str() == avl.printInorder().str())
+             << ", same height: " << (compact.height() == avl.height()) << std::noboolalpha << endl;
+        for (int value : {0, 50, 99, 100}) {
+            unsigned compares = 0;
+            const bool found = compact.find(value, compares);
+            cout << "  Value " << value << " is " << (found ? "FOUND " : "NOT FOUND ") << "after " << compares
+                 << " compares" << endl;
+        }
+        try {
+            compact.add(50);
+        } catch (const BSTException& e) {
+            cout << "add of 50 again, exception: " << e.what() << endl;
+        }
+
+        // remove every other value, then add them back into the freed nodes
+        for (int i = 0; i < size; i += 2)
+            compact.remove(i);
+        cout << "after removing the even values, size: " << compact.size() << ", height: " << compact.height()
+             << endl << "inorder: " << compact.printInorder().str() << endl;
+        try {
+            compact.remove(0);
+        } catch (const BSTException& e) {
+            cout << "remove of 0 again, exception: " << e.what() << endl;
+        }
+        for (int i = 0; i < size; i += 2)
+            compact.add(i);
+        cout << "after adding them back, size: " << compact.size() << ", height: " << compact.height()
+             << ", chunks in use: " << allocator.getStats().objectsInUse << endl;
+        compact.clear();
+        cout << "after clearing, size: " << compact.size() << ", chunks in use: " << allocator.getStats().objectsInUse
+             << endl;
+
+        // chunks must fit in the allocator's objects
+        try {
+            SimpleAllocator smallAllocator(sizeof(AVL<int>::BinTreeNode), config);
+            CompactAVL<int> badCompact(&smallAllocator);
+        } catch (const SimpleAllocatorException& e) {
+            cout << "small allocator, exception: " << e.what() << endl;
+        }
+        break;
+    }
+    case 17: {
+        cout << "=== Test the cached balance factors and counts through many adds and removes ===" << endl << endl;
+        int height;
+        unsigned count;
+        addInts<int>(avl, 1000, false, true);
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl << endl;
+        removeInts<int>(avl, false, 700, false, true);
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl << endl;
+        for (int i = 1000; i < 1500; ++i)
+            avl.add(i);
+        printStats(avl);
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl << endl;
+        findInt(avl, 1499);
+        break;
+    }
+    case 18: {
+        cout << "=== Test O(1) size and height through adds, removes and clear ===" << endl << endl;
+        cout << "empty, height: " << avl.height() << ", size: " << avl.size() << endl;
+
+        // compare with the heights and counts of the subtrees after every operation
+        const int size = 300;
+        int values[size];
+        generateShuffledInts(size, values);
+        bool matched = true;
+        int height;
+        unsigned count;
+        for (int value : values) {
+            avl.add(value);
+            matched = checkNodeStats<int>(avl.root(), height, count) && matched && height == avl.height()
+                      && count == avl.size();
+        }
+        cout << "after adding " << size << ", height: " << avl.height() << ", size: " << avl.size() << endl;
+        for (int i = 0; i < size; i += 2) {
+            avl.remove(values[i]);
+            matched = checkNodeStats<int>(avl.root(), height, count) && matched && height == avl.height()
+                      && count == avl.size();
+        }
+        cout << "after removing half, height: " << avl.height() << ", size: " << avl.size() << endl;
+        for (int i = 1; i < size; i += 2) {
+            avl.remove(values[i]);
+            matched = checkNodeStats<int>(avl.root(), height, count) && matched && height == avl.height()
+                      && count == avl.size();
+        }
+        cout << "after removing the rest, height: " << avl.height() << ", size: " << avl.size() << endl;
+        cout << "matched the subtrees after every operation: " << std::boolalpha << matched << std::noboolalpha
+             << endl << endl;
+
+        addInts<int>(avl, 10, true, true);
+        avl.clear();
+        cout << "after clearing, height: " << avl.height() << ", size: " << avl.size() << endl;
+        break;
+    }
+    case 19: {
+        cout << "=== Test order statistics: select, rank, percentile and median ===" << endl << endl;
+
+        // the multiples of 3 below 300, in random order
+        const int size = 100;
+        int values[size];
+        generateShuffledInts(size, values);
+        for (int value : values)
+            avl.add(value * 3);
+        printStats(avl);
+        for (unsigned k : {0u, 1u, 50u, 99u})
+            cout << "select(" << k << "): " << avl.select(k) << endl;
+        for (int value : {0, 150, 151, -5, 1000})
+            cout << "rank(" << value << "): " << avl.rank(value) << endl;
+        for (double percent : {0.0, 7.0, 14.0, 25.0, 28.0, 50.0, 55.0, 56.0, 90.0, 99.5, 100.0})
+            cout << "percentile(" << percent << "): " << avl.percentile(percent) << endl;
+        cout << "median: " << avl.median() << endl;
+
+        // every whole percentile is the value of its nearest rank, computed with integers
+        bool nearestRanks = true;
+        for (unsigned percent = 1; percent <= 100; ++percent)
+            nearestRanks = nearestRanks && avl.percentile(percent) == avl.select((percent * avl.size() + 99) / 100 - 1);
+        cout << "percentile(p) == select(ceil(p * size / 100) - 1) for every whole p: " << std::boolalpha
+             << nearestRanks << std::noboolalpha << endl;
+
+        bool roundTrips = true;
+        for (unsigned k = 0; k < avl.size(); ++k)
+            roundTrips = roundTrips && avl.rank(avl.select(k)) == k;
+        cout << "rank(select(k)) == k for every k: " << std::boolalpha << roundTrips << std::noboolalpha << endl;
+        try {
+            avl.select(avl.size());
+        } catch (const BSTException& e) {
+            cout << "select past the end, exception: " << e.what() << endl;
+        }
+        try {
+            avl.percentile(101);
+        } catch (const BSTException& e) {
+            cout << "percentile of 101, exception: " << e.what() << endl;
+        }
+
+        // the counts follow the removes
+        for (int i = 0; i < size / 2; ++i)
+            avl.remove(values[i] * 3);
+        cout << endl << "after removing half, size: " << avl.size() << ", median: " << avl.median()
+             << ", select(0): " << avl.select(0) << ", rank(150): " << avl.rank(150) << endl;
+        avl.clear();
+        try {
+            avl.median();
+        } catch (const BSTException& e) {
+            cout << "median of an empty tree, exception: " << e.what() << endl;
+        }
+        break;
+    }
+    case 20: {
+        cout << "=== Test bulk construction: buildFromSorted and assign ===" << endl << endl;
+
+        // the even numbers below 40, straight into a balanced tree
+        std::vector<int> sorted;
+        for (int i = 0; i < 20; ++i)
+            sorted.push_back(i * 2);
+        avl.buildFromSorted(sorted.begin(), sorted.end());
+        printStats(avl);
+        printAVL(avl);
+        int height;
+        unsigned count;
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl << endl;
+
+        // the tree keeps working as usual afterwards
+        for (int value : {1, 3, 5, 7})
+            avl.add(value);
+        avl.remove(20);
+        cout << "after 4 adds and a remove: " << avl.printInorder().str() << endl;
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl << endl;
+
+        // values out of order leave the tree as it was
+        const int unsorted[] = {1, 2, 4, 3};
+        try {
+            avl.buildFromSorted(unsorted, unsorted + 4);
+        } catch (const BSTException& e) {
+            cout << "unsorted values, exception: " << e.what() << endl;
+        }
+        cout << "size after the failed build: " << avl.size() << endl << endl;
+
+        // any order, duplicates included
+        const int size = 50;
+        int values[size];
+        generateShuffledInts(size, values);
+        std::vector<int> shuffled(values, values + size);
+        shuffled.insert(shuffled.end(), values, values + size / 2);
+        avl.assign(shuffled.begin(), shuffled.end());
+        printStats(avl);
+        cout << "inorder: " << avl.printInorder().str() << endl;
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl;
+
+        std::vector<int> none;
+        avl.assign(none.begin(), none.end());
+        printAVL(avl);
+        break;
+    }
+    case 21: {
+        cout << "=== Test join, split and set algebra: unionWith, intersectWith and difference ===" << endl << endl;
+        int height;
+        unsigned count;
+
+        // split the multiples of 3 around a value in the tree, then join them back
+        for (int i = 0; i < 20; ++i)
+            avl.add(i * 3);
+        AVL<int> greater;
+        const bool found = avl.split(30, greater);
+        cout << "split(30) found: " << std::boolalpha << found << std::noboolalpha << endl;
+        cout << "  less: " << avl.printInorder().str() << endl;
+        cout << "  greater: " << greater.printInorder().str() << endl;
+        cout << "  both consistent: " << std::boolalpha
+             << (checkNodeStats<int>(avl.root(), height, count) && height == avl.height()
+                 && checkNodeStats<int>(greater.root(), height, count) && height == greater.height())
+             << std::noboolalpha << endl;
+        try {
+            avl.join(100, greater);
+        } catch (const BSTException& e) {
+            cout << "join(100), exception: " << e.what() << endl;
+        }
+        avl.join(31, greater);
+        cout << "join(31): " << avl.printInorder().str() << endl;
+        cout << "  greater size: " << greater.size() << endl;
+        printStats(avl);
+        printAVL(avl);
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl << endl;
+
+        // the multiples of 3 against the even numbers below 60
+        AVL<int> evens;
+        for (int i = 0; i < 30; ++i)
+            evens.add(i * 2);
+        avl.remove(31);
+        avl.unionWith(evens);
+        cout << "union with evens: " << avl.printInorder().str() << endl;
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl;
+
+        avl.clear();
+        for (int i = 0; i < 20; ++i)
+            avl.add(i * 3);
+        avl.intersectWith(evens);
+        cout << "intersection with evens: " << avl.printInorder().str() << endl;
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl;
+
+        avl.clear();
+        for (int i = 0; i < 20; ++i)
+            avl.add(i * 3);
+        avl.difference(evens);
+        cout << "difference with evens: " << avl.printInorder().str() << endl;
+        cout << "every node consistent: " << std::boolalpha << checkNodeStats<int>(avl.root(), height, count)
+             << std::noboolalpha << ", height: " << height << ", count: " << count << endl;
+        cout << "evens untouched, size: " << evens.size() << endl;
+        break;
+    }
+    case 22: {
+        cout << "=== Test iterators: begin/end, reverse, lower_bound and upper_bound ===" << endl << endl;
+        cout << "empty tree, begin() == end(): " << std::boolalpha << (avl.begin() == avl.end()) << std::noboolalpha
+             << endl;
+
+        // the multiples of 5 below 100, in random order
+        const int size = 20;
+        int values[size];
+        generateShuffledInts(size, values);
+        for (int value : values)
+            avl.add(value * 5);
+
+        cout << "forward: ";
+        long long sum = 0;
+        for (int value : avl) {
+            cout << value << " ";
+            sum += value;
+        }
+        cout << endl << "sum: " << sum << ", distance: " << std::distance(avl.begin(), avl.end()) << endl;
+        cout << "reverse: ";
+        for (auto it = avl.rbegin(); it != avl.rend(); ++it)
+            cout << *it << " ";
+        cout << endl;
+        cout << "backward from end(): ";
+        for (auto it = avl.end(); it != avl.begin();)
+            cout << *--it << " ";
+        cout << endl << endl;
+
+        for (int value : {-1, 0, 42, 45, 95, 100}) {
+            auto lower = avl.lower_bound(value);
+            auto upper = avl.upper_bound(value);
+            cout << "lower_bound(" << value << "): ";
+            if (lower == avl.end())
+                cout << "end";
+            else
+                cout << *lower;
+            cout << ", upper_bound(" << value << "): ";
+            if (upper == avl.end())
+                cout << "end";
+            else
+                cout << *upper;
+            cout << endl;
+        }
+
+        // a window of values, then the steps back out of it
+        cout << "[30, 60): ";
+        auto last = avl.lower_bound(60);
+        for (auto it = avl.lower_bound(30); it != last; it++)
+            cout << *it << " ";
+        cout << endl << "3 before 60: ";
+        for (int i = 0; i < 3; ++i)
+            cout << *--last << " ";
+        cout << endl;
+        break;
+    }
+    case 23: {
+        cout << "=== Test range queries: countInRange and forEachInRange ===" << endl << endl;
+
+        // the multiples of 4 below 200, in random order
+        const int size = 50;
+        int values[size];
+        generateShuffledInts(size, values);
+        for (int value : values)
+            avl.add(value * 4);
+
+        const std::pair<int, int> ranges[] = {{0, 199}, {10, 30}, {12, 28}, {-50, 3}, {196, 500}, {60, 40}, {201, 300}};
+        for (const auto& range : ranges) {
+            cout << "[" << range.first << ", " << range.second << "], count: "
+                 << avl.countInRange(range.first, range.second) << ", values:";
+            avl.forEachInRange(range.first, range.second, [](int value) { cout << " " << value; });
+            cout << endl;
+        }
+
+        // the visitor stops the walk by returning false
+        int visited = 0;
+        const bool completed = avl.forEachInRange(100, 199, [&visited](int value) {
+            cout << (visited ? " " : "first 3 from 100: ") << value;
+            return ++visited < 3;
+        });
+        cout << endl << "completed: " << std::boolalpha << completed << std::noboolalpha << ", visited: " << visited
+             << endl;
+
+        // the counts follow the removes
+        for (int value = 0; value < 100; value += 8)
+            avl.remove(value);
+        cout << "after removing the multiples of 8 below 100, [0, 99] count: " << avl.countInRange(0, 99)
+             << ", values:";
+        avl.forEachInRange(0, 99, [](int value) { cout << " " << value; });
+        cout << endl;
+        break;
+    }
+    case 24: {
+        cout << "=== Test batched lookups: findMany against find ===" << endl << endl;
+        const int none[] = {1};
+        bool noneFound[1];
+        cout << "empty tree, found: " << avl.findMany(none, 1, noneFound) << " (" << std::boolalpha << noneFound[0]
+             << std::noboolalpha << ")" << endl;
+
+        // the multiples of 3 below 300, looked up with every int below 60 (more than a group)
+        for (int i = 0; i < 100; ++i)
+            avl.add(i * 3);
+        const int size = 60;
+        int values[size];
+        generateShuffledInts(size, values);
+        bool results[size];
+        cout << "found: " << avl.findMany(values, size, results) << endl;
+        bool matched = true;
+        for (int i = 0; i < size; ++i) {
+            unsigned compares;
+            matched = matched && results[i] == avl.find(values[i], compares);
+        }
+        cout << "same as find for every value: " << std::boolalpha << matched << std::noboolalpha << endl;
+        cout << "found among 0..19:";
+        for (int i = 0; i < size; ++i) {
+            if (values[i] < 20 && results[i])
+                cout << " " << values[i];
+        }
+        cout << endl;
+        cout << "no values, found: " << avl.findMany(values, 0, results) << endl;
+        break;
+    }
+    case 25: {
+        cout << "=== Test frozen snapshots: freeze, find, bounds, rank and ranges ===" << endl << endl;
+
+        // the multiples of 5 below 100, in random order
+        const int size = 20;
+        int values[size];
+        generateShuffledInts(size, values);
+        for (int value : values)
+            avl.add(value * 5);
+        FrozenAVL<int> frozen = avl.freeze();
+        cout << "frozen, height: " << frozen.height() << ", size: " << frozen.size() << endl;
+        cout << "forward:";
+        for (int value : frozen)
+            cout << " " << value;
+        cout << endl << "backward:";
+        for (auto it = frozen.end(); it != frozen.begin();)
+            cout << " " << *--it;
+        cout << endl << endl;
+
+        for (int value : {-5, 0, 42, 45, 95, 100}) {
+            unsigned compares;
+            const bool found = frozen.find(value, compares);
+            auto lower = frozen.lower_bound(value);
+            auto upper = frozen.upper_bound(value);
+            cout << value << ": found: " << std::boolalpha << found << std::noboolalpha << ", compares: " << compares
+                 << ", rank: " << frozen.rank(value) << ", lower_bound: ";
+            if (lower == frozen.end())
+                cout << "end";
+            else
+                cout << *lower;
+            cout << ", upper_bound: ";
+            if (upper == frozen.end())
+                cout << "end";
+            else
+                cout << *upper;
+            cout << endl;
+        }
+        cout << "[12, 48], count: " << frozen.countInRange(12, 48) << ", values:";
+        frozen.forEachInRange(12, 48, [](int value) { cout << " " << value; });
+        cout << endl << endl;
+
+        // the snapshot does not change with the tree
+        avl.clear();
+        avl.add(1000);
+        unsigned compares;
+        cout << "after clearing the tree, snapshot size: " << frozen.size() << ", 50 found: " << std::boolalpha
+             << frozen.find(50, compares) << ", 1000 found: " << frozen.find(1000, compares) << std::noboolalpha
+             << endl;
+        FrozenAVL<int> empty = AVL<int>().freeze();
+        cout << "empty snapshot, height: " << empty.height() << ", begin() == end(): " << std::boolalpha
+             << (empty.begin() == empty.end()) << std::noboolalpha << endl;
+        break;
+    }
+    case 26: {
+        cout << "=== Test saved snapshots: save, loadMapped, load and bad files ===" << endl << endl;
+
+        // the multiples of 3 below 90, in random order
+        const int size = 30;
+        const std::string path = "test26-snapshot.bin";
+        int values[size];
+        generateShuffledInts(size, values);
+        for (int value : values)
+            avl.add(value * 3);
+        avl.save(path);
+
+        // the mapped snapshot answers lookups from the file
+        FrozenAVL<int> mapped = AVL<int>::loadMapped(path);
+        cout << "mapped, height: " << mapped.height() << ", size: " << mapped.size() << endl << "values:";
+        for (int value : mapped)
+            cout << " " << value;
+        cout << endl;
+        for (int value : {0, 40, 42, 87, 90}) {
+            unsigned compares;
+            const bool found = mapped.find(value, compares);
+            cout << value << ": found: " << std::boolalpha << found << std::noboolalpha << ", compares: " << compares
+                 << ", rank: " << mapped.rank(value) << endl;
+        }
+        cout << "[10, 40], count: " << mapped.countInRange(10, 40) << endl << endl;
+
+        // and turns back into a tree that can change
+        AVL<int> loaded;
+        loaded.load(path);
+        cout << "loaded, same as the original: " << std::boolalpha
+             << (loaded.printInorder().str() == avl.printInorder().str()) << std::noboolalpha << endl;
+        loaded.add(1000);
+        loaded.remove(0);
+        cout << "then 1000 added and 0 removed:" << endl;
+        printAVL(loaded);
+        cout << endl;
+
+        // a flipped byte in the values, a snapshot of another type and no file at all
+        {
+            std::FILE* file = std::fopen(path.c_str(), "r+b");
+            std::fseek(file, 64 + 5 * sizeof(int), SEEK_SET);
+            std::fputc(0x7f, file);
+            std::fclose(file);
+        }
+        try {
+            loaded.load(path);
+        } catch (const SnapshotException& e) {
+            cout << "corrupted file, exception: " << e.what() << endl;
+        }
+        cout << "the tree is kept, size: " << loaded.size() << endl;
+        cout << "corrupted file without checking, size: " << AVL<int>::loadMapped(path, false).size() << endl;
+        try {
+            AVL<double>::loadMapped(path, false);
+        } catch (const SnapshotException& e) {
+            cout << "loaded as doubles, exception: " << e.what() << endl;
+        }
+        std::remove(path.c_str());
+        try {
+            AVL<int>::loadMapped(path);
+        } catch (const SnapshotException& e) {
+            cout << "missing file, exception: " << e.what() << endl;
+        }
+
+        // an empty tree saves and loads too
+        AVL<int>().save(path);
+        cout << "empty snapshot, size: " << AVL<int>::loadMapped(path).size() << endl;
+        std::remove(path.c_str());
+        break;
+    }
+    case 27: {
+        cout << "=== Test durable trees: log, commit, recovery and checkpoints ===" << endl << endl;
+
+        const std::string path = "test27";
+        const std::string logPath = path + ".log";
+        const std::string snapshotPath = path + ".snapshot";
+        std::remove(logPath.c_str());
+        std::remove(snapshotPath.c_str());
+        const int size = 20;
+        int values[size];
+        generateShuffledInts(size, values);
+
+        // the adds and removes go to the log
+        {
+            DurableAVL<int> durable(path);
+            for (int value : values)
+                durable.add(value);
+            for (int i = 0; i < size; i += 3)
+                durable.remove(i);
+            durable.commit();
+            cout << "after 20 adds and 7 removes, log records: " << durable.logRecords() << endl;
+            try {
+                durable.add(1);
+            } catch (const BSTException& e) {
+                cout << "add of 1 again, exception: " << e.what() << endl;
+            }
+        }
+
+        // and come back from it
+        {
+            DurableAVL<int> durable(path);
+            cout << "recovered from the log, records replayed: " << durable.recoveredRecords() << endl;
+            printAVL(durable.tree());
+
+            // a checkpoint starts the log over, and the destructor commits what is left
+            durable.checkpoint();
+            cout << "after a checkpoint, log records: " << durable.logRecords() << endl;
+            durable.add(100);
+            durable.remove(1);
+        }
+        {
+            DurableAVL<int> durable(path);
+            cout << "recovered from the snapshot and the log, records replayed: " << durable.recoveredRecords()
+                 << endl << "inorder: " << durable.tree().printInorder().str() << endl;
+        }
+
+        // a torn frame at the end of the log (as if the process died while writing it) is dropped
+        {
+            std::FILE* file = std::fopen(logPath.c_str(), "ab");
+            const unsigned char torn[] = {0x46, 0x52, 0x41, 0x4d, 5, 0, 0, 0, 1, 2, 3};
+            std::fwrite(torn, 1, sizeof(torn), file);
+            std::fclose(file);
+        }
+        {
+            DurableAVL<int> durable(path);
+            cout << "recovered with a torn frame, records replayed: " << durable.recoveredRecords()
+                 << ", size: " << durable.tree().size() << endl;
+            durable.add(200);
+        }
+        {
+            DurableAVL<int> durable(path);
+            cout << "and again after one more add, records replayed: " << durable.recoveredRecords()
+                 << ", size: " << durable.tree().size() << endl << endl;
+        }
+        std::remove(logPath.c_str());
+        std::remove(snapshotPath.c_str());
+
+        // a checkpoint every 8 records keeps the log short
+        {
+            DurableAVL<int> durable(path, DurableAVLConfig(std::chrono::milliseconds(1), 8));
+            for (int value : values)
+                durable.add(value);
+            cout << "checkpoint every 8 records, after 20 adds, log records: " << durable.logRecords() << endl;
+        }
+        {
+            DurableAVL<int> durable(path);
+            cout << "recovered, records replayed: " << durable.recoveredRecords()
+                 << ", size: " << durable.tree().size() << endl;
+        }
+        std::remove(logPath.c_str());
+        std::remove(snapshotPath.c_str());
+        break;
+    }
+    case 28: {
+        cout << "=== Test persistent trees: versions, snapshots and readers ===" << endl << endl;
+
+        const int size = 15;
+        int values[size];
+        generateShuffledInts(size, values);
+        PersistentAVL<int> persistent;
+        for (int value : values)
+            persistent.add(value);
+
+        // a snapshot keeps its version as the writer goes on
+        PersistentAVL<int>::Snapshot first = persistent.snapshot();
+        for (int i = 0; i < size; i += 2)
+            persistent.remove(i);
+        persistent.add(100);
+        PersistentAVL<int>::Snapshot second = persistent.snapshot();
+        cout << "first, size: " << first.size() << ", height: " << first.height()
+             << ", inorder: " << first.printInorder().str() << endl;
+        cout << "second, size: " << second.size() << ", height: " << second.height()
+             << ", inorder: " << second.printInorder().str() << endl;
+        for (int value : {4, 7, 100}) {
+            unsigned firstCompares, secondCompares;
+            const bool inFirst = first.find(value, firstCompares);
+            const bool inSecond = second.find(value, secondCompares);
+            cout << "  " << value << ": in first: " << std::boolalpha << inFirst << " (" << firstCompares
+                 << " compares), in second: " << inSecond << std::noboolalpha << " (" << secondCompares << " compares)"
+                 << endl;
+        }
+        try {
+            persistent.add(100);
+        } catch (const BSTException& e) {
+            cout << "add of 100 again, exception: " << e.what() << endl;
+        }
+        try {
+            persistent.remove(0);
+        } catch (const BSTException& e) {
+            cout << "remove of 0 again, exception: " << e.what() << endl;
+        }
+
+        // the old nodes go back to the allocator once no snapshot can reach them
+        for (int round = 0; round < 200; ++round) {
+            persistent.add(1000 + round);
+            persistent.remove(1000 + round);
+        }
+        const size_t held = persistent.retiredCount();
+        first = persistent.snapshot();
+        second = persistent.snapshot();
+        for (int round = 0; round < 200; ++round) {
+            persistent.add(1000 + round);
+            persistent.remove(1000 + round);
+        }
+        cout << std::boolalpha << "retired nodes held back by the old snapshots: " << (held > 0)
+             << ", reclaimed once they are released: " << (persistent.retiredCount() < held) << std::noboolalpha
+             << endl << endl;
+
+        // readers on other threads see whole versions while the writer adds 0, 1, 2, ... in order
+        PersistentAVL<int> counting;
+        std::atomic<bool> done(false);
+        std::atomic<bool> whole(true);
+        std::vector<std::thread> readers;
+        for (int reader = 0; reader < 2; ++reader) {
+            readers.emplace_back([&counting, &done, &whole] {
+                while (!done.load()) {
+                    PersistentAVL<int>::Snapshot snapshot = counting.snapshot();
+                    const int count = static_cast<int>(snapshot.size());
+                    unsigned compares;
+                    if ((count && !snapshot.find(count - 1, compares)) || snapshot.find(count, compares))
+                        whole.store(false);
+                }
+            });
+        }
+        for (int i = 0; i < 10000; ++i)
+            counting.add(i);
+        done.store(true);
+        for (std::thread& reader : readers)
+            reader.join();
+        cout << "after 10000 adds, size: " << counting.size() << ", readers saw whole versions: " << std::boolalpha
+             << whole.load() << std::noboolalpha << endl;
+        break;
+    }
+    case 29: {
+        cout << "=== Test that the blocks of configs without an alignment boundary stay aligned ===" << endl << endl;
+
+        // - pages of 16 and 7 objects have in-use bitmaps of 2 and 1 bytes before their blocks
+        // - and the headers and pads push the objects by 5, 8 (+2 user-defined), 8 and 2 bytes
+        SimpleAllocatorConfig padConfig(false, 16, 0);
+        padConfig.padBytesSize = 2;
+        const std::pair<const char*, SimpleAllocatorConfig> configs[] = {
+            {"default", SimpleAllocatorConfig()},
+            {"16 per page", SimpleAllocatorConfig(false, 16, 0)},
+            {"7 per page", SimpleAllocatorConfig(false, 7, 0)},
+            {"basic header", SimpleAllocatorConfig(false, 7, 0, SimpleAllocatorConfig::HeaderBlockInfo(
+                                                                   SimpleAllocatorConfig::BASIC_HEADER))},
+            {"extended header", SimpleAllocatorConfig(false, 7, 0, SimpleAllocatorConfig::HeaderBlockInfo(
+                                                                      SimpleAllocatorConfig::EXTENDED_HEADER, 0, 2))},
+            {"external header", SimpleAllocatorConfig(false, 7, 0, SimpleAllocatorConfig::HeaderBlockInfo(
+                                                                      SimpleAllocatorConfig::EXTERNAL_HEADER))},
+            {"2 pad bytes", padConfig},
+        };
+        for (const auto& config : configs) {
+            cout << config.first << ":";
+            // - the node size depends on the tree, so it is not printed
+            for (size_t size : {size_t(8), size_t(12), size_t(16), size_t(40), size_t(100),
+                                sizeof(AVL<int>::BinTreeNode)}) {
+                // the natural alignment of the size (at least a pointer's)
+                const size_t alignment = std::max(std::min(size & (~size + 1), alignof(std::max_align_t)),
+                                                  alignof(void*));
+                SimpleAllocator allocator(size, config.second);
+                std::vector<void*> objects;
+                bool aligned = true;
+                // - as many as the default config holds (3 pages of 4)
+                for (int i = 0; i < 12; ++i) {
+                    objects.push_back(allocator.allocate());
+                    aligned = aligned && reinterpret_cast<uintptr_t>(objects.back()) % alignment == 0;
+                }
+                for (void* object : objects)
+                    allocator.free(object);
+                if (size == sizeof(AVL<int>::BinTreeNode))
+                    cout << " nodes " << (aligned ? "aligned" : "MISALIGNED");
+                else
+                    cout << " " << size << " bytes " << (aligned ? "aligned" : "MISALIGNED") << ",";
+            }
+            cout << endl;
+        }
+        cout << endl;
+
+        // a tree on pages of 7 nodes
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 7, 0));
+        AVL<int> smallPagesAVL(&allocator);
+        addInts<int>(smallPagesAVL, 20, false, true);
+        inorderSS = smallPagesAVL.printInorder();
+        cout << "tree on pages of 7 nodes, inorder: " << inorderSS.str() << endl;
+        break;
+    }
+    case 30: {
+        cout << "=== Test freeing foreign, interior and already freed pointers ===" << endl << endl;
+
+        // the in-use bits on the page catch these for every header type
+        const std::pair<const char*, SimpleAllocatorConfig::HeaderType> headerTypes[] = {
+            {"no header", SimpleAllocatorConfig::NO_HEADER},
+            {"basic header", SimpleAllocatorConfig::BASIC_HEADER},
+            {"extended header", SimpleAllocatorConfig::EXTENDED_HEADER},
+            {"external header", SimpleAllocatorConfig::EXTERNAL_HEADER},
+        };
+        for (const auto& headerType : headerTypes) {
+            cout << headerType.first << ":" << endl;
+            const SimpleAllocatorConfig config(false, 8, 0,
+                                               SimpleAllocatorConfig::HeaderBlockInfo(headerType.second, 0, 2));
+            SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), config);
+            SimpleAllocator otherAllocator(sizeof(AVL<int>::BinTreeNode), config);
+            unsigned char* pObject = static_cast<unsigned char*>(allocator.allocate());
+            void* pKept = allocator.allocate();
+            void* pOther = otherAllocator.allocate();
+            int* pHeap = new int(0);
+
+            auto tryFree = [&allocator](const char* what, void* pointer) {
+                try {
+                    allocator.free(pointer);
+                    cout << "  " << what << ": freed" << endl;
+                } catch (const SimpleAllocatorException& e) {
+                    const char* code = e.code() == SimpleAllocatorException::E_BAD_BOUNDARY    ? "E_BAD_BOUNDARY"
+                                       : e.code() == SimpleAllocatorException::E_MULTIPLE_FREE ? "E_MULTIPLE_FREE"
+                                                                                                : "other";
+                    cout << "  " << what << ": " << code << ", " << e.what() << endl;
+                }
+            };
+            tryFree("heap pointer", pHeap);
+            tryFree("block of another allocator", pOther);
+            tryFree("inside a block", pObject + 1);
+            tryFree("just before a block", pObject - 1);
+            tryFree("block", pObject);
+            tryFree("block again", pObject);
+
+            // the failed frees changed nothing
+            const SimpleAllocatorStats stats = allocator.getStats();
+            cout << "  objectsInUse: " << stats.objectsInUse << ", deallocations: " << stats.deallocations << endl;
+            allocator.free(pKept);
+            otherAllocator.free(pOther);
+            delete pHeap;
+        }
+        break;
+    }
+    case 31: {
+        cout << "=== Test several AVL trees sharing a thread-cached allocator across threads ===" << endl << endl;
+        stressThreadCached(4, 5000);
+
+        // a block freed into a magazine stays in use on its page, so its header has to catch a second free
+        SimpleAllocatorConfig config(false, 16, 0,
+                                     SimpleAllocatorConfig::HeaderBlockInfo(SimpleAllocatorConfig::BASIC_HEADER));
+        config.concurrency = SimpleAllocatorConfig::THREAD_CACHED;
+        config.magazineSize = 8;
+        SimpleAllocator allocator(sizeof(int), config);
+        void* pFirst = allocator.allocate();
+        void* pSecond = allocator.allocate();
+        allocator.free(pFirst);
+        try {
+            allocator.free(pFirst);
+        } catch (const SimpleAllocatorException& e) {
+            cout << "freeing a block in the magazine again, exception: " << e.what() << endl;
+        }
+        try {
+            allocator.freeBatch(&pFirst, 1);
+        } catch (const SimpleAllocatorException& e) {
+            cout << "freeing it again in a batch, exception: " << e.what() << endl;
+        }
+        allocator.free(pSecond);
+        SimpleAllocatorStats stats = allocator.getStats();
+        cout << "allocations: " << stats.allocations << ", deallocations: " << stats.deallocations
+             << ", objectsInUse: " << stats.objectsInUse << endl;
+        break;
+    }
+    case 32: {
+        cout << "=== Test that the blocks of every size class are aligned for objects of its size ===" << endl << endl;
+
+        // - a basic header is 5 bytes, so only the class's own boundary keeps its objects aligned
+        // - and a 12 byte boundary only aligns objects on 4 bytes unless a class raises it to a multiple
+        const std::pair<const char*, SimpleAllocatorConfig> configs[] = {
+            {"no header", SimpleAllocatorConfig(false, 16, 0)},
+            {"basic header", SimpleAllocatorConfig(false, 16, 0,
+                                                   SimpleAllocatorConfig::HeaderBlockInfo(
+                                                       SimpleAllocatorConfig::BASIC_HEADER))},
+            {"basic header, 12 byte boundary", SimpleAllocatorConfig(false, 16, 0,
+                                                                     SimpleAllocatorConfig::HeaderBlockInfo(
+                                                                         SimpleAllocatorConfig::BASIC_HEADER),
+                                                                     12)},
+        };
+        for (const auto& config : configs) {
+            cout << config.first << ":" << endl;
+            SizeClassAllocator pool(config.second);
+            for (size_t size : {1, 8, 12, 24, 40, 64, 100, 200, 512, 1024}) {
+                // the strictest alignment an object of the class size may need
+                const size_t sizeClass = SizeClassAllocator::sizeClassOf(size);
+                const size_t classSize = SizeClassAllocator::classSize(sizeClass);
+                const size_t alignment = std::min(classSize & (~classSize + 1), alignof(std::max_align_t));
+                std::vector<void*> objects;
+                bool aligned = true;
+                for (int i = 0; i < 20; ++i) {
+                    objects.push_back(pool.allocate(size));
+                    aligned = aligned && reinterpret_cast<uintptr_t>(objects.back()) % alignment == 0;
+                }
+                for (void* object : objects)
+                    pool.free(object, size);
+                cout << "  size: " << size << ", class size: " << classSize << ", "
+                     << (aligned ? "aligned" : "MISALIGNED") << endl;
+            }
+        }
+        cout << endl;
+
+        // nodes of a tree through the class path with basic headers
+        SizeClassAllocator pool(configs[1].second);
+        AVL<int> classAVL(&pool.allocatorFor(sizeof(AVL<int>::BinTreeNode)));
+        addInts<int>(classAVL, 20, false, true);
+        inorderSS = classAVL.printInorder();
+        cout << "tree on a size class with basic headers, inorder: " << inorderSS.str() << endl;
+        break;
+    }
+    case 33: {
+        cout << "=== Test filling a pool up to its page limit and reusing its free list ===" << endl << endl;
+        // 3 pages of 4 blocks, so the 13th allocation finds no page
+        SimpleAllocator allocator(sizeof(AVL<int>::BinTreeNode), SimpleAllocatorConfig(false, 4, 3));
+        std::vector<void*> objects;
+        for (int i = 0; i < 12; ++i)
+            objects.push_back(allocator.allocate());
+        SimpleAllocatorStats stats = allocator.getStats();
+        cout << "after 12 allocations, pagesInUse: " << stats.pagesInUse << ", objectsInUse: " << stats.objectsInUse
+             << ", freeObjects: " << stats.freeObjects << endl;
+        try {
+            allocator.allocate();
+        } catch (const SimpleAllocatorException& e) {
+            cout << "13th allocation, E_NO_PAGE: " << std::boolalpha
+                 << (e.code() == SimpleAllocatorException::E_NO_PAGE) << std::noboolalpha
+                 << ", exception: " << e.what() << endl;
+        }
+        stats = allocator.getStats();
+        cout << "after the failed allocation, allocations: " << stats.allocations
+             << ", objectsInUse: " << stats.objectsInUse << endl << endl;
+
+        // freed blocks come back off the free list, last freed first, without a new page
+        allocator.free(objects[5]);
+        allocator.free(objects[2]);
+        void* pFirst = allocator.allocate();
+        void* pSecond = allocator.allocate();
+        stats = allocator.getStats();
+        cout << "reallocated the last freed block first: " << std::boolalpha << (pFirst == objects[2])
+             << ", then the one before: " << (pSecond == objects[5]) << std::noboolalpha
+             << ", pagesInUse: " << stats.pagesInUse << endl << endl;
+
+        // once everything is freed, a tree of 12 nodes fits in the same pages
+        for (void* pObject : objects)
+            allocator.free(pObject);
+        AVL<int> fullAVL(&allocator);
+        addInts<int>(fullAVL, 12, true, true);
+        stats = allocator.getStats();
+        cout << "tree of " << fullAVL.size() << " nodes, pagesInUse: " << stats.pagesInUse
+             << ", objectsInUse: " << stats.objectsInUse << ", freeObjects: " << stats.freeObjects
+             << ", deallocations: " << stats.deallocations << endl;
+        fullAVL.clear();
+        break;
+    }
     default:
         cout << "Please select a valid test." << endl;
         break;